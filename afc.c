@@ -0,0 +1,175 @@
+/******************************************************************************/
+/* PiCC1101  - Radio serial link using CC1101 module and Raspberry-Pi         */
+/*                                                                            */
+/* Automatic frequency control                                                */
+/*                                                                            */
+/* The frequency offset estimate (FREQEST) of each good block is averaged per */
+/* peer. Every few blocks the mean of the peer averages is added to the       */
+/* frequency offset register (FSCTRL0) of all modules. Only half of it is     */
+/* applied at a time so that two nodes doing the same do not chase each       */
+/* other since the offset moves both the Rx and Tx frequencies.               */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#include <math.h>
+#include <string.h>
+
+#include "afc.h"
+#include "util.h"
+
+static uint8_t    afc_active;                 // AFC is engaged
+static int8_t     afc_offset;                 // Current frequency offset in FSCTRL0 units
+static float      afc_step_hz;                // Frequency offset unit in Hz
+static uint32_t   afc_blocks;                 // Good blocks since the last correction
+static afc_peer_t afc_peers[AFC_MAX_PEERS];
+
+// === Static functions declarations ==============================================================
+
+static afc_peer_t *afc_get_peer(uint8_t address);
+
+// === Static functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Get peer by address. Allocates a new slot if necessary. When the table is full the last slot
+// is recycled.
+afc_peer_t *afc_get_peer(uint8_t address)
+// ------------------------------------------------------------------------------------------------
+{
+    int i;
+
+    for (i=0; i<AFC_MAX_PEERS; i++)
+    {
+        if ((afc_peers[i].in_use) && (afc_peers[i].address == address))
+        {
+            return &afc_peers[i];
+        }
+    }
+
+    for (i=0; i<AFC_MAX_PEERS-1; i++)
+    {
+        if (!afc_peers[i].in_use)
+        {
+            break;
+        }
+    }
+
+    memset(&afc_peers[i], 0, sizeof(afc_peer_t));
+    afc_peers[i].in_use = 1;
+    afc_peers[i].address = address;
+
+    return &afc_peers[i];
+}
+
+// === Public functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Initialize automatic frequency control
+void afc_init(radio_parms_t *radio_parms, arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    afc_active = arguments->afc;
+    afc_offset = 0;
+    afc_step_hz = radio_parms->f_xtal / (float) (1<<14);
+    afc_blocks = 0;
+    memset(afc_peers, 0, sizeof(afc_peers));
+
+    if (afc_active)
+    {
+        verbprintf(1, "AFC: correction every %d good blocks by steps of %.1f Hz\n", AFC_WINDOW, afc_step_hz);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Account for the frequency offset estimate of a good block received from a peer
+void afc_rx_block(uint8_t address, int8_t freqest)
+// ------------------------------------------------------------------------------------------------
+{
+    afc_peer_t *peer;
+
+    if (!afc_active)
+    {
+        return;
+    }
+
+    peer = afc_get_peer(address);
+
+    if (peer->blocks == 0)
+    {
+        peer->offset_avg = freqest;
+    }
+    else
+    {
+        peer->offset_avg += (freqest - peer->offset_avg) / 8.0;
+    }
+
+    peer->blocks++;
+    afc_blocks++;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Correct the frequency offset once enough good blocks have been received
+void afc_check()
+// ------------------------------------------------------------------------------------------------
+{
+    float   mean = 0.0;
+    int     i, nb_peers = 0, offset, delta;
+
+    if ((!afc_active) || (afc_blocks < AFC_WINDOW))
+    {
+        return;
+    }
+
+    afc_blocks = 0;
+
+    for (i=0; i<AFC_MAX_PEERS; i++)
+    {
+        if ((afc_peers[i].in_use) && (afc_peers[i].blocks))
+        {
+            mean += afc_peers[i].offset_avg;
+            nb_peers++;
+        }
+    }
+
+    if (nb_peers == 0)
+    {
+        return;
+    }
+
+    mean /= nb_peers;
+
+    if (fabs(mean) < AFC_DEADBAND)
+    {
+        return;
+    }
+
+    offset = afc_offset + (int) lroundf(mean / 2.0);
+
+    if (offset > 127)
+    {
+        offset = 127;
+    }
+    else if (offset < -128)
+    {
+        offset = -128;
+    }
+
+    delta = offset - afc_offset;
+
+    if (delta == 0)
+    {
+        return;
+    }
+
+    for (i=0; i<AFC_MAX_PEERS; i++) // estimates are relative to the new offset from now on
+    {
+        afc_peers[i].offset_avg -= delta;
+    }
+
+    afc_offset = offset;
+    radio_set_freq_offset(afc_offset);
+
+    verbprintf(1, "AFC: frequency offset %d (%.1f Hz) for a mean estimate of %.1f over %d peers\n",
+        afc_offset, afc_offset * afc_step_hz, mean, nb_peers);
+}
@@ -0,0 +1,34 @@
+/******************************************************************************/
+/* PiCC1101  - Radio serial link using CC1101 module and Raspberry-Pi         */
+/*                                                                            */
+/* Automatic frequency control                                                */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef _AFC_H_
+#define _AFC_H_
+
+#include <stdint.h>
+
+#include "main.h"
+#include "radio.h"
+
+#define AFC_MAX_PEERS    8     // Number of peers tracked
+#define AFC_WINDOW      16     // Number of good blocks between corrections
+#define AFC_DEADBAND   1.0     // Minimum average offset in FREQEST units that triggers a correction
+
+typedef struct afc_peer_s
+{
+    uint8_t  in_use;          // Peer slot is allocated
+    uint8_t  address;         // Peer link address
+    uint32_t blocks;          // Number of good blocks received
+    float    offset_avg;      // Running average of the frequency offset estimate in FREQEST units
+} afc_peer_t;
+
+void afc_init(radio_parms_t *radio_parms, arguments_t *arguments);
+void afc_rx_block(uint8_t address, int8_t freqest);
+void afc_check();
+
+#endif
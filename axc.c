@@ -0,0 +1,317 @@
+/******************************************************************************/
+/* PiCC1101  - Radio serial link using CC1101 module and Raspberry-Pi         */
+/*                                                                            */
+/* AX.25 address header compression on the radio link                         */
+/*                                                                            */
+/* Address fields of KISS data frames are replaced by one byte tokens:        */
+/*   0b0Hiiiiii: dictionary entry i, H is the command/response or has been    */
+/*               repeated bit (bit 7 of the SSID byte)                        */
+/*   0b10iiiiii: literal address of 7 bytes follows, store it in entry i      */
+/* Frames are unescaped KISS frames without delimiters. A compressed frame:   */
+/*   port<<4 | AXC_KISS_CMD, number of addresses, tokens,                     */
+/*   XOR checksum of the original addresses, rest of frame                    */
+/* The sender has a Tx dictionary mirrored by an Rx dictionary of the         */
+/* receiver for each sender link address. When decoding fails the receiver   */
+/* asks the senders to reset their dictionary with a link control block (see  */
+/* link.c).                                                                   */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#include <string.h>
+
+#include "axc.h"
+#include "link.h"
+#include "util.h"
+
+static axc_entry_t axc_tx_dict[AXC_DICT_SIZE];
+static axc_source_t axc_sources[AXC_MAX_SOURCES];
+static uint32_t    axc_use_count;              // Incremented at each use of a Tx dictionary entry
+static uint32_t    axc_source_count;           // Incremented at each use of an Rx dictionary
+
+// === Static functions declarations ==============================================================
+
+static int      axc_lookup(uint8_t *address);
+static int      axc_victim();
+static axc_entry_t *axc_rx_dict(uint8_t source);
+static uint32_t axc_decode_error(axc_entry_t *rx_dict);
+
+// === Static functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Look up an address in the Tx dictionary. Returns the index or -1 if not found
+int axc_lookup(uint8_t *address)
+// ------------------------------------------------------------------------------------------------
+{
+    int i;
+
+    for (i=0; i<AXC_DICT_SIZE; i++)
+    {
+        if ((axc_tx_dict[i].valid)
+            && (memcmp(axc_tx_dict[i].address, address, AXC_ADDR_LEN-1) == 0)
+            && (axc_tx_dict[i].address[AXC_ADDR_LEN-1] == (address[AXC_ADDR_LEN-1] & 0x7E)))
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Select a free or the least recently used entry of the Tx dictionary
+int axc_victim()
+// ------------------------------------------------------------------------------------------------
+{
+    int i, victim = 0;
+
+    for (i=0; i<AXC_DICT_SIZE; i++)
+    {
+        if (!axc_tx_dict[i].valid)
+        {
+            return i;
+        }
+
+        if (axc_tx_dict[i].last_used < axc_tx_dict[victim].last_used)
+        {
+            victim = i;
+        }
+    }
+
+    return victim;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Get the Rx dictionary of a sender by link address. Allocates a new one if necessary replacing
+// the least recently used when all are taken.
+axc_entry_t *axc_rx_dict(uint8_t source)
+// ------------------------------------------------------------------------------------------------
+{
+    int i, victim = 0;
+
+    for (i=0; i<AXC_MAX_SOURCES; i++)
+    {
+        if ((axc_sources[i].in_use) && (axc_sources[i].address == source))
+        {
+            axc_sources[i].last_used = axc_source_count++;
+            return axc_sources[i].dict;
+        }
+    }
+
+    for (i=0; i<AXC_MAX_SOURCES; i++)
+    {
+        if (!axc_sources[i].in_use)
+        {
+            victim = i;
+            break;
+        }
+
+        if (axc_sources[i].last_used < axc_sources[victim].last_used)
+        {
+            victim = i;
+        }
+    }
+
+    memset(&axc_sources[victim], 0, sizeof(axc_source_t));
+    axc_sources[victim].in_use = 1;
+    axc_sources[victim].address = source;
+    axc_sources[victim].last_used = axc_source_count++;
+
+    return axc_sources[victim].dict;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Frame cannot be decoded: forget the Rx dictionary of its sender and ask the senders to reset
+// their Tx dictionary
+uint32_t axc_decode_error(axc_entry_t *rx_dict)
+// ------------------------------------------------------------------------------------------------
+{
+    verbprintf(1, "AXC: cannot decode frame, dropped. Requesting dictionary reset\n");
+    memset(rx_dict, 0, AXC_DICT_SIZE * sizeof(axc_entry_t));
+    link_request_axc_reset();
+    return 0;
+}
+
+// === Public functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Clear all dictionaries
+void axc_init()
+// ------------------------------------------------------------------------------------------------
+{
+    memset(axc_tx_dict, 0, sizeof(axc_tx_dict));
+    memset(axc_sources, 0, sizeof(axc_sources));
+    axc_use_count = 0;
+    axc_source_count = 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Clear the Tx dictionary at the request of the peer. Next addresses are sent literally.
+void axc_reset_tx()
+// ------------------------------------------------------------------------------------------------
+{
+    verbprintf(1, "AXC: peer requested dictionary reset\n");
+    memset(axc_tx_dict, 0, sizeof(axc_tx_dict));
+}
+
+// ------------------------------------------------------------------------------------------------
+// Compress the address field of an unescaped KISS frame starting with the KISS command byte.
+// Output may be up to AXC_MAX_GROWTH bytes larger. Returns the number of bytes written.
+uint32_t axc_compress(uint8_t *frame, uint32_t len, uint8_t *out)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t  *address, checksum = 0;
+    int      nb_addr = 0, i, j, index;
+    uint32_t o = 0, header_len;
+
+    if ((len > 0) && ((frame[0] & 0x0F) == 0)) // data frame: look for address field end
+    {
+        for (nb_addr = 0; nb_addr < AXC_MAX_ADDR; )
+        {
+            if ((uint32_t) (1 + AXC_ADDR_LEN*(nb_addr+1)) > len)
+            {
+                nb_addr = 0; // truncated
+                break;
+            }
+
+            address = &frame[1 + AXC_ADDR_LEN*nb_addr];
+            nb_addr++;
+
+            if (address[AXC_ADDR_LEN-1] & 0x01) // extension bit: last address
+            {
+                break;
+            }
+        }
+
+        if ((nb_addr < 2) || !(frame[AXC_ADDR_LEN*nb_addr] & 0x01))
+        {
+            nb_addr = 0;
+        }
+    }
+
+    if (nb_addr == 0) // not compressible: copy as is
+    {
+        memcpy(out, frame, len);
+        return len;
+    }
+
+    header_len = 1 + AXC_ADDR_LEN*nb_addr;
+    out[o++] = (frame[0] & 0xF0) | AXC_KISS_CMD;
+    out[o++] = nb_addr;
+
+    for (i=0; i<nb_addr; i++)
+    {
+        address = &frame[1 + AXC_ADDR_LEN*i];
+        index = axc_lookup(address);
+
+        for (j=0; j<AXC_ADDR_LEN; j++)
+        {
+            checksum ^= address[j];
+        }
+
+        if (index < 0) // new address: send literal and store
+        {
+            index = axc_victim();
+            memcpy(axc_tx_dict[index].address, address, AXC_ADDR_LEN);
+            axc_tx_dict[index].address[AXC_ADDR_LEN-1] &= 0x7E;
+            axc_tx_dict[index].valid = 1;
+            out[o++] = 0x80 | index;
+            memcpy(&out[o], address, AXC_ADDR_LEN);
+            o += AXC_ADDR_LEN;
+        }
+        else
+        {
+            out[o++] = ((address[AXC_ADDR_LEN-1] & 0x80) ? 0x40 : 0x00) | index;
+        }
+
+        axc_tx_dict[index].last_used = axc_use_count++;
+    }
+
+    out[o++] = checksum;
+    memcpy(&out[o], &frame[header_len], len - header_len);
+    o += len - header_len;
+
+    return o;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Restore the address field of a compressed frame with the Rx dictionary of the link address it
+// was received from. Output may be up to AXC_MAX_EXPANSION bytes larger. Returns the number of
+// bytes written or 0 if the frame cannot be decoded in which case a dictionary reset is requested.
+uint32_t axc_expand(uint8_t *frame, uint32_t len, uint8_t *out, uint8_t source)
+// ------------------------------------------------------------------------------------------------
+{
+    axc_entry_t *rx_dict;
+    uint8_t  *address, token, checksum = 0;
+    int      nb_addr, i, j, index;
+    uint32_t o = 0, p = 2;
+
+    if ((len < 2) || ((frame[0] & 0x0F) != AXC_KISS_CMD)) // not compressed: copy as is
+    {
+        memcpy(out, frame, len);
+        return len;
+    }
+
+    rx_dict = axc_rx_dict(source);
+    nb_addr = frame[1];
+
+    if ((nb_addr < 2) || (nb_addr > AXC_MAX_ADDR))
+    {
+        return axc_decode_error(rx_dict);
+    }
+
+    out[o++] = frame[0] & 0xF0;
+
+    for (i=0; i<nb_addr; i++)
+    {
+        if (p >= len)
+        {
+            return axc_decode_error(rx_dict);
+        }
+
+        token = frame[p++];
+        index = token & 0x3F;
+
+        if (token & 0x80) // literal
+        {
+            if (p + AXC_ADDR_LEN > len)
+            {
+                return axc_decode_error(rx_dict);
+            }
+
+            address = &frame[p];
+            p += AXC_ADDR_LEN;
+            memcpy(rx_dict[index].address, address, AXC_ADDR_LEN);
+            rx_dict[index].address[AXC_ADDR_LEN-1] &= 0x7E;
+            rx_dict[index].valid = 1;
+            memcpy(&out[o], address, AXC_ADDR_LEN);
+        }
+        else if (rx_dict[index].valid)
+        {
+            memcpy(&out[o], rx_dict[index].address, AXC_ADDR_LEN);
+            out[o + AXC_ADDR_LEN-1] |= ((token & 0x40) ? 0x80 : 0x00) | ((i == nb_addr-1) ? 0x01 : 0x00);
+        }
+        else
+        {
+            return axc_decode_error(rx_dict);
+        }
+
+        for (j=0; j<AXC_ADDR_LEN; j++)
+        {
+            checksum ^= out[o+j];
+        }
+
+        o += AXC_ADDR_LEN;
+    }
+
+    if ((p >= len) || (frame[p++] != checksum))
+    {
+        return axc_decode_error(rx_dict);
+    }
+
+    memcpy(&out[o], &frame[p], len - p);
+    o += len - p;
+
+    return o;
+}
@@ -0,0 +1,45 @@
+/******************************************************************************/
+/* PiCC1101  - Radio serial link using CC1101 module and Raspberry-Pi         */
+/*                                                                            */
+/* AX.25 address header compression on the radio link                         */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef _AXC_H_
+#define _AXC_H_
+
+#include <stdint.h>
+
+#include "main.h"
+
+#define AXC_DICT_SIZE   64    // Number of addresses in a dictionary (6 bit index)
+#define AXC_MAX_SOURCES  8    // Number of senders with an Rx dictionary
+#define AXC_MAX_ADDR    10    // Destination, source and up to 8 digipeaters
+#define AXC_ADDR_LEN     7    // Callsign (6 bytes) and SSID byte
+#define AXC_KISS_CMD  0x0E    // KISS command code marking a compressed frame on the radio link
+#define AXC_MAX_GROWTH     (2 + AXC_MAX_ADDR)                // Compressed frame may be larger by this
+#define AXC_MAX_EXPANSION  ((AXC_ADDR_LEN-1) * AXC_MAX_ADDR)  // Expanded frame may be larger by this
+
+typedef struct axc_entry_s
+{
+    uint8_t  valid;                  // Entry is in use
+    uint8_t  address[AXC_ADDR_LEN];  // Address with command/response, has been repeated and extension bits cleared
+    uint32_t last_used;              // Use counter value at last use for replacement of least recently used
+} axc_entry_t;
+
+typedef struct axc_source_s
+{
+    uint8_t     in_use;              // Dictionary is allocated
+    uint8_t     address;             // Link address of the sender. 0 if blocks are not addressed
+    uint32_t    last_used;           // Use counter value at last use for replacement of least recently used
+    axc_entry_t dict[AXC_DICT_SIZE]; // Mirror of the Tx dictionary of the sender
+} axc_source_t;
+
+void     axc_init();
+void     axc_reset_tx();
+uint32_t axc_compress(uint8_t *frame, uint32_t len, uint8_t *out);
+uint32_t axc_expand(uint8_t *frame, uint32_t len, uint8_t *out, uint8_t source);
+
+#endif
@@ -0,0 +1,285 @@
+/******************************************************************************/
+/* PiCC1101  - Radio serial link using CC1101 module and Raspberry-Pi         */
+/*                                                                            */
+/* Multi-radio bonding                                                        */
+/*                                                                            */
+/* Several modules on consecutive channels carry a superframe in parallel.    */
+/* The superframe is cut in as many stripes as there are modules and each     */
+/* stripe is sent as a packet by its own module, blocks of the same rank      */
+/* being sent at the same time. A stripe starts with the superframe sequence  */
+/* number and its index and count of stripes so the receiver can put the      */
+/* superframe back together whichever module it was received on.              */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bond.h"
+#include "hop.h"
+#include "util.h"
+
+static uint8_t      bond_active;                                  // Bonding is engaged
+static int          bond_nb_units;                                // Number of bonded modules including the first one
+static spi_parms_t  bond_spi_parms[RADIO_MAX_UNITS-1];            // SPI links of the additional modules
+static spi_parms_t *bond_units[RADIO_MAX_UNITS];                  // SPI links of all bonded modules
+static uint8_t      bond_tx_seq;                                  // Sequence number of the next superframe sent
+static uint8_t      bond_tx[RADIO_MAX_UNITS][BOND_STRIPE_SIZE];   // Stripes to send
+static uint8_t      bond_rx[RADIO_MAX_UNITS][BOND_STRIPE_SIZE];   // Stripes received by stripe index
+static uint32_t     bond_rx_size[RADIO_MAX_UNITS];                // Size of the stripes received
+static uint8_t      bond_rx_seq;                                  // Sequence number of the superframe being reassembled
+static uint8_t      bond_rx_count;                                // Number of stripes of this superframe. Zero if none.
+static uint8_t      bond_rx_mask;                                 // Stripes of this superframe received so far
+static uint8_t      bond_packet[RADIO_BUFSIZE];                   // Packet received by a module
+
+// === Static functions declarations ==============================================================
+
+static int bond_parse_gdo(char **gdo, int *wpi_gdo0, int *wpi_gdo2);
+
+// === Static functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Take the next GDO0,GDO2 pair from the list. Returns 0 if found.
+int bond_parse_gdo(char **gdo, int *wpi_gdo0, int *wpi_gdo2)
+// ------------------------------------------------------------------------------------------------
+{
+    char *end;
+
+    *wpi_gdo0 = strtol(*gdo, &end, 10);
+
+    if ((end == *gdo) || (*end != ','))
+    {
+        return 1;
+    }
+
+    *gdo = end + 1;
+    *wpi_gdo2 = strtol(*gdo, &end, 10);
+
+    if (end == *gdo)
+    {
+        return 1;
+    }
+
+    *gdo = (*end == ',' ? end + 1 : end);
+    return 0;
+}
+
+// === Public functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Initialize the additional modules. Module k uses the channel of the first module plus k.
+int bond_init(radio_parms_t *radio_parms, spi_parms_t *spi_parms, arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    char *devices, *device, *saveptr, *gdo = arguments->bond_gdo;
+    int  wpi_gdo0, wpi_gdo2, ret = 0;
+
+    bond_units[0] = spi_parms;
+    bond_nb_units = 1;
+    bond_active = 0;
+    bond_tx_seq = 0;
+    bond_rx_count = 0;
+    bond_rx_mask = 0;
+
+    if (!arguments->bond_spi_devices)
+    {
+        return 0;
+    }
+
+    devices = strdup(arguments->bond_spi_devices);
+    device = strtok_r(devices, ",", &saveptr);
+
+    while ((device) && (ret == 0))
+    {
+        if (bond_nb_units == RADIO_MAX_UNITS)
+        {
+            fprintf(stderr, "BOND: at most %d additional modules\n", RADIO_MAX_UNITS - 1);
+            ret = 1;
+        }
+        else if (bond_parse_gdo(&gdo, &wpi_gdo0, &wpi_gdo2))
+        {
+            fprintf(stderr, "BOND: no GDO0,GDO2 pins for %s\n", device);
+            ret = 1;
+        }
+        else
+        {
+            ret = init_radio_bonded(radio_parms, &bond_spi_parms[bond_nb_units-1], arguments, device, wpi_gdo0, wpi_gdo2, hop_channel() + bond_nb_units);
+
+            if (ret == 0)
+            {
+                bond_units[bond_nb_units] = &bond_spi_parms[bond_nb_units-1];
+                bond_nb_units++;
+            }
+        }
+
+        device = strtok_r(NULL, ",", &saveptr);
+    }
+
+    free(devices);
+    bond_active = (bond_nb_units > 1);
+    verbprintf(1, "BOND: %d modules from channel %d\n", bond_nb_units, hop_channel());
+
+    return ret;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Maximum superframe size in bytes. Stripes are limited to the number of blocks the Rx ring of a
+// module can hold while another module is being read. Without bonding the radio buffer size.
+uint32_t bond_capacity(arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    if (!bond_active)
+    {
+        return RADIO_BUFSIZE;
+    }
+
+    return bond_nb_units * (RADIO_RX_RING * radio_get_block_payload(arguments) - 1 - BOND_HEADER_SIZE);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Put the additional modules back into Rx
+void bond_turn_rx(arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    int i;
+
+    for (i=1; i<bond_nb_units; i++)
+    {
+        radio_init_rx(bond_units[i], arguments);
+        radio_turn_rx(bond_units[i]);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Send a superframe in stripes over the bonded modules. There are no more stripes than needed to
+// fill a block in each. The first module must be ready for transmission.
+void bond_send_packet(spi_parms_t *spi_parms, arguments_t *arguments, uint8_t *packet, uint32_t size)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t  *stripes[RADIO_MAX_UNITS];
+    uint32_t sizes[RADIO_MAX_UNITS], stripe_size, offset = 0;
+    uint32_t block_size = radio_get_block_payload(arguments) - BOND_HEADER_SIZE;
+    int      nb_stripes, i;
+
+    if (!bond_active)
+    {
+        radio_send_packet(spi_parms, arguments, packet, size);
+        return;
+    }
+
+    nb_stripes = (size + block_size - 1) / block_size;
+
+    if (nb_stripes > bond_nb_units)
+    {
+        nb_stripes = bond_nb_units;
+    }
+    else if (nb_stripes == 0)
+    {
+        nb_stripes = 1;
+    }
+
+    stripe_size = (size + nb_stripes - 1) / nb_stripes;
+
+    for (i=0; i<nb_stripes; i++)
+    {
+        sizes[i] = (size - offset < stripe_size ? size - offset : stripe_size);
+        bond_tx[i][0] = bond_tx_seq;
+        bond_tx[i][1] = (i<<4) + nb_stripes;
+        memcpy(&bond_tx[i][BOND_HEADER_SIZE], &packet[offset], sizes[i]);
+        offset += sizes[i];
+        sizes[i] += BOND_HEADER_SIZE;
+        stripes[i] = bond_tx[i];
+
+        if (i > 0)
+        {
+            radio_wait_free(bond_units[i]); // Make sure no radio operation is in progress
+            radio_prepare_tx(bond_units[i]); // Inhibit Rx and flush FIFOs if necessary
+        }
+    }
+
+    verbprintf(2, "BOND: superframe #%d of %d bytes in %d stripes\n", bond_tx_seq, size, nb_stripes);
+    radio_send_parallel(bond_units, nb_stripes, arguments, stripes, sizes);
+    bond_tx_seq++;
+
+    for (i=1; i<nb_stripes; i++)
+    {
+        radio_init_rx(bond_units[i], arguments);
+        radio_turn_rx(bond_units[i]);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Collect stripes from all bonded modules. Returns the superframe size once all its stripes have
+// been received else zero. Without bonding this is the packet received by the given module.
+uint32_t bond_receive_packet(spi_parms_t *spi_parms, arguments_t *arguments, uint8_t *packet)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t size, offset;
+    uint8_t  seq, index, count;
+    int      i;
+
+    if (!bond_active)
+    {
+        return radio_receive_packet(spi_parms, arguments, packet);
+    }
+
+    for (i=0; i<bond_nb_units; i++)
+    {
+        size = radio_receive_packet(bond_units[i], arguments, bond_packet);
+
+        if (size == 0)
+        {
+            continue;
+        }
+
+        seq   = bond_packet[0];
+        index = bond_packet[1] >> 4;
+        count = bond_packet[1] & 0x0F;
+
+        if ((size < BOND_HEADER_SIZE) || (size - BOND_HEADER_SIZE > BOND_STRIPE_SIZE) || (count == 0) || (count > bond_nb_units) || (index >= count))
+        {
+            verbprintf(1, "BOND: invalid stripe, dropped\n");
+            continue;
+        }
+
+        if ((bond_rx_count == 0) || (seq != bond_rx_seq) || (count != bond_rx_count)) // new superframe
+        {
+            if (bond_rx_mask)
+            {
+                verbprintf(1, "BOND: superframe #%d incomplete, dropped\n", bond_rx_seq);
+            }
+
+            bond_rx_seq = seq;
+            bond_rx_count = count;
+            bond_rx_mask = 0;
+        }
+
+        bond_rx_size[index] = size - BOND_HEADER_SIZE;
+        memcpy(bond_rx[index], &bond_packet[BOND_HEADER_SIZE], bond_rx_size[index]);
+        bond_rx_mask |= (1<<index);
+
+        verbprintf(3, "BOND: stripe %d/%d of superframe #%d on module %d\n", index + 1, count, seq, i);
+
+        if (bond_rx_mask == (1<<bond_rx_count) - 1) // all stripes received
+        {
+            offset = 0;
+
+            for (index=0; index<bond_rx_count; index++)
+            {
+                memcpy(&packet[offset], bond_rx[index], bond_rx_size[index]);
+                offset += bond_rx_size[index];
+            }
+
+            verbprintf(2, "BOND: superframe #%d of %d bytes reassembled\n", bond_rx_seq, offset);
+            bond_rx_count = 0;
+            bond_rx_mask = 0;
+
+            return offset;
+        }
+    }
+
+    return 0;
+}
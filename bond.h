@@ -0,0 +1,28 @@
+/******************************************************************************/
+/* PiCC1101  - Radio serial link using CC1101 module and Raspberry-Pi         */
+/*                                                                            */
+/* Multi-radio bonding                                                        */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef _BOND_H_
+#define _BOND_H_
+
+#include <stdint.h>
+
+#include "main.h"
+#include "pi_cc_spi.h"
+#include "radio.h"
+
+#define BOND_HEADER_SIZE 2                                                 // Superframe sequence and stripe index/count
+#define BOND_STRIPE_SIZE (RADIO_RX_RING * (PI_CCxxx0_PACKET_COUNT_SIZE-2)) // Stripe size limit including header
+
+int      bond_init(radio_parms_t *radio_parms, spi_parms_t *spi_parms, arguments_t *arguments);
+uint32_t bond_capacity(arguments_t *arguments);
+void     bond_turn_rx(arguments_t *arguments);
+void     bond_send_packet(spi_parms_t *spi_parms, arguments_t *arguments, uint8_t *packet, uint32_t size);
+uint32_t bond_receive_packet(spi_parms_t *spi_parms, arguments_t *arguments, uint8_t *packet);
+
+#endif
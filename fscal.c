@@ -0,0 +1,201 @@
+/******************************************************************************/
+/* PiCC1101  - Radio serial link using CC1101 module and Raspberry-Pi         */
+/*                                                                            */
+/* Frequency synthesizer calibration cache                                    */
+/*                                                                            */
+/* Each channel is calibrated once and automatic calibration is disabled.     */
+/* Turnarounds then skip calibration and channel changes restore the cached   */
+/* FSCAL3..1 values instead of calibrating again.                             */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fscal.h"
+#include "util.h"
+
+static fscal_entry_t fscal_cache[FSCAL_NUM_CHANNELS];
+static uint32_t      fscal_freq_word;  // Base frequency word the cache was computed for
+static uint16_t      fscal_chanspc;    // Channel spacing words the cache was computed for (E<<8 + M)
+
+// === Static functions declarations ==============================================================
+
+static int  fscal_calibrate(spi_parms_t *spi_parms, uint8_t channel);
+static void fscal_load(char *file_name);
+static void fscal_save(char *file_name);
+
+// === Static functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Calibrate one channel and store the result. Radio must be in IDLE state.
+int fscal_calibrate(spi_parms_t *spi_parms, uint8_t channel)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t fsm_state, *regs;
+    int     timeout = 100; // 100 times 100us
+
+    PI_CC_SPIWriteReg(spi_parms, PI_CCxxx0_CHANNR, channel);
+    PI_CC_SPIStrobe(spi_parms, PI_CCxxx0_SCAL);
+
+    do
+    {
+        usleep(100);
+        PI_CC_SPIReadStatus(spi_parms, PI_CCxxx0_MARCSTATE, &fsm_state);
+        fsm_state &= 0x1F;
+        timeout--;
+    } while ((fsm_state != CCxxx0_STATE_IDLE) && (timeout));
+
+    if (!timeout)
+    {
+        fprintf(stderr, "FSCAL: calibration of channel %d did not complete (state %s)\n", channel, state_names[fsm_state]);
+        return 1;
+    }
+
+    if (PI_CC_SPIReadBurstReg(spi_parms, PI_CCxxx0_FSCAL3, &regs, 3) != 0)
+    {
+        return 1;
+    }
+
+    fscal_cache[channel].fscal3 = regs[0];
+    fscal_cache[channel].fscal2 = regs[1];
+    fscal_cache[channel].fscal1 = regs[2];
+    fscal_cache[channel].valid = 1;
+
+    verbprintf(2, "FSCAL: channel %d: FSCAL3=%02X FSCAL2=%02X FSCAL1=%02X\n", channel, regs[0], regs[1], regs[2]);
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Load calibration values from file. Only entries for the current base frequency and spacing are kept.
+// Each line is: frequency word, spacing word, channel, FSCAL3, FSCAL2, FSCAL1
+void fscal_load(char *file_name)
+// ------------------------------------------------------------------------------------------------
+{
+    FILE *fp = fopen(file_name, "r");
+    unsigned int freq_word, chanspc, channel, fscal3, fscal2, fscal1;
+    int nb_loaded = 0;
+
+    if (!fp)
+    {
+        verbprintf(1, "FSCAL: no calibration file %s\n", file_name);
+        return;
+    }
+
+    while (fscanf(fp, "%u %u %u %x %x %x", &freq_word, &chanspc, &channel, &fscal3, &fscal2, &fscal1) == 6)
+    {
+        if ((freq_word == fscal_freq_word) && (chanspc == fscal_chanspc) && (channel < FSCAL_NUM_CHANNELS))
+        {
+            fscal_cache[channel].fscal3 = fscal3;
+            fscal_cache[channel].fscal2 = fscal2;
+            fscal_cache[channel].fscal1 = fscal1;
+            fscal_cache[channel].valid = 1;
+            nb_loaded++;
+        }
+    }
+
+    fclose(fp);
+    verbprintf(1, "FSCAL: %d channels loaded from %s\n", nb_loaded, file_name);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Save calibration values to file
+void fscal_save(char *file_name)
+// ------------------------------------------------------------------------------------------------
+{
+    FILE *fp = fopen(file_name, "w");
+    int channel;
+
+    if (!fp)
+    {
+        perror("FSCAL: cannot write calibration file");
+        return;
+    }
+
+    for (channel=0; channel<FSCAL_NUM_CHANNELS; channel++)
+    {
+        if (fscal_cache[channel].valid)
+        {
+            fprintf(fp, "%u %u %u %02X %02X %02X\n", fscal_freq_word, fscal_chanspc, channel,
+                fscal_cache[channel].fscal3,
+                fscal_cache[channel].fscal2,
+                fscal_cache[channel].fscal1);
+        }
+    }
+
+    fclose(fp);
+}
+
+// === Public functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Calibrate the given channels unless already found in the calibration file then disable automatic
+// calibration. Leaves the radio in IDLE state on the first channel.
+int fscal_init(spi_parms_t *spi_parms, radio_parms_t *radio_parms, arguments_t *arguments, uint8_t *channels, int nb_channels)
+// ------------------------------------------------------------------------------------------------
+{
+    int i, nb_calibrated = 0;
+
+    memset(fscal_cache, 0, sizeof(fscal_cache));
+    fscal_freq_word = radio_parms->freq_word;
+    fscal_chanspc = (radio_parms->chanspc_e<<8) + radio_parms->chanspc_m;
+
+    if (arguments->fscal_file)
+    {
+        fscal_load(arguments->fscal_file);
+    }
+
+    radio_turn_idle(spi_parms);
+
+    for (i=0; i<nb_channels; i++)
+    {
+        if (!fscal_cache[channels[i]].valid)
+        {
+            if (fscal_calibrate(spi_parms, channels[i]) != 0)
+            {
+                return 1;
+            }
+
+            nb_calibrated++;
+        }
+    }
+
+    if ((arguments->fscal_file) && (nb_calibrated))
+    {
+        fscal_save(arguments->fscal_file);
+    }
+
+    // MCSM0: FS_AUTOCAL = 0: never calibrate automatically. PO_TIMEOUT unchanged.
+    PI_CC_SPIWriteReg(spi_parms, PI_CCxxx0_MCSM0, 0x08);
+
+    verbprintf(1, "FSCAL: %d channels calibrated, automatic calibration disabled\n", nb_calibrated);
+
+    return fscal_set_channel(spi_parms, channels[0]);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Change channel restoring cached calibration values. Radio must be in IDLE state.
+int fscal_set_channel(spi_parms_t *spi_parms, uint8_t channel)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t regs[3];
+
+    if (!fscal_cache[channel].valid)
+    {
+        verbprintf(1, "FSCAL: channel %d is not calibrated\n", channel);
+        PI_CC_SPIWriteReg(spi_parms, PI_CCxxx0_CHANNR, channel);
+        return fscal_calibrate(spi_parms, channel);
+    }
+
+    regs[0] = fscal_cache[channel].fscal3;
+    regs[1] = fscal_cache[channel].fscal2;
+    regs[2] = fscal_cache[channel].fscal1;
+
+    PI_CC_SPIWriteReg(spi_parms, PI_CCxxx0_CHANNR, channel);
+    PI_CC_SPIWriteBurstReg(spi_parms, PI_CCxxx0_FSCAL3, regs, 3);
+
+    return 0;
+}
@@ -0,0 +1,32 @@
+/******************************************************************************/
+/* PiCC1101  - Radio serial link using CC1101 module and Raspberry-Pi         */
+/*                                                                            */
+/* Frequency synthesizer calibration cache                                    */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef _FSCAL_H_
+#define _FSCAL_H_
+
+#include <stdint.h>
+
+#include "main.h"
+#include "pi_cc_spi.h"
+#include "radio.h"
+
+#define FSCAL_NUM_CHANNELS 256
+
+typedef struct fscal_entry_s
+{
+    uint8_t valid;    // Calibration values are available
+    uint8_t fscal3;   // FSCAL3 register after calibration
+    uint8_t fscal2;   // FSCAL2 register after calibration
+    uint8_t fscal1;   // FSCAL1 register after calibration
+} fscal_entry_t;
+
+int  fscal_init(spi_parms_t *spi_parms, radio_parms_t *radio_parms, arguments_t *arguments, uint8_t *channels, int nb_channels);
+int  fscal_set_channel(spi_parms_t *spi_parms, uint8_t channel);
+
+#endif
@@ -0,0 +1,46 @@
+/******************************************************************************/
+/* PiCC1101  - Radio serial link using CC1101 module and Raspberry-Pi         */
+/*                                                                            */
+/* Build time generator of the modem register table                           */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#include <stdio.h>
+
+#include "modem.h"
+
+// ------------------------------------------------------------------------------------------------
+// Write the register table as C source on standard output. Order follows modem_profile_index.
+int main (int argc, char **argv)
+// ------------------------------------------------------------------------------------------------
+{
+    int rate, modulation, index_i, skew_i;
+    modem_regs_t regs;
+
+    printf("/* Generated by gen_modem_table. Do not edit. */\n\n");
+    printf("#include \"modem.h\"\n\n");
+    printf("const modem_regs_t modem_table[MODEM_NUM_PROFILES] = {\n");
+
+    for (rate=0; rate<NUM_RATE; rate++)
+    {
+        for (modulation=0; modulation<NUM_MOD; modulation++)
+        {
+            for (index_i=0; index_i<MODEM_NUM_INDEX; index_i++)
+            {
+                for (skew_i=0; skew_i<MODEM_NUM_SKEW; skew_i++)
+                {
+                    modem_get_regs(rate, modulation, modem_indexes[index_i], modem_skews[skew_i], MODEM_F_XTAL, &regs);
+                    printf("    {0x%02X, 0x%02X, 0x%02X, 0x%02X}, // %d Baud mod %d h=%.2f skew=%.2f\n",
+                        regs.mdmcfg4, regs.mdmcfg3, regs.mdmcfg2, regs.deviatn,
+                        rate_values[rate], modulation, modem_indexes[index_i], modem_skews[skew_i]);
+                }
+            }
+        }
+    }
+
+    printf("};\n");
+
+    return 0;
+}
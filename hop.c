@@ -0,0 +1,342 @@
+/******************************************************************************/
+/* PiCC1101  - Radio serial link using CC1101 module and Raspberry-Pi         */
+/*                                                                            */
+/* Channel plan and frequency hopping                                         */
+/*                                                                            */
+/* The hopping sequence is a permutation of the channel list shuffled with a  */
+/* seed shared by both ends. Hops are slotted in time: the sequence position  */
+/* changes every dwell time whether packets are sent or not and a packet is   */
+/* sent only if it ends before the dwell does. Every block carries the        */
+/* position and the phase within the dwell of its sender and receivers align  */
+/* their own timing on it so a lost packet does not break synchronization.    */
+/* A node that has heard nothing for a while no longer knows the timing of    */
+/* its peers. It then listens on a channel for one cycle of the sequence and  */
+/* one more dwell before moving to the next so that any peer hopping on its   */
+/* own timing comes by. It still transmits on its own timing.                 */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "hop.h"
+#include "fscal.h"
+#include "util.h"
+
+static uint8_t        hop_sequence[HOP_MAX_CHANNELS];
+static int            hop_nb_channels;
+static int            hop_index;          // Position in the sequence of the channel tuned
+static uint8_t        hop_cache;          // Calibration values are cached (see fscal.c)
+static uint32_t       hop_dwell_us;       // Time spent on each channel in microseconds
+static uint64_t       hop_origin;         // Start of a dwell at position 0 in microseconds
+static uint8_t        hop_synced;         // Timing taken from a peer recently
+static struct timeval hop_last_rx;        // Time the last block was received
+static uint64_t       hop_last_tx;        // Time the last block was sent in microseconds
+static radio_parms_t  *hop_radio_parms;
+static arguments_t    *hop_arguments;
+
+// === Static functions declarations ==============================================================
+
+static uint32_t hop_random(uint32_t *state);
+static uint64_t hop_now_us();
+static uint32_t hop_bytes(uint32_t time_us, radio_parms_t *radio_parms, arguments_t *arguments);
+static void     hop_set_index(spi_parms_t *spi_parms, int index);
+
+// === Static functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Xorshift pseudo-random generator. Independent of the C library so that both ends compute the
+// same sequence.
+uint32_t hop_random(uint32_t *state)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+
+    return x;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Current time in microseconds
+uint64_t hop_now_us()
+// ------------------------------------------------------------------------------------------------
+{
+    struct timeval tp;
+
+    gettimeofday(&tp, NULL);
+    return tp.tv_sec * 1000000ULL + tp.tv_usec;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Maximum packet size in bytes that can be sent in the given time. Only full blocks are counted.
+// One byte less than full blocks so that the block countdown does not add an empty block.
+uint32_t hop_bytes(uint32_t time_us, radio_parms_t *radio_parms, arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t blocks = time_us / (radio_get_block_time(radio_parms, arguments) + HOP_BLOCK_MARGIN_US);
+
+    if (blocks == 0)
+    {
+        return 0;
+    }
+
+    if (blocks > 256) // block countdown is one byte
+    {
+        blocks = 256;
+    }
+
+    return blocks * radio_get_block_payload(arguments) - 1;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Move to the given position in the sequence. Radio must be in IDLE state.
+void hop_set_index(spi_parms_t *spi_parms, int index)
+// ------------------------------------------------------------------------------------------------
+{
+    hop_index = index;
+
+    if (hop_cache)
+    {
+        fscal_set_channel(spi_parms, hop_sequence[hop_index]);
+    }
+    else
+    {
+        PI_CC_SPIWriteReg(spi_parms, PI_CCxxx0_CHANNR, hop_sequence[hop_index]); // calibrated at next Rx or Tx
+    }
+
+    verbprintf(3, "HOP: channel %d (#%d)\n", hop_sequence[hop_index], hop_index);
+}
+
+// === Public functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Build the hopping sequence and tune to its first channel. Without hopping the sequence is the
+// single channel 0.
+int hop_init(spi_parms_t *spi_parms, radio_parms_t *radio_parms, arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t state = (arguments->hop_seed ? arguments->hop_seed : 1);
+    uint8_t  channel;
+    int      i, j;
+
+    hop_radio_parms = radio_parms;
+    hop_arguments = arguments;
+    hop_dwell_us = arguments->hop_dwell_ms * 1000;
+
+    if (arguments->hop_nb_channels > 1)
+    {
+        if ((hop_dwell_us <= HOP_GUARD_US) || (hop_bytes(hop_dwell_us - HOP_GUARD_US, radio_parms, arguments) == 0))
+        {
+            fprintf(stderr, "HOP: dwell time of %d ms too short for a block of %d us\n", arguments->hop_dwell_ms, radio_get_block_time(radio_parms, arguments));
+            return 1;
+        }
+
+        hop_nb_channels = arguments->hop_nb_channels;
+        memcpy(hop_sequence, arguments->hop_channels, hop_nb_channels);
+
+        for (i = hop_nb_channels-1; i > 0; i--) // Fisher-Yates shuffle
+        {
+            j = hop_random(&state) % (i+1);
+            channel = hop_sequence[i];
+            hop_sequence[i] = hop_sequence[j];
+            hop_sequence[j] = channel;
+        }
+
+        verbprintf(1, "HOP: %d channels of %d ms:", hop_nb_channels, arguments->hop_dwell_ms);
+
+        for (i = 0; i < hop_nb_channels; i++)
+        {
+            verbprintf(1, " %d", hop_sequence[i]);
+        }
+
+        verbprintf(1, "\n");
+    }
+    else
+    {
+        hop_nb_channels = 1;
+        hop_sequence[0] = (arguments->hop_nb_channels ? arguments->hop_channels[0] : 0);
+    }
+
+    hop_index = 0;
+    hop_cache = arguments->fscal_cache;
+    hop_origin = hop_now_us();
+    hop_synced = 0;
+    hop_last_tx = 0;
+    gettimeofday(&hop_last_rx, NULL);
+
+    if (hop_cache)
+    {
+        return fscal_init(spi_parms, radio_parms, arguments, hop_sequence, hop_nb_channels);
+    }
+    else
+    {
+        radio_turn_idle(spi_parms);
+        hop_set_index(spi_parms, 0);
+        return 0;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Current channel number
+uint8_t hop_channel()
+// ------------------------------------------------------------------------------------------------
+{
+    return hop_sequence[hop_index];
+}
+
+// ------------------------------------------------------------------------------------------------
+// Timing of this node written in the header of a block about to be sent: position in the sequence
+// and phase within the dwell in 1/256 of the dwell time
+void hop_tx_timing(uint8_t *position, uint8_t *phase)
+// ------------------------------------------------------------------------------------------------
+{
+    uint64_t elapsed;
+
+    hop_last_tx = hop_now_us();
+    elapsed = hop_last_tx - hop_origin;
+    *position = (elapsed / hop_dwell_us) % hop_nb_channels;
+    *phase = ((elapsed % hop_dwell_us) * 256) / hop_dwell_us;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Align the timing of this node on the header of a block received with good CRC. Size is the
+// number of bytes received after the sync word. The block started that long before the time of
+// its reception.
+void hop_rx_timing(uint8_t position, uint8_t phase, uint32_t size)
+// ------------------------------------------------------------------------------------------------
+{
+    struct timeval rx_time;
+    uint64_t rx_start;
+
+    if ((hop_nb_channels < 2) || (position >= hop_nb_channels))
+    {
+        return;
+    }
+
+    radio_get_rx_time(&rx_time);
+    rx_start = rx_time.tv_sec * 1000000ULL + rx_time.tv_usec;
+    rx_start -= (uint64_t) ((nb_preamble_bytes[hop_arguments->preamble] + 4 + size) * radio_get_byte_time(hop_radio_parms));
+    hop_origin = rx_start - (uint64_t) position * hop_dwell_us - ((phase * hop_dwell_us) + hop_dwell_us / 2) / 256;
+
+    if (!hop_synced)
+    {
+        verbprintf(1, "HOP: synchronized on peer at #%d\n", position);
+    }
+
+    hop_synced = 1;
+    gettimeofday(&hop_last_rx, NULL);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Maximum packet size in bytes that can be sent now so that it ends before the dwell on this
+// channel minus the guard time. Transmission starts after the given delay. Zero if the channel of
+// the dwell is not tuned yet or if the time left is too short. Without hopping the radio buffer
+// size.
+uint32_t hop_tx_budget(radio_parms_t *radio_parms, arguments_t *arguments, uint32_t delay_us)
+// ------------------------------------------------------------------------------------------------
+{
+    uint64_t elapsed;
+    uint32_t remaining;
+
+    if (hop_nb_channels < 2)
+    {
+        return RADIO_BUFSIZE;
+    }
+
+    elapsed = hop_now_us() - hop_origin;
+
+    if ((int) ((elapsed / hop_dwell_us) % hop_nb_channels) != hop_index) // dwell just ended
+    {
+        return 0;
+    }
+
+    remaining = hop_dwell_us - (elapsed % hop_dwell_us);
+
+    if (remaining <= HOP_GUARD_US + delay_us)
+    {
+        return 0;
+    }
+
+    return hop_bytes(remaining - HOP_GUARD_US - delay_us, radio_parms, arguments);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Maximum packet size in bytes that can be sent in a full dwell. Frames larger than this can
+// never be sent. Without hopping the radio buffer size.
+uint32_t hop_dwell_capacity(radio_parms_t *radio_parms, arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    if (hop_nb_channels < 2)
+    {
+        return RADIO_BUFSIZE;
+    }
+
+    return hop_bytes(hop_dwell_us - HOP_GUARD_US, radio_parms, arguments);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Milliseconds until the end of the current dwell rounded up. Zero without hopping.
+uint32_t hop_wait_ms()
+// ------------------------------------------------------------------------------------------------
+{
+    if (hop_nb_channels < 2)
+    {
+        return 0;
+    }
+
+    return (hop_dwell_us - ((hop_now_us() - hop_origin) % hop_dwell_us)) / 1000 + 1;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Tune to the channel of the current dwell. Without the timing of the peers listen on a channel
+// for a cycle and a dwell except while something is waiting to be sent or an answer may come
+// back in the dwell following a transmission.
+void hop_check(spi_parms_t *spi_parms, arguments_t *arguments, uint8_t tx_waiting)
+// ------------------------------------------------------------------------------------------------
+{
+    struct timeval now, delta;
+    uint64_t now_us, dwell;
+    int      index;
+
+    if (hop_nb_channels < 2)
+    {
+        return;
+    }
+
+    gettimeofday(&now, NULL);
+    timeval_subtract(&delta, &now, &hop_last_rx);
+
+    if ((hop_synced) && (delta.tv_sec >= HOP_RESYNC_S))
+    {
+        verbprintf(1, "HOP: nothing received for %d s, listening one cycle per channel\n", HOP_RESYNC_S);
+        hop_synced = 0;
+    }
+
+    now_us = hop_now_us();
+    dwell = (now_us - hop_origin) / hop_dwell_us;
+
+    if ((hop_synced) || (tx_waiting) || (now_us - hop_last_tx < 2 * hop_dwell_us))
+    {
+        index = dwell % hop_nb_channels;
+    }
+    else
+    {
+        index = (dwell / (hop_nb_channels + 1)) % hop_nb_channels;
+    }
+
+    if (index != hop_index)
+    {
+        radio_wait_free(spi_parms);
+        radio_turn_idle(spi_parms); // channel change takes effect from IDLE
+        hop_set_index(spi_parms, index);
+        radio_init_rx(spi_parms, arguments);
+        radio_turn_rx(spi_parms);
+    }
+}
@@ -0,0 +1,33 @@
+/******************************************************************************/
+/* PiCC1101  - Radio serial link using CC1101 module and Raspberry-Pi         */
+/*                                                                            */
+/* Channel plan and frequency hopping                                         */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef _HOP_H_
+#define _HOP_H_
+
+#include <stdint.h>
+
+#include "main.h"
+#include "pi_cc_spi.h"
+#include "radio.h"
+
+#define HOP_MAX_CHANNELS     256   // Maximum number of channels in the hopping sequence
+#define HOP_RESYNC_S          30   // Seconds without a received block before the timing of the peers is considered lost
+#define HOP_GUARD_US        5000   // Guard time at the end of a dwell in microseconds
+#define HOP_BLOCK_MARGIN_US 1000   // Time allowed per block for calibration and FIFO loading in microseconds
+
+int      hop_init(spi_parms_t *spi_parms, radio_parms_t *radio_parms, arguments_t *arguments);
+uint8_t  hop_channel();
+void     hop_tx_timing(uint8_t *position, uint8_t *phase);
+void     hop_rx_timing(uint8_t position, uint8_t phase, uint32_t size);
+uint32_t hop_tx_budget(radio_parms_t *radio_parms, arguments_t *arguments, uint32_t delay_us);
+uint32_t hop_dwell_capacity(radio_parms_t *radio_parms, arguments_t *arguments);
+uint32_t hop_wait_ms();
+void     hop_check(spi_parms_t *spi_parms, arguments_t *arguments, uint8_t tx_waiting);
+
+#endif
@@ -0,0 +1,189 @@
+/******************************************************************************/
+/* PiCC1101  - Radio serial link using CC1101 module and Raspberry-Pi         */
+/*                                                                            */
+/* KISS escape scanning                                                       */
+/*                                                                            */
+/* Escaping and unescaping KISS frames is mostly copying runs of bytes that   */
+/* are neither FEND nor FESC. The length of such a run is found by comparing  */
+/* 16 or 32 bytes at a time with SIMD instructions: SSE2 or AVX2 on x86 and   */
+/* NEON on ARM when the compiler targets it (-mfpu=neon on the Raspberry Pi 2 */
+/* and later). AVX2 is used only if the processor has it. The scalar version  */
+/* is the fallback and the reference for the benchmark test.                  */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define KESC_AVX2 1
+#endif
+
+#include "kesc.h"
+#include "kiss.h"
+
+// === Static functions declarations ==============================================================
+
+static uint32_t kesc_scan_scalar(const uint8_t *bytes, uint32_t size);
+#if defined(__SSE2__)
+static uint32_t kesc_scan_sse2(const uint8_t *bytes, uint32_t size);
+#endif
+#if defined(KESC_AVX2)
+static uint32_t kesc_scan_avx2(const uint8_t *bytes, uint32_t size);
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+static uint32_t kesc_scan_neon(const uint8_t *bytes, uint32_t size);
+#endif
+
+static kesc_scan_t kesc_scan_best = kesc_scan_scalar; // Selected implementation
+
+// === Static functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// One byte at a time
+uint32_t kesc_scan_scalar(const uint8_t *bytes, uint32_t size)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t i;
+
+    for (i=0; i<size; i++)
+    {
+        if ((bytes[i] == KISS_FEND) || (bytes[i] == KISS_FESC))
+        {
+            break;
+        }
+    }
+
+    return i;
+}
+
+#if defined(__SSE2__)
+// ------------------------------------------------------------------------------------------------
+// 16 bytes at a time with SSE2
+uint32_t kesc_scan_sse2(const uint8_t *bytes, uint32_t size)
+// ------------------------------------------------------------------------------------------------
+{
+    const __m128i fend = _mm_set1_epi8((char) KISS_FEND);
+    const __m128i fesc = _mm_set1_epi8((char) KISS_FESC);
+    __m128i  block;
+    uint32_t i, mask;
+
+    for (i=0; i+16<=size; i+=16)
+    {
+        block = _mm_loadu_si128((const __m128i *) &bytes[i]);
+        mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, fend), _mm_cmpeq_epi8(block, fesc)));
+
+        if (mask)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+
+    return i + kesc_scan_scalar(&bytes[i], size - i);
+}
+#endif
+
+#if defined(KESC_AVX2)
+// ------------------------------------------------------------------------------------------------
+// 32 bytes at a time with AVX2
+__attribute__((target("avx2")))
+uint32_t kesc_scan_avx2(const uint8_t *bytes, uint32_t size)
+// ------------------------------------------------------------------------------------------------
+{
+    const __m256i fend = _mm256_set1_epi8((char) KISS_FEND);
+    const __m256i fesc = _mm256_set1_epi8((char) KISS_FESC);
+    __m256i  block;
+    uint32_t i, mask;
+
+    for (i=0; i+32<=size; i+=32)
+    {
+        block = _mm256_loadu_si256((const __m256i *) &bytes[i]);
+        mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(block, fend), _mm256_cmpeq_epi8(block, fesc)));
+
+        if (mask)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+
+    return i + kesc_scan_scalar(&bytes[i], size - i);
+}
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+// ------------------------------------------------------------------------------------------------
+// 16 bytes at a time with NEON. There is no byte mask instruction so the exact position is found
+// in the scalar way once a block contains a special byte.
+uint32_t kesc_scan_neon(const uint8_t *bytes, uint32_t size)
+// ------------------------------------------------------------------------------------------------
+{
+    const uint8x16_t fend = vdupq_n_u8(KISS_FEND);
+    const uint8x16_t fesc = vdupq_n_u8(KISS_FESC);
+    uint8x16_t block;
+    uint64x2_t match;
+    uint32_t   i;
+
+    for (i=0; i+16<=size; i+=16)
+    {
+        block = vld1q_u8(&bytes[i]);
+        match = vreinterpretq_u64_u8(vorrq_u8(vceqq_u8(block, fend), vceqq_u8(block, fesc)));
+
+        if (vgetq_lane_u64(match, 0) | vgetq_lane_u64(match, 1))
+        {
+            break;
+        }
+    }
+
+    return i + kesc_scan_scalar(&bytes[i], size - i);
+}
+#endif
+
+// === Public functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Select the fastest implementation available or the scalar one. Returns its name.
+const char *kesc_init(uint8_t allow_simd)
+// ------------------------------------------------------------------------------------------------
+{
+    kesc_scan_best = kesc_scan_scalar;
+
+    if (!allow_simd)
+    {
+        return "scalar";
+    }
+
+#if defined(KESC_AVX2)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+    {
+        kesc_scan_best = kesc_scan_avx2;
+        return "AVX2";
+    }
+#endif
+#if defined(__SSE2__)
+    kesc_scan_best = kesc_scan_sse2;
+    return "SSE2";
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    kesc_scan_best = kesc_scan_neon;
+    return "NEON";
+#else
+    return "scalar";
+#endif
+}
+
+// ------------------------------------------------------------------------------------------------
+// Length of the run of bytes at the start of the buffer that need no escaping
+uint32_t kesc_scan(const uint8_t *bytes, uint32_t size)
+// ------------------------------------------------------------------------------------------------
+{
+    return kesc_scan_best(bytes, size);
+}
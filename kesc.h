@@ -0,0 +1,20 @@
+/******************************************************************************/
+/* PiCC1101  - Radio serial link using CC1101 module and Raspberry-Pi         */
+/*                                                                            */
+/* KISS escape scanning                                                       */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef _KESC_H_
+#define _KESC_H_
+
+#include <stdint.h>
+
+typedef uint32_t (*kesc_scan_t)(const uint8_t *bytes, uint32_t size); // length of the run without FEND or FESC
+
+const char *kesc_init(uint8_t allow_simd);
+uint32_t    kesc_scan(const uint8_t *bytes, uint32_t size);
+
+#endif
@@ -0,0 +1,317 @@
+/******************************************************************************/
+/* PiCC1101  - Radio serial link using CC1101 module and Raspberry-Pi         */
+/*                                                                            */
+/* KISS frame queue                                                           */
+/*                                                                            */
+/* Bytes from the serial link are parsed as they come by a state machine that */
+/* unescapes them directly into a ring. Only complete frames are queued and   */
+/* frames are handed out as slices of the ring. A frame is always contiguous: */
+/* when it reaches the end of the ring the part already parsed is moved back  */
+/* to the start of the ring.                                                  */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#include <string.h>
+
+#include "kfq.h"
+#include "kesc.h"
+#include "kiss.h"
+#include "util.h"
+
+// === Static functions declarations ==============================================================
+
+static uint8_t  kfq_put(kfq_t *queue, const uint8_t *bytes, uint32_t size);
+static uint32_t kfq_push(kfq_t *queue, kfq_filter_t filter);
+static void     kfq_drop(kfq_t *queue);
+
+// === Static functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Append unescaped bytes to the frame being parsed. Returns 1 if there is no room.
+uint8_t kfq_put(kfq_t *queue, const uint8_t *bytes, uint32_t size)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t oldest = (queue->count ? queue->frames[queue->head].offset : KFQ_RING_SIZE);
+    uint32_t end = queue->write + queue->size;
+
+    if (queue->size + size > KFQ_MAX_FRAME)
+    {
+        return 1;
+    }
+
+    if ((queue->count) && (queue->write < oldest)) // behind the oldest frame
+    {
+        if (end + size > oldest)
+        {
+            return 1;
+        }
+    }
+    else if (end + size > KFQ_RING_SIZE) // move the frame back to the start of the ring
+    {
+        if (queue->size + size > oldest)
+        {
+            return 1;
+        }
+
+        memmove(queue->ring, &queue->ring[queue->write], queue->size);
+        queue->write = 0;
+        end = queue->size;
+    }
+
+    memcpy(&queue->ring[end], bytes, size);
+    queue->size += size;
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Queue the frame just parsed unless the filter consumes it. Returns the number of frames queued.
+uint32_t kfq_push(kfq_t *queue, kfq_filter_t filter)
+// ------------------------------------------------------------------------------------------------
+{
+    kfq_frame_t *frame;
+
+    if ((filter) && (filter(&queue->ring[queue->write], queue->size)))
+    {
+        return 0;
+    }
+
+    if (queue->count == KFQ_MAX_FRAMES)
+    {
+        verbprintf(1, "KISS: frame queue full, frame dropped\n");
+        queue->dropped++;
+        return 0;
+    }
+
+    frame = &queue->frames[(queue->head + queue->count) % KFQ_MAX_FRAMES];
+    frame->offset = queue->write;
+    frame->size = queue->size;
+    queue->count++;
+    queue->write += queue->size;
+
+    return 1;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Drop the frame being parsed and ignore bytes until the next delimiter
+void kfq_drop(kfq_t *queue)
+// ------------------------------------------------------------------------------------------------
+{
+    verbprintf(1, "KISS: no room for frame in queue, dropped\n");
+    queue->dropping = 1;
+    queue->size = 0;
+    queue->dropped++;
+}
+
+// === Public functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Initialize an empty queue. Bytes before the first frame delimiter are ignored.
+void kfq_init(kfq_t *queue)
+// ------------------------------------------------------------------------------------------------
+{
+    queue->head = 0;
+    queue->count = 0;
+    queue->in_frame = 0;
+    queue->fesc = 0;
+    queue->dropping = 0;
+    queue->write = 0;
+    queue->size = 0;
+    queue->dropped = 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Number of serial bytes that can be parsed without dropping a frame for lack of room. Escaped
+// bytes never give more unescaped bytes so this is a safe read size.
+uint32_t kfq_room(kfq_t *queue)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t oldest, end = queue->write + queue->size, tail, front;
+
+    if (queue->count == KFQ_MAX_FRAMES)
+    {
+        return 0;
+    }
+
+    if (queue->count == 0)
+    {
+        return KFQ_RING_SIZE - queue->size;
+    }
+
+    oldest = queue->frames[queue->head].offset;
+
+    if (queue->write < oldest) // behind the oldest frame
+    {
+        return oldest - end;
+    }
+
+    tail = KFQ_RING_SIZE - end;
+    front = (oldest > queue->size ? oldest - queue->size : 0); // after moving back to the start
+
+    return (tail > front ? tail : front);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Parse serial bytes. Each complete frame is given to the filter first and queued unless the
+// filter consumed it. A frame may span several calls. Runs of bytes that need no unescaping are
+// copied at once. Returns the number of frames queued.
+uint32_t kfq_parse(kfq_t *queue, uint8_t *bytes, uint32_t size, kfq_filter_t filter)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t i, run, nb_frames = 0;
+    uint8_t  byte, *next;
+
+    for (i=0; i<size; i++)
+    {
+        if ((!queue->in_frame) || (queue->dropping)) // skip to next delimiter
+        {
+            if (!(next = memchr(&bytes[i], KISS_FEND, size - i)))
+            {
+                break;
+            }
+
+            i = next - bytes;
+        }
+        else if (!queue->fesc)
+        {
+            run = kesc_scan(&bytes[i], size - i);
+
+            if (run > 0)
+            {
+                if (kfq_put(queue, &bytes[i], run))
+                {
+                    kfq_drop(queue);
+                }
+
+                i += run - 1;
+                continue;
+            }
+        }
+
+        byte = bytes[i];
+
+        if (byte == KISS_FEND)
+        {
+            if ((queue->in_frame) && (queue->size > 0) && (!queue->dropping)) // not empty
+            {
+                nb_frames += kfq_push(queue, filter);
+            }
+
+            queue->in_frame = 1;
+            queue->fesc = 0;
+            queue->dropping = 0;
+            queue->size = 0;
+
+            if (queue->count == 0)
+            {
+                queue->write = 0;
+            }
+
+            continue;
+        }
+
+        if (queue->fesc)
+        {
+            queue->fesc = 0;
+
+            if (byte == KISS_TFEND)
+            {
+                byte = KISS_FEND;
+            }
+            else if (byte == KISS_TFESC)
+            {
+                byte = KISS_FESC;
+            }
+            else // protocol error
+            {
+                continue;
+            }
+        }
+        else if (byte == KISS_FESC)
+        {
+            queue->fesc = 1;
+            continue;
+        }
+
+        if (kfq_put(queue, &byte, 1))
+        {
+            kfq_drop(queue);
+        }
+    }
+
+    return nb_frames;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Number of complete frames queued
+uint32_t kfq_count(kfq_t *queue)
+// ------------------------------------------------------------------------------------------------
+{
+    return queue->count;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Oldest frame in the queue starting with its type byte or NULL if the queue is empty. The frame
+// stays valid until it is popped.
+uint8_t *kfq_peek(kfq_t *queue, uint32_t *size)
+// ------------------------------------------------------------------------------------------------
+{
+    if (queue->count == 0)
+    {
+        return NULL;
+    }
+
+    *size = queue->frames[queue->head].size;
+    return &queue->ring[queue->frames[queue->head].offset];
+}
+
+// ------------------------------------------------------------------------------------------------
+// Newest frame in the queue or NULL if the queue is empty. The frame stays valid until it is
+// popped.
+uint8_t *kfq_tail(kfq_t *queue, uint32_t *size)
+// ------------------------------------------------------------------------------------------------
+{
+    kfq_frame_t *frame;
+
+    if (queue->count == 0)
+    {
+        return NULL;
+    }
+
+    frame = &queue->frames[(queue->head + queue->count - 1) % KFQ_MAX_FRAMES];
+    *size = frame->size;
+    return &queue->ring[frame->offset];
+}
+
+// ------------------------------------------------------------------------------------------------
+// Remove the oldest frame
+void kfq_pop(kfq_t *queue)
+// ------------------------------------------------------------------------------------------------
+{
+    if (queue->count == 0)
+    {
+        return;
+    }
+
+    queue->head = (queue->head + 1) % KFQ_MAX_FRAMES;
+    queue->count--;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Queue a complete unescaped frame. Only for queues that are not fed by the parser. Returns 1 if
+// there is no room for it in which case nothing is queued.
+uint8_t kfq_append(kfq_t *queue, const uint8_t *frame, uint32_t size)
+// ------------------------------------------------------------------------------------------------
+{
+    if ((queue->count == KFQ_MAX_FRAMES) || (kfq_put(queue, frame, size)))
+    {
+        queue->size = 0;
+        return 1;
+    }
+
+    kfq_push(queue, 0);
+    queue->size = 0;
+    return 0;
+}
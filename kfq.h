@@ -0,0 +1,52 @@
+/******************************************************************************/
+/* PiCC1101  - Radio serial link using CC1101 module and Raspberry-Pi         */
+/*                                                                            */
+/* KISS frame queue                                                           */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef _KFQ_H_
+#define _KFQ_H_
+
+#include <stdint.h>
+
+#include "radio.h"
+
+#define KFQ_RING_SIZE   (2*RADIO_BUFSIZE)  // Size of the ring of unescaped frames
+#define KFQ_MAX_FRAMES  1024               // Maximum number of queued frames
+#define KFQ_MAX_FRAME   RADIO_BUFSIZE      // Frames larger than this are dropped while parsed
+
+typedef struct kfq_frame_s
+{
+    uint32_t offset;            // Start of the frame in the ring. First byte is the KISS type byte.
+    uint32_t size;              // Frame size including the type byte
+} kfq_frame_t;
+
+typedef struct kfq_s
+{
+    uint8_t     ring[KFQ_RING_SIZE];      // Unescaped frames. A frame is always contiguous.
+    kfq_frame_t frames[KFQ_MAX_FRAMES];   // Queued frames from the oldest
+    uint32_t    head;                     // Index of the oldest frame
+    uint32_t    count;                    // Number of complete frames queued
+    uint8_t     in_frame;                 // Parser: a frame delimiter has been seen
+    uint8_t     fesc;                     // Parser: last byte was an escape
+    uint8_t     dropping;                 // Parser: frame being parsed is dropped until next delimiter
+    uint32_t    write;                    // Parser: start of the frame being parsed in the ring
+    uint32_t    size;                     // Parser: bytes of the frame being parsed so far
+    uint32_t    dropped;                  // Number of frames dropped by the parser
+} kfq_t;
+
+typedef uint8_t (*kfq_filter_t)(uint8_t *frame, uint32_t size); // returns 1 if the frame is consumed
+
+void      kfq_init(kfq_t *queue);
+uint32_t  kfq_room(kfq_t *queue);
+uint32_t  kfq_parse(kfq_t *queue, uint8_t *bytes, uint32_t size, kfq_filter_t filter);
+uint32_t  kfq_count(kfq_t *queue);
+uint8_t  *kfq_peek(kfq_t *queue, uint32_t *size);
+uint8_t  *kfq_tail(kfq_t *queue, uint32_t *size);
+void      kfq_pop(kfq_t *queue);
+uint8_t   kfq_append(kfq_t *queue, const uint8_t *frame, uint32_t size);
+
+#endif
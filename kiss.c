@@ -8,117 +8,453 @@
 /******************************************************************************/
 
 #include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
+#include <time.h>
 
 #include "kiss.h"
+#include "kfq.h"
+#include "kesc.h"
 #include "radio.h"
+#include "link.h"
+#include "hop.h"
+#include "tdma.h"
+#include "bond.h"
+#include "afc.h"
+#include "port.h"
+#include "kserv.h"
+#include "txq.h"
+#include "win.h"
+#include "tun.h"
+#include "axc.h"
+#include "lzc.h"
 #include "util.h"
 
 static uint32_t tnc_tx_keyup_delay; // Tx keyup delay in microseconds
 static float    kiss_persistence;   // Persistence parameter
 static uint32_t kiss_slot_time;     // Slot time in microseconds
 static uint32_t kiss_tx_tail;       // Tx tail in microseconds (obsolete)
+static uint64_t kiss_next_slot;     // Time of the next channel access attempt in microseconds
+static uint8_t  kiss_air[RADIO_BUFSIZE];                         // Superframe as sent on air
+static uint8_t  kiss_frames[RADIO_BUFSIZE];                      // Unescaped frames of a superframe
+static uint8_t  kiss_frame[RADIO_BUFSIZE + AXC_MAX_EXPANSION];   // One unescaped frame
+static uint32_t kiss_frame_len[KISS_MAX_FRAMES];                 // Lengths of unescaped frames
+static kfq_t    kiss_tx_queue;                                   // Frames received on the serial link before classification
+static int      kiss_epoll_fd;      // Event loop
+static int      kiss_window_fd;     // Timer of the serial and radio concatenation windows
+static int      kiss_keyup_fd;      // Timer of the Tx keyup delay
+static int      kiss_access_fd;     // Timer of the next channel access attempt of a waiting packet
 
 // === Static functions declarations ==============================================================
 
-static uint8_t *kiss_tok(uint8_t *block, uint8_t *end);
-static uint8_t kiss_command(uint8_t *block);
+static uint8_t kiss_command(uint8_t *frame, uint32_t size);
+static uint8_t kiss_channel_access(spi_parms_t *spi_parms, arguments_t *arguments);
+static uint32_t kiss_access_wait_us(radio_parms_t *radio_parms, arguments_t *arguments);
+static uint8_t *kiss_put_varint(uint8_t *p, uint32_t value);
+static uint8_t *kiss_get_varint(uint8_t *p, uint8_t *end, uint32_t *value);
+static uint32_t kiss_to_air(uint32_t max_size, uint32_t capacity, arguments_t *arguments);
+static uint8_t  kiss_tx_port(spi_parms_t *spi_parms, arguments_t *arguments);
+static uint32_t kiss_from_air(uint8_t *air, uint32_t size, uint8_t *kiss, uint32_t max_size, uint32_t *nb_packets, arguments_t *arguments);
+static void     kiss_set_timer(int timer_fd, uint32_t delay_us);
+static int      kiss_wait_ms(uint8_t tx_again);
+static void     kiss_init_events(serial_t *serial_parms, arguments_t *arguments);
 
 // === Static functions ===========================================================================
 
 // ------------------------------------------------------------------------------------------------
-// Utility to unconcatenate KISS blocks. Returns pointer on next KISS delimiter past first byte (KISS_FEND = 0xC0)
-// Assumes the pointer is currently on the opening KISS_FEND. Give pointer to first byte of block and past end pointer
-uint8_t *kiss_tok(uint8_t *block, uint8_t *end) 
+// p-persistent CSMA. Called repeatedly while a packet is waiting to be sent. At each slot time the
+// channel is sampled and if clear the packet is sent with probability given by the persistence.
+// Returns 1 if the packet can be sent now
+uint8_t kiss_channel_access(spi_parms_t *spi_parms, arguments_t *arguments)
 // ------------------------------------------------------------------------------------------------
 {
-    uint8_t *p_cur, *p_ret = NULL;
+    struct timeval tp;
+    uint64_t now;
 
+    if (!arguments->csma)
+    {
+        return 1;
+    }
+
+    gettimeofday(&tp, NULL);
+    now = tp.tv_sec * 1000000ULL + tp.tv_usec;
+
+    if (now < kiss_next_slot)
+    {
+        return 0;
+    }
+
+    kiss_next_slot = now + kiss_slot_time;
+
+    if (!radio_channel_clear(spi_parms))
+    {
+        verbprintf(3, "KISS: channel busy\n");
+        return 0;
+    }
 
-    for (p_cur = block; p_cur < end; p_cur++)
+    if ((rand() / (RAND_MAX + 1.0)) >= kiss_persistence)
     {
-        if (p_cur == block)
+        verbprintf(3, "KISS: channel clear, transmission deferred\n");
+        return 0;
+    }
+
+    kiss_next_slot = 0; // next packet samples the channel immediately
+    return 1;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Microseconds until a packet that could not be sent may try again: the next CSMA slot if it falls
+// in the TDMA slot of this node else the start of its next TDMA slot. Zero if only an event (block
+// received, end of dwell) can let it go.
+uint32_t kiss_access_wait_us(radio_parms_t *radio_parms, arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    struct timeval tp;
+    uint64_t now;
+    uint32_t csma_us = 0;
+
+    if (arguments->csma)
+    {
+        gettimeofday(&tp, NULL);
+        now = tp.tv_sec * 1000000ULL + tp.tv_usec;
+
+        if (now < kiss_next_slot)
         {
-            if (*p_cur == KISS_FEND)
-            {
-                continue;
-            }
-            else
-            {
-                break; // will return NULL
-            }
+            csma_us = kiss_next_slot - now;
         }
+    }
+
+    return tdma_slot_wait_us(radio_parms, arguments, csma_us);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Write a variable length integer: 7 bits per byte, most significant bit set if more bytes follow
+uint8_t *kiss_put_varint(uint8_t *p, uint32_t value)
+// ------------------------------------------------------------------------------------------------
+{
+    while (value >= 0x80)
+    {
+        *p++ = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+
+    *p++ = value;
+    return p;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Read a variable length integer. Returns pointer past it or NULL if truncated
+uint8_t *kiss_get_varint(uint8_t *p, uint8_t *end, uint32_t *value)
+// ------------------------------------------------------------------------------------------------
+{
+    int shift = 0;
 
-        if (*p_cur == KISS_FEND)
+    *value = 0;
+
+    while ((p < end) && (shift < 32))
+    {
+        *value |= (*p & 0x7F) << shift;
+
+        if (!(*p++ & 0x80))
         {
-            p_ret = p_cur;
-            break;
+            return p;
         }
+
+        shift += 7;
     }
 
-    return p_ret;
+    return NULL;
 }
 
-// === Public functions ===========================================================================
-
 // ------------------------------------------------------------------------------------------------
-// Initialize the common parameters to defaults
-void kiss_init(arguments_t *arguments)
+// Convert the frames of the Tx queues to a superframe in kiss_air in the order of the scheduler. The superframe is the number of
+// frames and their lengths as variable length integers followed by the unescaped frames. The
+// superframe size is limited to max_size and frames that do not fit are left in the queue for the
+// next one. Frames that cannot fit the capacity of a transmission are dropped. Returns the
+// superframe size or 0 if there is nothing to send.
+uint32_t kiss_to_air(uint32_t max_size, uint32_t capacity, arguments_t *arguments)
 // ------------------------------------------------------------------------------------------------
 {
-    tnc_tx_keyup_delay = arguments->tnc_keyup_delay; // 50ms Tx keyup delay
-    kiss_persistence = 0.25;                          // 0.25 persistence parameter
-    kiss_slot_time = 100000;                          // 100ms slot time
-    kiss_tx_tail = 0;                                 // obsolete
+    uint8_t  *frame, *p;
+    uint32_t nb_frames = 0, frames_size = 0, frame_size, i;
+
+    while ((frame = txq_peek(&frame_size)) && (nb_frames < KISS_MAX_FRAMES))
+    {
+        if ((port_active()) && ((frame[0] >> 4) != port_current())) // next frame goes with another profile
+        {
+            break;
+        }
+
+        if (frame_size + AXC_MAX_GROWTH + 3*2 > capacity) // can never be sent
+        {
+            verbprintf(1, "KISS: frame of %d bytes too large for radio link, dropped\n", frame_size);
+            txq_pop();
+            continue;
+        }
+
+        if (frames_size + frame_size + AXC_MAX_GROWTH + 3*(nb_frames+2) > max_size) // leave it for next superframe
+        {
+            break;
+        }
+
+        if (arguments->ax25_compress)
+        {
+            frame_size = axc_compress(frame, frame_size, &kiss_frames[frames_size]);
+        }
+        else
+        {
+            memcpy(&kiss_frames[frames_size], frame, frame_size);
+        }
+
+        kiss_frame_len[nb_frames++] = frame_size;
+        frames_size += frame_size;
+        txq_pop();
+    }
+
+    if (nb_frames == 0)
+    {
+        return 0;
+    }
+
+    p = kiss_put_varint(kiss_air, nb_frames);
+
+    for (i=0; i<nb_frames; i++)
+    {
+        p = kiss_put_varint(p, kiss_frame_len[i]);
+    }
+
+    memcpy(p, kiss_frames, frames_size);
+    verbprintf(2, "KISS: %d frames, %d bytes on air\n", nb_frames, (p - kiss_air) + frames_size);
+    win_superframe(nb_frames, (p - kiss_air) + frames_size);
+
+    return (p - kiss_air) + frames_size;
 }
 
 // ------------------------------------------------------------------------------------------------
-// Remove KISS signalling
-void kiss_pack(uint8_t *kiss_block, uint8_t *packed_block, size_t *size)
+// Convert a superframe received on air back to escaped KISS frames. IP packets are given to the
+// network interface and counted in nb_packets. Returns the number of bytes written or 0 if the
+// superframe is invalid or has no KISS frames.
+uint32_t kiss_from_air(uint8_t *air, uint32_t size, uint8_t *kiss, uint32_t max_size, uint32_t *nb_packets, arguments_t *arguments)
 // ------------------------------------------------------------------------------------------------
 {
-    size_t  new_size = 0, i;
-    uint8_t fesc = 0;
+    uint8_t  *end = air + size, *p, *frame;
+    uint32_t nb_frames, i, kiss_size = 0;
+    size_t   frame_size;
+
+    *nb_packets = 0;
+
+    if (!(p = kiss_get_varint(air, end, &nb_frames)) || (nb_frames > KISS_MAX_FRAMES))
+    {
+        verbprintf(1, "KISS: invalid superframe header\n");
+        return 0;
+    }
 
-    for (i=1; i<*size-1; i++)
+    for (i=0; i<nb_frames; i++)
     {
-        if (kiss_block[i] == KISS_FESC) // FESC
+        if (!(p = kiss_get_varint(p, end, &kiss_frame_len[i])))
+        {
+            verbprintf(1, "KISS: invalid superframe header\n");
+            return 0;
+        }
+    }
+
+    frame = p;
+
+    for (i=0; i<nb_frames; i++)
+    {
+        if (kiss_frame_len[i] > end - frame)
+        {
+            verbprintf(1, "KISS: truncated superframe\n");
+            break;
+        }
+
+        if (arguments->ax25_compress)
+        {
+            frame_size = axc_expand(frame, kiss_frame_len[i], kiss_frame, radio_get_rx_source());
+        }
+        else
+        {
+            frame_size = kiss_frame_len[i];
+            memcpy(kiss_frame, frame, frame_size);
+        }
+
+        frame += kiss_frame_len[i];
+
+        if (frame_size == 0) // frame dropped
         {
-            fesc = 1;
             continue;
         }
-        if (fesc)
+
+        if ((kiss_frame[0] & 0x0F) == TUN_KISS_CMD) // IP packet: not for the AX.25 stack
         {
-            if (kiss_block[i] == KISS_TFEND) // TFEND
-            {
-                packed_block[new_size++] = KISS_FEND; // FEND
-            }
-            else if (kiss_block[i] == KISS_TFESC) // TFESC
+            if (tun_active())
             {
-                packed_block[new_size++] = KISS_FESC; // FESC    
+                tun_send(&kiss_frame[1], frame_size - 1);
+                (*nb_packets)++;
             }
 
-             fesc = 0;
-             continue;
+            continue;
+        }
+
+        if (port_active()) // frame belongs to the port of the profile it was received with
+        {
+            kiss_frame[0] = (kiss_frame[0] & 0x0F) + (port_current() << 4);
+        }
+
+        if (kiss_size + 2*frame_size + 2 > max_size)
+        {
+            verbprintf(1, "KISS: no room for received frames\n");
+            break;
         }
 
-        packed_block[new_size++] = kiss_block[i];
+        kiss_unpack(&kiss[kiss_size], kiss_frame, &frame_size); // escape and delimit
+        kiss_size += frame_size;
     }
 
-    *size = new_size;
+    return kiss_size;
 }
 
 // ------------------------------------------------------------------------------------------------
-// Restore KISS signalling
+// With KISS ports tune to the profile of the port of the next frame to send so that channel access
+// is sampled there and reception goes on meanwhile. Frames for ports that are not configured are
+// dropped. Returns 0 if no frame is left.
+uint8_t kiss_tx_port(spi_parms_t *spi_parms, arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t  *frame;
+    uint32_t size;
+
+    if (!port_active())
+    {
+        return 1;
+    }
+
+    while ((frame = txq_peek(&size)) && (!port_valid(frame[0] >> 4)))
+    {
+        verbprintf(1, "KISS: port %d is not configured, frame dropped\n", frame[0] >> 4);
+        txq_pop();
+    }
+
+    if (!frame)
+    {
+        return 0;
+    }
+
+    if ((frame[0] >> 4) != port_current())
+    {
+        radio_wait_free(spi_parms);   // Make sure no radio operation is in progress
+        port_select(frame[0] >> 4);
+        radio_init_rx(spi_parms, arguments);
+        radio_turn_rx(spi_parms);
+    }
+
+    return 1;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Arm a one shot timer. A zero delay disarms it.
+void kiss_set_timer(int timer_fd, uint32_t delay_us)
+// ------------------------------------------------------------------------------------------------
+{
+    struct itimerspec timer_spec;
+
+    memset(&timer_spec, 0, sizeof(timer_spec));
+    timer_spec.it_value.tv_sec = delay_us / 1000000;
+    timer_spec.it_value.tv_nsec = (delay_us % 1000000) * 1000;
+    timerfd_settime(timer_fd, 0, &timer_spec, NULL);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Time to wait for an event in milliseconds. None if frames are left to send right away else long
+// enough for housekeeping only. A packet waiting for channel access or its TDMA slot is woken up by
+// the access timer. Never past the next TDMA beacon or the end of the hopping dwell.
+int kiss_wait_ms(uint8_t tx_again)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t wait_ms = (tx_again ? 0 : KISS_IDLE_MS);
+    uint32_t beacon_ms = tdma_beacon_wait_ms();
+    uint32_t dwell_ms = hop_wait_ms();
+
+    if ((beacon_ms) && (beacon_ms < wait_ms))
+    {
+        wait_ms = beacon_ms;
+    }
+
+    if ((dwell_ms) && (dwell_ms < wait_ms))
+    {
+        wait_ms = dwell_ms;
+    }
+
+    return wait_ms;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Set up the event loop on the serial link unless KISS clients connect to the server or IP packets
+// go through the network interface, the radio blocks reception and the window and access timers
+void kiss_init_events(serial_t *serial_parms, arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    struct epoll_event event;
+
+    kiss_epoll_fd = epoll_create1(0);
+    kiss_window_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    kiss_keyup_fd = timerfd_create(CLOCK_MONOTONIC, 0);
+    kiss_access_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+
+    if ((!arguments->kiss_server) && (!arguments->tun_name))
+    {
+        event.data.fd = serial_parms->SERIAL_TNC;
+        epoll_ctl(kiss_epoll_fd, EPOLL_CTL_ADD, serial_parms->SERIAL_TNC, &event);
+    }
+
+    event.data.fd = radio_get_event_fd();
+    epoll_ctl(kiss_epoll_fd, EPOLL_CTL_ADD, radio_get_event_fd(), &event);
+    event.data.fd = kiss_window_fd;
+    epoll_ctl(kiss_epoll_fd, EPOLL_CTL_ADD, kiss_window_fd, &event);
+    event.data.fd = kiss_access_fd;
+    epoll_ctl(kiss_epoll_fd, EPOLL_CTL_ADD, kiss_access_fd, &event);
+}
+
+// === Public functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Initialize the common parameters to defaults
+void kiss_init(arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    tnc_tx_keyup_delay = arguments->tnc_keyup_delay; // 50ms Tx keyup delay
+    kiss_persistence = 0.25;                          // 0.25 persistence parameter
+    kiss_slot_time = 100000;                          // 100ms slot time
+    kiss_tx_tail = 0;                                 // obsolete
+    kiss_next_slot = 0;
+    srand(time(NULL));                                // randomize CSMA persistence draws
+    verbprintf(1, "KISS: %s escape scanning\n", kesc_init(1));
+}
+
+// ------------------------------------------------------------------------------------------------
+// Restore KISS signalling. Runs of bytes that need no escaping are copied at once.
 void kiss_unpack(uint8_t *kiss_block, uint8_t *packed_block, size_t *size)
 // ------------------------------------------------------------------------------------------------
 {
-    size_t  new_size = 0, i;
+    size_t  new_size = 0, i, run;
 
-    kiss_block[0] = KISS_FEND; // FEND
+    kiss_block[new_size++] = KISS_FEND; // FEND
 
     for (i=0; i<*size; i++)
     {
+        if ((run = kesc_scan(&packed_block[i], *size - i)))
+        {
+            memcpy(&kiss_block[new_size], &packed_block[i], run);
+            new_size += run;
+            i += run - 1;
+            continue;
+        }
+
         if (packed_block[i] == KISS_FEND) // FEND
         {
             kiss_block[new_size++] = KISS_FESC; // FESC
@@ -140,17 +476,18 @@ void kiss_unpack(uint8_t *kiss_block, uint8_t *packed_block, size_t *size)
 }
 
 // ------------------------------------------------------------------------------------------------
-// Check if the KISS block is a command block and interpret the command 
-// Returns 1 if this is a command block
-// Returns 0 it this is a data block
-uint8_t kiss_command(uint8_t *block)
+// Check if the unescaped KISS frame is a command frame and interpret the command. Called by the
+// parser for each complete frame received on the serial link so commands take effect at once.
+// Returns 1 if this is a command frame
+// Returns 0 it this is a data frame
+uint8_t kiss_command(uint8_t *frame, uint32_t size)
 // ------------------------------------------------------------------------------------------------
 {
-    uint8_t command_code = block[1] & 0x0F;
-    uint8_t kiss_port = (block[1] & 0xF0)>>4;
-    uint8_t command_arg = block[2];
+    uint8_t command_code = frame[0] & 0x0F;
+    uint8_t kiss_port = (frame[0] & 0xF0)>>4;
+    uint8_t command_arg = (size > 1 ? frame[1] : 0);
 
-    verbprintf(4, "KISS: command %02X %02X\n", block[1], block[2]);
+    verbprintf(4, "KISS: command %02X %02X\n", frame[0], command_arg);
 
     switch (command_code)
     {
@@ -182,49 +519,140 @@ uint8_t kiss_command(uint8_t *block)
 
 // ------------------------------------------------------------------------------------------------
 // Run the KISS virtual TNC
-void kiss_run(serial_t *serial_parms, spi_parms_t *spi_parms, arguments_t *arguments)
+void kiss_run(serial_t *serial_parms, spi_parms_t *spi_parms, radio_parms_t *radio_parms, arguments_t *arguments)
 // ------------------------------------------------------------------------------------------------
 {
     static const size_t   bufsize = RADIO_BUFSIZE;
     uint32_t timeout_value;
-    uint8_t  rx_buffer[bufsize], tx_buffer[bufsize];
+    uint8_t  rx_buffer[bufsize], tx_buffer[bufsize]; // Tx buffer takes raw serial bytes for the parser
     uint8_t  rtx_toggle; // 1:Tx, 0:Rx
     uint8_t  rx_trigger; 
     uint8_t  tx_trigger; 
     uint8_t  force_mode;
-    int      rx_count, tx_count, byte_count, ret;
-    uint64_t timestamp;
-    struct timeval tp;  
+    uint8_t  tx_again; // frames left to send without waiting for an event
+    int      rx_count, byte_count, ret;
+    uint32_t rx_packets, air_count, air_max, air_hop, air_slot, air_capacity, room, tun_packets;
+    uint64_t expirations;
+    uint8_t  serial_hup; // serial link hung up and removed from the event loop
+    uint8_t  serial_paused; // serial link not polled while the Tx queue is full
+    int      nb_events, i;
+    struct epoll_event events[KISS_MAX_EVENTS];
+    spi_parms_t *spi_rx = radio_get_rx_unit(spi_parms); // same module unless full duplex
+    uint8_t  duplex = (spi_rx != spi_parms);
+
+    if ((!arguments->kiss_server) && (!arguments->tun_name))
+    {
+        set_serial_parameters(serial_parms, arguments);
+    }
+
+    init_radio_int(arguments);
+    link_init(spi_parms, radio_parms, arguments);
+
+    if (tdma_init(radio_parms, arguments))
+    {
+        return;
+    }
 
-    set_serial_parameters(serial_parms, arguments);
-    init_radio_int(spi_parms, arguments);
+    afc_init(radio_parms, arguments);
+    axc_init();
+    lzc_init();
+    kfq_init(&kiss_tx_queue);
+    txq_init(arguments);
+    win_init(radio_parms, arguments);
     memset(rx_buffer, 0, bufsize);
     memset(tx_buffer, 0, bufsize);
     radio_flush_fifos(spi_parms);
+
+    if (duplex)
+    {
+        radio_flush_fifos(spi_rx);
+    }
+
+    kiss_init_events(serial_parms, arguments);
+
+    if ((kserv_init(arguments, kiss_epoll_fd, kiss_command)) || (tun_init(arguments, kiss_epoll_fd)))
+    {
+        return;
+    }
     
     verbprintf(1, "Starting...\n");
 
     force_mode = 1;
+    tx_again = 0;
+    serial_hup = 0;
+    serial_paused = 0;
     rtx_toggle = 0;
     rx_trigger = 0;
     tx_trigger = 0;
     rx_count = 0;
-    tx_count = 0;
-    radio_init_rx(spi_parms, arguments); // init for new packet to receive Rx
-    radio_turn_rx(spi_parms);            // Turn Rx on
+    rx_packets = packets_received;
+    radio_init_rx(spi_rx, arguments);    // init for new packet to receive Rx
+    radio_turn_rx(spi_rx);               // Turn Rx on
+    bond_turn_rx(arguments);             // Turn Rx on for bonded modules
 
     while(1)
     {    
-        byte_count = radio_receive_packet(spi_parms, arguments, &rx_buffer[rx_count]); // check if anything was received on radio link
+        nb_events = epoll_wait(kiss_epoll_fd, events, KISS_MAX_EVENTS, kiss_wait_ms(tx_again));
 
-        if (byte_count > 0)
+        for (i=0; i<nb_events; i++)
+        {
+            if (events[i].data.fd == radio_get_event_fd()) // Blocks received
+            {
+                radio_clear_event();
+            }
+            else if (events[i].data.fd == kiss_window_fd) // Window expired
+            {
+                if (read(kiss_window_fd, &expirations, sizeof(expirations)) > 0)
+                {
+                    force_mode = 1;
+                }
+            }
+            else if (events[i].data.fd == kiss_access_fd) // Time to try channel access again
+            {
+                read(kiss_access_fd, &expirations, sizeof(expirations));
+            }
+            else if (kserv_event(events[i].data.fd, events[i].events)) // Server connections and clients
+            {
+                continue;
+            }
+            else if ((events[i].data.fd == serial_parms->SERIAL_TNC) && (events[i].events & (EPOLLHUP | EPOLLERR)))
+            {
+                verbprintf(1, "KISS: serial link hung up\n");
+                epoll_ctl(kiss_epoll_fd, EPOLL_CTL_DEL, serial_parms->SERIAL_TNC, NULL);
+                serial_hup = 1;
+            }
+        }
+
+        if ((nb_events == 0) && (serial_hup)) // Retry the serial link at idle wake ups
+        {
+            events[0].events = EPOLLIN;
+            events[0].data.fd = serial_parms->SERIAL_TNC;
+            epoll_ctl(kiss_epoll_fd, EPOLL_CTL_ADD, serial_parms->SERIAL_TNC, &events[0]);
+            serial_hup = 0;
+            serial_paused = 0;
+        }
+
+        byte_count = bond_receive_packet(spi_rx, arguments, kiss_air); // check if anything was received on radio link
+
+        if ((byte_count > 0) && (arguments->lz_compress)) // Decompress superframe
+        {
+            byte_count = lzc_expand(kiss_air, byte_count, bufsize);
+        }
+
+        tun_packets = 0;
+
+        if (byte_count > 0) // Restore KISS frames
+        {
+            byte_count = kiss_from_air(kiss_air, byte_count, &rx_buffer[rx_count], bufsize - rx_count, &tun_packets, arguments);
+        }
+
+        if ((byte_count > 0) || (tun_packets > 0))
         {
             rx_count += byte_count;  // Accumulate Rx
             
-            gettimeofday(&tp, NULL);
-            timestamp = tp.tv_sec * 1000000ULL + tp.tv_usec;
-            timeout_value = arguments->tnc_radio_window;
+            timeout_value = win_radio();
             force_mode = (timeout_value == 0);
+            kiss_set_timer(kiss_window_fd, timeout_value);
 
             if (rtx_toggle) // Tx to Rx transition
             {
@@ -235,20 +663,53 @@ void kiss_run(serial_t *serial_parms, spi_parms_t *spi_parms, arguments_t *argum
                 tx_trigger = 0;
             }
 
-            radio_init_rx(spi_parms, arguments); // Init for new packet to receive
+            radio_init_rx(spi_rx, arguments); // Init for new packet to receive
             rtx_toggle = 0;
         }
 
-        byte_count = read_serial(serial_parms, &tx_buffer[tx_count], bufsize - tx_count);
+        if (packets_received != rx_packets) // Packet or control block received
+        {
+            rx_packets = packets_received;
+            port_activity();
+        }
+
+        byte_count = tun_receive(&kiss_tx_queue); // IP packets from the network interface
 
-        if (byte_count > 0)
+        if (kserv_active()) // Frames of the clients already parsed
+        {
+            byte_count += kserv_merge(&kiss_tx_queue);
+        }
+        else if (!tun_active())
         {
-            tx_count += byte_count;  // Accumulate Tx
+            room = kfq_room(&kiss_tx_queue);
 
-            gettimeofday(&tp, NULL);
-            timestamp = tp.tv_sec * 1000000ULL + tp.tv_usec;
-            timeout_value = arguments->tnc_serial_window;
+            if ((room == 0) != serial_paused) // Stop polling the serial link while the Tx queue is full
+            {
+                serial_paused = (room == 0);
+                events[0].events = (serial_paused ? 0 : EPOLLIN);
+                events[0].data.fd = serial_parms->SERIAL_TNC;
+
+                if (!serial_hup)
+                {
+                    epoll_ctl(kiss_epoll_fd, EPOLL_CTL_MOD, serial_parms->SERIAL_TNC, &events[0]);
+                }
+            }
+
+            byte_count = (room ? read_serial(serial_parms, (char *) tx_buffer, (room < bufsize ? room : bufsize)) : 0);
+
+            if (byte_count > 0)
+            {
+                kfq_parse(&kiss_tx_queue, tx_buffer, byte_count, kiss_command); // Queue complete frames and run commands
+            }
+        }
+
+        txq_classify(&kiss_tx_queue); // Sort frames in the priority queues
+
+        if (byte_count > 0)
+        {
+            timeout_value = win_serial(txq_bytes());
             force_mode = (timeout_value == 0);
+            kiss_set_timer(kiss_window_fd, timeout_value);
 
             if (!rtx_toggle) // Rx to Tx transition
             {
@@ -264,52 +725,162 @@ void kiss_run(serial_t *serial_parms, spi_parms_t *spi_parms, arguments_t *argum
 
         if ((rx_count > 0) && ((rx_trigger) || (force_mode))) // Send bytes received on air to serial
         {
-            radio_wait_free();            // Make sure no radio operation is in progress
-            radio_turn_idle(spi_parms);   // Inhibit radio operations
+            radio_wait_free(spi_rx);      // Make sure no radio operation is in progress
+
+            if ((!arguments->fast_turnaround) && (!duplex))
+            {
+                radio_turn_idle(spi_parms);   // Inhibit radio operations
+            }
+
             verbprintf(2, "Received %d bytes\n", rx_count);
-            ret = write_serial(serial_parms, rx_buffer, rx_count);
-            verbprintf(2, "Sent %d bytes on serial\n", ret);
-            radio_init_rx(spi_parms, arguments); // Init for new packet to receive Rx
-            radio_turn_rx(spi_parms);            // Put back into Rx
+
+            if (kserv_active())
+            {
+                kserv_send(rx_buffer, rx_count);
+            }
+            else if (tun_active()) // no KISS host
+            {
+                verbprintf(2, "No KISS host for %d bytes\n", rx_count);
+            }
+            else
+            {
+                ret = write_serial(serial_parms, rx_buffer, rx_count);
+                verbprintf(2, "Sent %d bytes on serial\n", ret);
+            }
+
+            if ((!arguments->fast_turnaround) && (!duplex))
+            {
+                radio_init_rx(spi_parms, arguments); // Init for new packet to receive Rx
+                radio_turn_rx(spi_parms);            // Put back into Rx
+            }
+
             rx_count = 0;
             rx_trigger = 0;
         }
 
-        if ((tx_count > 0) && ((tx_trigger) || (force_mode))) // Send bytes received on serial to air 
+        hop_check(spi_parms, arguments, (txq_count() > 0) || (tdma_beacon_due()) || (link_control_pending())); // Channel of the current dwell
+
+        tx_again = 0;
+
+        if ((txq_count() > 0) && ((tx_trigger) || (force_mode))) // Send frames received on serial to air 
         {
-            if (!kiss_command(tx_buffer))
+            air_count = 0;
+
+            if ((kiss_tx_port(spi_parms, arguments))                // else all frames were for unknown ports
+                && (air_max = tdma_tx_budget(radio_parms, arguments, tnc_tx_keyup_delay)) // else wait for own TDMA slot
+                && (hop_tx_budget(radio_parms, arguments, tnc_tx_keyup_delay)) // else wait for next dwell
+                && (kiss_channel_access(spi_parms, arguments))     // else wait for next slot still receiving
+                && (air_slot = tdma_tx_budget(radio_parms, arguments, tnc_tx_keyup_delay)) // time left in the TDMA slot after channel access
+                && (air_hop = hop_tx_budget(radio_parms, arguments, tnc_tx_keyup_delay))) // time left in the dwell after channel access
             {
-                radio_wait_free();            // Make sure no radio operation is in progress
-                radio_turn_idle(spi_parms);   // Inhibit radio operations (should be superfluous since both Tx and Rx turn to IDLE after a packet has been processed)
-                radio_flush_fifos(spi_parms); // Flush result of any Rx activity
+                air_capacity = tdma_slot_capacity(radio_parms, arguments);
+
+                if (air_max > air_slot)
+                {
+                    air_max = air_slot;
+                }
+
+                if (air_max > air_hop)
+                {
+                    air_max = air_hop;
+                }
 
-                verbprintf(2, "%d bytes to send\n", tx_count);
+                if (air_capacity > hop_dwell_capacity(radio_parms, arguments))
+                {
+                    air_capacity = hop_dwell_capacity(radio_parms, arguments);
+                }
 
-                if (tnc_tx_keyup_delay)
+                if (air_max > bond_capacity(arguments)) // stripes must fit in the Rx rings of bonded modules
                 {
-                    usleep(tnc_tx_keyup_delay);
+                    air_max = bond_capacity(arguments);
                 }
 
-                radio_send_packet(spi_parms, arguments, tx_buffer, tx_count);
+                if (air_capacity > bond_capacity(arguments))
+                {
+                    air_capacity = bond_capacity(arguments);
+                }
 
-                radio_init_rx(spi_parms, arguments); // init for new packet to receive Rx
-                radio_turn_rx(spi_parms);            // put back into Rx
+                if (arguments->lz_compress) // room for compression header
+                {
+                    air_max--;
+                    air_capacity--;
+                }
+
+                air_count = kiss_to_air(air_max, air_capacity, arguments); // Unescaped frames and length table
+
+                if (air_count > 0)
+                {
+                    radio_wait_free(spi_parms);   // Make sure no radio operation is in progress
+                    radio_prepare_tx(spi_parms);  // Inhibit Rx and flush FIFOs if necessary
+
+                    verbprintf(2, "%d bytes to send\n", air_count);
+
+                    kiss_set_timer(kiss_keyup_fd, tnc_tx_keyup_delay); // Keyup delay runs while compressing
+
+                    if (arguments->lz_compress) // Compress superframe unless it does not shrink
+                    {
+                        air_count = lzc_compress(kiss_air, air_count, bufsize);
+                    }
+
+                    if (tnc_tx_keyup_delay)
+                    {
+                        read(kiss_keyup_fd, &expirations, sizeof(expirations)); // Wait for the rest of the delay
+                    }
+
+                    if (air_count > 0) // else dropped by the compressor
+                    {
+                        bond_send_packet(spi_parms, arguments, kiss_air, air_count); // or plain packet without bonding
+                        port_activity();          // Stay on this port for the answer
+                    }
+
+                    if (!duplex) // else Tx module returns to IDLE and Rx module is still receiving
+                    {
+                        radio_init_rx(spi_parms, arguments); // init for new packet to receive Rx
+                        radio_turn_rx(spi_parms);            // put back into Rx
+                    }
+                }
+
+                if (air_count > 0)
+                {
+                    tx_trigger = 0;
+                }
+            }
+
+            if (air_count > 0) // the rest if any goes without waiting
+            {
+                tx_again = (txq_count() > 0) && (force_mode);
             }
+            else // wake up for the next channel access attempt
+            {
+                kiss_set_timer(kiss_access_fd, kiss_access_wait_us(radio_parms, arguments));
+            }
+        }
 
-            tx_count = 0;
-            tx_trigger = 0;            
+        if ((tdma_beacon_due()) && (hop_tx_budget(radio_parms, arguments, 0))) // Start a new TDMA superframe
+        {
+            radio_wait_free(spi_parms);   // Make sure no radio operation is in progress
+            radio_prepare_tx(spi_parms);  // Inhibit Rx and flush FIFOs if necessary
+            tdma_send_beacon(spi_parms, arguments);
+            radio_init_rx(spi_parms, arguments); // init for new packet to receive Rx
+            radio_turn_rx(spi_parms);            // put back into Rx
         }
 
-        if (!force_mode)
+        if ((link_control_pending()) && (hop_tx_budget(radio_parms, arguments, 0))) // Send link control message
         {
-            gettimeofday(&tp, NULL);
+            radio_wait_free(spi_parms);   // Make sure no radio operation is in progress
+            radio_prepare_tx(spi_parms);  // Inhibit Rx and flush FIFOs if necessary
+            link_send_control(spi_parms, arguments);
+            radio_turn_idle(spi_parms);   // A profile switch may have put the radio back into Rx
 
-            if ((tp.tv_sec * 1000000ULL + tp.tv_usec) > timestamp + timeout_value)
+            if (!duplex)
             {
-                force_mode = 1;
-            }                        
+                radio_init_rx(spi_parms, arguments); // init for new packet to receive Rx
+                radio_turn_rx(spi_parms);            // put back into Rx
+            }
         }
 
-        radio_wait_a_bit(4);
+        link_check(arguments);
+        afc_check();
+        port_check();
     }
 }
\ No newline at end of file
@@ -15,15 +15,20 @@
 #include "main.h"
 #include "pi_cc_spi.h"
 #include "serial.h"
+#include "radio.h"
+#include "axc.h"
 
 #define KISS_FEND  0xC0
 #define KISS_TFEND 0xDC
 #define KISS_FESC  0xDB
 #define KISS_TFESC 0xDD
 
-void kiss_pack(uint8_t *kiss_block, uint8_t *packed_block, size_t *size);
+#define KISS_MAX_FRAMES 1024 // Maximum number of KISS frames in a superframe
+#define KISS_MAX_EVENTS    4 // Maximum number of events handled at each wake up
+#define KISS_IDLE_MS     100 // Wake up period for housekeeping when idle in milliseconds
+
 void kiss_unpack(uint8_t *kiss_block, uint8_t *packed_block, size_t *size);
-void kiss_run(serial_t *serial_parms, spi_parms_t *spi_parms, arguments_t *arguments);
+void kiss_run(serial_t *serial_parms, spi_parms_t *spi_parms, radio_parms_t *radio_parms, arguments_t *arguments);
 void kiss_init(arguments_t *arguments);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,531 @@
+/******************************************************************************/
+/* PiCC1101  - Radio serial link using CC1101 module and Raspberry-Pi         */
+/*                                                                            */
+/* KISS server on a TCP or Unix domain socket                                 */
+/*                                                                            */
+/* Several applications share the radio by connecting to the server instead  */
+/* of the serial link. Each client has its own frame queue so that the bytes  */
+/* of different clients are parsed separately. Complete frames are merged     */
+/* into the Tx queue one frame per client in turn. Frames received on air go  */
+/* to all clients. They are buffered for each client and written as the     */
+/* socket takes them so that a slow client does not stall the others.         */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "kserv.h"
+#include "util.h"
+
+typedef struct kserv_client_s
+{
+    int      fd;                    // Client socket. -1 if the slot is free.
+    uint8_t  paused;                // Not polled for input while its queue is full
+    uint32_t events;                // Events polled
+    kfq_t    queue;                 // Frames received from this client
+    uint32_t out_count;             // Bytes waiting to be sent to this client
+    uint8_t  out[KSERV_OUT_SIZE];   // Frames received on air not yet taken by this client
+} kserv_client_t;
+
+static int            kserv_listen_fd = -1;
+static int            kserv_epoll_fd;
+static char           *kserv_unix_path;             // Unix socket to remove when closing. NULL for TCP.
+static kfq_filter_t   kserv_filter;                 // Applied to each frame parsed (KISS commands)
+static kserv_client_t kserv_clients[KSERV_MAX_CLIENTS];
+static uint32_t       kserv_next;                   // Client merged first next time
+static uint8_t        kserv_buffer[RADIO_BUFSIZE];  // Bytes read from a client
+
+// === Static functions declarations ==============================================================
+
+static int  kserv_listen_unix(char *path);
+static int  kserv_listen_tcp(char *address);
+static void kserv_accept();
+static void kserv_drop(kserv_client_t *client);
+static void kserv_read(kserv_client_t *client);
+static void kserv_poll(kserv_client_t *client, uint8_t paused);
+static void kserv_watch(kserv_client_t *client);
+static void kserv_flush(kserv_client_t *client);
+
+// === Static functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Listen on a Unix domain socket. A socket left over by a previous run is replaced. Returns the
+// socket or -1 on error.
+int kserv_listen_unix(char *path)
+// ------------------------------------------------------------------------------------------------
+{
+    struct sockaddr_un address;
+    struct stat        path_stat;
+    int                fd;
+
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "KSERV: socket path %s is too long\n", path);
+        return -1;
+    }
+
+    if ((lstat(path, &path_stat) == 0) && (S_ISSOCK(path_stat.st_mode)))
+    {
+        unlink(path);
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    {
+        return -1;
+    }
+
+    if (bind(fd, (struct sockaddr *) &address, sizeof(address)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    kserv_unix_path = strdup(path);
+    return fd;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Listen on a TCP port given as PORT or HOST:PORT. All interfaces if no host is given. Returns the
+// socket or -1 on error.
+int kserv_listen_tcp(char *address)
+// ------------------------------------------------------------------------------------------------
+{
+    struct addrinfo hints, *addresses, *a;
+    char *host = 0, *port = address, *colon;
+    int  fd = -1, on = 1;
+
+    if ((colon = strrchr(address, ':')))
+    {
+        host = strndup(address, colon - address);
+        port = colon + 1;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    if (getaddrinfo(((host) && (*host) ? host : NULL), port, &hints, &addresses) != 0)
+    {
+        free(host);
+        return -1;
+    }
+
+    for (a = addresses; a; a = a->ai_next)
+    {
+        if ((fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol)) < 0)
+        {
+            continue;
+        }
+
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        if (bind(fd, a->ai_addr, a->ai_addrlen) == 0)
+        {
+            break;
+        }
+
+        close(fd);
+        fd = -1;
+    }
+
+    freeaddrinfo(addresses);
+    free(host);
+    return fd;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Accept a new client. The connection is closed if all client slots are taken.
+void kserv_accept()
+// ------------------------------------------------------------------------------------------------
+{
+    struct epoll_event event;
+    kserv_client_t     *client = 0;
+    int                fd, i, on = 1;
+
+    if ((fd = accept(kserv_listen_fd, NULL, NULL)) < 0)
+    {
+        return;
+    }
+
+    for (i=0; i<KSERV_MAX_CLIENTS; i++)
+    {
+        if (kserv_clients[i].fd < 0)
+        {
+            client = &kserv_clients[i];
+            break;
+        }
+    }
+
+    if (!client)
+    {
+        verbprintf(1, "KSERV: %d clients already connected, connection refused\n", KSERV_MAX_CLIENTS);
+        close(fd);
+        return;
+    }
+
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)); // fails harmlessly on Unix sockets
+    fcntl(fd, F_SETFL, O_NONBLOCK); // the event loop never waits for a client
+
+    client->fd = fd;
+    client->paused = 0;
+    client->events = EPOLLIN;
+    client->out_count = 0;
+    kfq_init(&client->queue);
+
+    memset(&event, 0, sizeof(event));
+    event.events = client->events;
+    event.data.fd = fd;
+    epoll_ctl(kserv_epoll_fd, EPOLL_CTL_ADD, fd, &event);
+
+    verbprintf(1, "KSERV: client %d connected\n", client - kserv_clients);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Disconnect a client. Frames it sent that were not merged yet are lost.
+void kserv_drop(kserv_client_t *client)
+// ------------------------------------------------------------------------------------------------
+{
+    verbprintf(1, "KSERV: client %d disconnected\n", client - kserv_clients);
+    epoll_ctl(kserv_epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    client->fd = -1;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Parse the bytes a client sent into its queue. Never reads more than the queue can take.
+void kserv_read(kserv_client_t *client)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t room = kfq_room(&client->queue);
+    int      byte_count;
+
+    if (room == 0)
+    {
+        kserv_poll(client, 1);
+        return;
+    }
+
+    byte_count = read(client->fd, kserv_buffer, (room < RADIO_BUFSIZE ? room : RADIO_BUFSIZE));
+
+    if ((byte_count < 0) && ((errno == EAGAIN) || (errno == EINTR)))
+    {
+        return;
+    }
+
+    if (byte_count <= 0) // closed by the client
+    {
+        kserv_drop(client);
+        return;
+    }
+
+    kfq_parse(&client->queue, kserv_buffer, byte_count, kserv_filter);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Stop or resume polling a client for input
+void kserv_poll(kserv_client_t *client, uint8_t paused)
+// ------------------------------------------------------------------------------------------------
+{
+    client->paused = paused;
+    kserv_watch(client);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Poll a client for input unless paused and for output while bytes wait to be sent to it
+void kserv_watch(kserv_client_t *client)
+// ------------------------------------------------------------------------------------------------
+{
+    struct epoll_event event;
+    uint32_t events = (client->paused ? 0 : EPOLLIN) | (client->out_count ? EPOLLOUT : 0);
+
+    if (events == client->events)
+    {
+        return;
+    }
+
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.fd = client->fd;
+    epoll_ctl(kserv_epoll_fd, EPOLL_CTL_MOD, client->fd, &event);
+    client->events = events;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Send as many buffered bytes as the client socket takes without waiting. The client is
+// disconnected on error.
+void kserv_flush(kserv_client_t *client)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t sent = 0;
+    int      ret;
+
+    while (sent < client->out_count)
+    {
+        ret = send(client->fd, &client->out[sent], client->out_count - sent, MSG_NOSIGNAL);
+
+        if ((ret < 0) && (errno == EINTR))
+        {
+            continue;
+        }
+
+        if ((ret < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) // socket buffer full
+        {
+            break;
+        }
+
+        if (ret <= 0)
+        {
+            verbprintf(1, "KSERV: client %d does not take frames: %s\n", client - kserv_clients, strerror(errno));
+            kserv_drop(client);
+            return;
+        }
+
+        sent += ret;
+    }
+
+    if (sent)
+    {
+        memmove(client->out, &client->out[sent], client->out_count - sent);
+        client->out_count -= sent;
+    }
+
+    kserv_watch(client);
+}
+
+// === Public functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Open the server socket and add it to the event loop. A path starting with / is a Unix domain
+// socket else a TCP port. Returns 0 if there is no server or it is listening.
+uint8_t kserv_init(arguments_t *arguments, int epoll_fd, kfq_filter_t filter)
+// ------------------------------------------------------------------------------------------------
+{
+    struct epoll_event event;
+    int i;
+
+    kserv_epoll_fd = epoll_fd;
+    kserv_filter = filter;
+    kserv_next = 0;
+
+    for (i=0; i<KSERV_MAX_CLIENTS; i++)
+    {
+        kserv_clients[i].fd = -1;
+    }
+
+    if (!arguments->kiss_server)
+    {
+        return 0;
+    }
+
+    if (arguments->kiss_server[0] == '/')
+    {
+        kserv_listen_fd = kserv_listen_unix(arguments->kiss_server);
+    }
+    else
+    {
+        kserv_listen_fd = kserv_listen_tcp(arguments->kiss_server);
+    }
+
+    if ((kserv_listen_fd < 0) || (listen(kserv_listen_fd, KSERV_BACKLOG) != 0))
+    {
+        fprintf(stderr, "KSERV: cannot listen on %s: %s\n", arguments->kiss_server, strerror(errno));
+        kserv_close();
+        return 1;
+    }
+
+    fcntl(kserv_listen_fd, F_SETFL, O_NONBLOCK);
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = kserv_listen_fd;
+    epoll_ctl(kserv_epoll_fd, EPOLL_CTL_ADD, kserv_listen_fd, &event);
+
+    verbprintf(1, "KSERV: listening on %s\n", arguments->kiss_server);
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Returns 1 if clients connect to the server instead of the serial link
+uint8_t kserv_active()
+// ------------------------------------------------------------------------------------------------
+{
+    return (kserv_listen_fd >= 0);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Handle an event of the event loop. Returns 1 if it was for the server or one of its clients.
+uint8_t kserv_event(int fd, uint32_t events)
+// ------------------------------------------------------------------------------------------------
+{
+    int i;
+
+    if (!kserv_active())
+    {
+        return 0;
+    }
+
+    if (fd == kserv_listen_fd)
+    {
+        kserv_accept();
+        return 1;
+    }
+
+    for (i=0; i<KSERV_MAX_CLIENTS; i++)
+    {
+        if (kserv_clients[i].fd == fd)
+        {
+            if (events & EPOLLOUT) // room in the socket for buffered bytes
+            {
+                kserv_flush(&kserv_clients[i]);
+
+                if (kserv_clients[i].fd < 0) // dropped
+                {
+                    return 1;
+                }
+            }
+
+            if (events & EPOLLIN) // reads what is left and sees the end of the connection
+            {
+                kserv_read(&kserv_clients[i]);
+            }
+            else if (events & (EPOLLHUP | EPOLLERR))
+            {
+                kserv_drop(&kserv_clients[i]);
+            }
+
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Move complete frames of the clients to the Tx queue taking one frame of each client in turn
+// until the Tx queue is full. Clients whose queue is full are polled again once there is room.
+// Returns the number of frames moved.
+uint32_t kserv_merge(kfq_t *tx_queue)
+// ------------------------------------------------------------------------------------------------
+{
+    kserv_client_t *client;
+    uint32_t nb_frames = 0, size, i;
+    uint8_t  *frame, moved = 1, full = 0;
+
+    while ((moved) && (!full))
+    {
+        moved = 0;
+
+        for (i=0; (i<KSERV_MAX_CLIENTS) && (!full); i++)
+        {
+            client = &kserv_clients[(kserv_next + i) % KSERV_MAX_CLIENTS];
+
+            if ((client->fd < 0) || (!(frame = kfq_peek(&client->queue, &size))))
+            {
+                continue;
+            }
+
+            if (kfq_append(tx_queue, frame, size))
+            {
+                full = 1;
+            }
+            else
+            {
+                kfq_pop(&client->queue);
+                nb_frames++;
+                moved = 1;
+            }
+        }
+    }
+
+    kserv_next = (kserv_next + 1) % KSERV_MAX_CLIENTS; // next client goes first next time
+
+    for (i=0; i<KSERV_MAX_CLIENTS; i++)
+    {
+        if (kserv_clients[i].fd >= 0)
+        {
+            kserv_poll(&kserv_clients[i], (kfq_room(&kserv_clients[i].queue) == 0));
+        }
+    }
+
+    return nb_frames;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Send escaped KISS frames to all clients. The bytes are buffered for each client and sent as
+// its socket takes them. A client whose buffer is full is disconnected.
+void kserv_send(uint8_t *bytes, uint32_t size)
+// ------------------------------------------------------------------------------------------------
+{
+    kserv_client_t *client;
+    int i;
+
+    for (i=0; i<KSERV_MAX_CLIENTS; i++)
+    {
+        client = &kserv_clients[i];
+
+        if (client->fd < 0)
+        {
+            continue;
+        }
+
+        if (client->out_count + size > KSERV_OUT_SIZE)
+        {
+            verbprintf(1, "KSERV: client %d does not take frames, %d bytes waiting\n", i, client->out_count);
+            kserv_drop(client);
+            continue;
+        }
+
+        memcpy(&client->out[client->out_count], bytes, size);
+        client->out_count += size;
+        kserv_flush(client);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Disconnect all clients and close the server socket
+void kserv_close()
+// ------------------------------------------------------------------------------------------------
+{
+    int i;
+
+    if (kserv_listen_fd >= 0) // else client slots may not be initialized yet
+    {
+        for (i=0; i<KSERV_MAX_CLIENTS; i++)
+        {
+            if (kserv_clients[i].fd >= 0)
+            {
+                close(kserv_clients[i].fd);
+                kserv_clients[i].fd = -1;
+            }
+        }
+
+        close(kserv_listen_fd);
+        kserv_listen_fd = -1;
+    }
+
+    if (kserv_unix_path)
+    {
+        unlink(kserv_unix_path);
+        free(kserv_unix_path);
+        kserv_unix_path = 0;
+    }
+}
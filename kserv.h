@@ -0,0 +1,29 @@
+/******************************************************************************/
+/* PiCC1101  - Radio serial link using CC1101 module and Raspberry-Pi         */
+/*                                                                            */
+/* KISS server on a TCP or Unix domain socket                                 */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef _KSERV_H_
+#define _KSERV_H_
+
+#include <stdint.h>
+
+#include "main.h"
+#include "kfq.h"
+
+#define KSERV_MAX_CLIENTS     8 // Maximum number of clients connected at once
+#define KSERV_BACKLOG         4 // Connections waiting to be accepted
+#define KSERV_OUT_SIZE (2*RADIO_BUFSIZE) // Bytes buffered for a client that is slow to take frames before it is disconnected
+
+uint8_t  kserv_init(arguments_t *arguments, int epoll_fd, kfq_filter_t filter);
+uint8_t  kserv_active();
+uint8_t  kserv_event(int fd, uint32_t events);
+uint32_t kserv_merge(kfq_t *tx_queue);
+void     kserv_send(uint8_t *bytes, uint32_t size);
+void     kserv_close();
+
+#endif
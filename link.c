@@ -0,0 +1,468 @@
+/******************************************************************************/
+/* PiCC1101  - Radio serial link using CC1101 module and Raspberry-Pi         */
+/*                                                                            */
+/* Link quality monitoring and adaptive data rate                             */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#include <string.h>
+#include <sys/time.h>
+
+#include "link.h"
+#include "axc.h"
+#include "tdma.h"
+#include "bond.h"
+#include "util.h"
+
+static spi_parms_t   *link_spi_parms;
+static radio_parms_t *link_radio_parms;
+static arguments_t   *link_arguments;
+static link_peer_t   link_peers[LINK_MAX_PEERS];
+static rate_t        link_base_rate;          // Initial rate. Fallback when the link is lost
+static modulation_t  link_base_modulation;    // Initial modulation. Fallback when the link is lost
+static uint8_t       link_ctl[3];             // Pending control message: code, rate index, modulation index
+static uint8_t       link_ctl_pending;        // A control message is waiting to be sent
+static uint8_t       link_axc_reset_pending;  // An address compression dictionary reset request is waiting to be sent
+static uint8_t       link_switch_on_sent;     // Switch to the acknowledged profile once the control message is sent
+static uint8_t       link_proposal;           // A proposal has been sent and is waiting for acknowledgement
+static struct timeval link_proposal_time;     // Time the proposal was sent
+static struct timeval link_last_good;         // Time the last good block was received
+static uint8_t       link_last_peer;          // Address of the last peer a block was received from
+
+// === Static functions declarations ==============================================================
+
+static uint8_t link_step(int step, rate_t *rate, modulation_t *modulation);
+static uint8_t link_allowed(rate_t rate, modulation_t modulation);
+static void    link_propose(int step);
+static void    link_switch(rate_t rate, modulation_t modulation);
+static void    link_reset_windows();
+static uint32_t link_elapsed_s(struct timeval *since);
+
+// === Static functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Compute next rate and modulation one step up (step > 0) or down (step < 0) the ladder.
+// The ladder goes through the rate indexes between the adaptation limits with the initial
+// modulation. For 2-FSK and GFSK a last step uses 4-FSK at the maximum rate.
+// Returns 1 if a step is possible else 0
+uint8_t link_step(int step, rate_t *rate, modulation_t *modulation)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t fsk4_step = ((link_base_modulation == MOD_FSK2) || (link_base_modulation == MOD_GFSK));
+
+    if (step > 0)
+    {
+        if (*rate < link_arguments->link_rate_max)
+        {
+            (*rate)++;
+            return 1;
+        }
+        else if ((fsk4_step) && (*modulation != MOD_FSK4) && (rate_values[*rate] <= 300000))
+        {
+            *modulation = MOD_FSK4;
+            return 1;
+        }
+    }
+    else if (step < 0)
+    {
+        if ((fsk4_step) && (*modulation == MOD_FSK4))
+        {
+            *modulation = link_base_modulation;
+            return 1;
+        }
+        else if (*rate > link_arguments->link_rate_min)
+        {
+            (*rate)--;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Returns 1 if rate and modulation are on the local ladder else 0
+uint8_t link_allowed(rate_t rate, modulation_t modulation)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t fsk4_step = ((link_base_modulation == MOD_FSK2) || (link_base_modulation == MOD_GFSK));
+
+    if ((rate < link_arguments->link_rate_min) || (rate > link_arguments->link_rate_max))
+    {
+        return 0;
+    }
+
+    if (modulation == link_base_modulation)
+    {
+        return 1;
+    }
+
+    return ((fsk4_step) && (modulation == MOD_FSK4) && (rate == link_arguments->link_rate_max) && (rate_values[rate] <= 300000));
+}
+
+// ------------------------------------------------------------------------------------------------
+// Queue a rate change proposal one step up or down
+void link_propose(int step)
+// ------------------------------------------------------------------------------------------------
+{
+    rate_t       rate = link_arguments->rate;
+    modulation_t modulation = link_arguments->modulation;
+
+    if ((link_ctl_pending) || (link_proposal))
+    {
+        return;
+    }
+
+    if (!link_step(step, &rate, &modulation))
+    {
+        return;
+    }
+
+    verbprintf(1, "LINK: propose %d Baud %s\n", rate_values[rate], modulation_names[modulation]);
+
+    link_ctl[0] = LINK_CTL_RATE_PROPOSE;
+    link_ctl[1] = (uint8_t) rate;
+    link_ctl[2] = (uint8_t) modulation;
+    link_ctl_pending = 1;
+    link_switch_on_sent = 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Reprogram the modem for new rate and modulation and put back into Rx
+void link_switch(rate_t rate, modulation_t modulation)
+// ------------------------------------------------------------------------------------------------
+{
+    verbprintf(1, "LINK: switch from %d Baud %s to %d Baud %s\n",
+        rate_values[link_arguments->rate], modulation_names[link_arguments->modulation],
+        rate_values[rate], modulation_names[modulation]);
+
+    link_arguments->rate = rate;
+    link_arguments->modulation = modulation;
+
+    radio_wait_free(link_spi_parms);
+    radio_set_modem(link_spi_parms, link_radio_parms, link_arguments);
+    radio_init_rx(radio_get_rx_unit(link_spi_parms), link_arguments); // Rx module in full duplex
+    radio_turn_rx(radio_get_rx_unit(link_spi_parms));
+    bond_turn_rx(link_arguments); // all bonded modules were put in IDLE
+
+    link_proposal = 0;
+    link_reset_windows();
+    gettimeofday(&link_last_good, NULL); // restart the fallback timer
+}
+
+// ------------------------------------------------------------------------------------------------
+// Restart evaluation windows of all peers
+void link_reset_windows()
+// ------------------------------------------------------------------------------------------------
+{
+    int i;
+
+    for (i=0; i<LINK_MAX_PEERS; i++)
+    {
+        link_peers[i].window_blocks = 0;
+        link_peers[i].window_errors = 0;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Seconds elapsed since given time
+uint32_t link_elapsed_s(struct timeval *since)
+// ------------------------------------------------------------------------------------------------
+{
+    struct timeval now, delta;
+
+    gettimeofday(&now, NULL);
+    timeval_subtract(&delta, &now, since);
+
+    return delta.tv_sec;
+}
+
+// === Public functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Initialize link quality monitoring
+void link_init(spi_parms_t *spi_parms, radio_parms_t *radio_parms, arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    link_spi_parms = spi_parms;
+    link_radio_parms = radio_parms;
+    link_arguments = arguments;
+    link_base_rate = arguments->rate;
+    link_base_modulation = arguments->modulation;
+    link_ctl_pending = 0;
+    link_axc_reset_pending = 0;
+    link_switch_on_sent = 0;
+    link_proposal = 0;
+    memset(link_peers, 0, sizeof(link_peers));
+    link_last_peer = 0;
+    gettimeofday(&link_last_good, NULL);
+
+    if (arguments->link_adapt)
+    {
+        verbprintf(1, "LINK: adaptive rate between %d and %d Baud\n",
+            rate_values[arguments->link_rate_min],
+            rate_values[arguments->link_rate_max]);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Get peer statistics by address. Allocates a new slot if necessary.
+// When the table is full the last slot is recycled.
+link_peer_t *link_get_peer(uint8_t address)
+// ------------------------------------------------------------------------------------------------
+{
+    int i;
+
+    for (i=0; i<LINK_MAX_PEERS; i++)
+    {
+        if ((link_peers[i].in_use) && (link_peers[i].address == address))
+        {
+            return &link_peers[i];
+        }
+    }
+
+    for (i=0; i<LINK_MAX_PEERS-1; i++)
+    {
+        if (!link_peers[i].in_use)
+        {
+            break;
+        }
+    }
+
+    memset(&link_peers[i], 0, sizeof(link_peer_t));
+    link_peers[i].in_use = 1;
+    link_peers[i].address = address;
+
+    return &link_peers[i];
+}
+
+// ------------------------------------------------------------------------------------------------
+// Account for a block received from a peer. RSSI and LQI/CRC are the status bytes appended to the block.
+void link_rx_block(uint8_t address, uint8_t rssi_dec, uint8_t crc_lqi)
+// ------------------------------------------------------------------------------------------------
+{
+    link_peer_t *peer = link_get_peer(address);
+    float rssi = rssi_dbm(rssi_dec);
+    uint8_t lqi = 0x7F - (crc_lqi & 0x7F); // higher is better as printed for received blocks
+
+    link_last_peer = address;
+
+    if (crc_lqi & PI_CCxxx0_CRC_OK)
+    {
+        if (peer->blocks_ok == 0)
+        {
+            peer->rssi_avg = rssi;
+            peer->lqi_avg = lqi;
+        }
+        else
+        {
+            peer->rssi_avg += (rssi - peer->rssi_avg) / 8.0;
+            peer->lqi_avg += (lqi - peer->lqi_avg) / 8.0;
+        }
+
+        peer->blocks_ok++;
+        gettimeofday(&link_last_good, NULL);
+    }
+    else
+    {
+        peer->blocks_crc++;
+        peer->window_errors++;
+    }
+
+    peer->window_blocks++;
+
+    if (!link_arguments->link_adapt)
+    {
+        return;
+    }
+
+    if (peer->window_errors >= LINK_ERRORS_DOWN)
+    {
+        verbprintf(2, "LINK: peer %d: %d CRC errors in %d blocks\n", address, peer->window_errors, peer->window_blocks);
+        link_propose(-1);
+        peer->window_blocks = 0;
+        peer->window_errors = 0;
+    }
+    else if (peer->window_blocks >= LINK_WINDOW)
+    {
+        verbprintf(2, "LINK: peer %d: RSSI %.1f dBm LQI %.1f, %d CRC errors in %d blocks\n",
+            address, peer->rssi_avg, peer->lqi_avg, peer->window_errors, peer->window_blocks);
+
+        if ((peer->window_errors == 0) && (peer->rssi_avg >= LINK_RSSI_UP_DBM) && (peer->lqi_avg >= LINK_LQI_UP))
+        {
+            link_propose(1);
+        }
+
+        peer->window_blocks = 0;
+        peer->window_errors = 0;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Account for blocks with bad CRC discarded by the chip. Their source is unknown so they are
+// charged to the last peer heard.
+void link_rx_dropped(uint32_t count)
+// ------------------------------------------------------------------------------------------------
+{
+    verbprintf(2, "LINK: %d blocks with bad CRC dropped by the chip\n", count);
+
+    while (count--)
+    {
+        link_rx_block(link_last_peer, 0, 0); // status bytes with CRC not OK
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Interpret a link control message received from the peer
+void link_rx_control(uint8_t *control, uint8_t size)
+// ------------------------------------------------------------------------------------------------
+{
+    if ((size > 0) && (control[0] == LINK_CTL_TDMA_BEACON)) // has its own payload
+    {
+        tdma_rx_beacon(&control[1], size - 1);
+        return;
+    }
+
+    if ((size > 0) && (control[0] == LINK_CTL_AXC_RESET)) // no payload
+    {
+        axc_reset_tx();
+        return;
+    }
+
+    if ((size < 3) || (control[1] >= NUM_RATE) || (control[2] >= NUM_MOD))
+    {
+        verbprintf(1, "LINK: invalid control message\n");
+        return;
+    }
+
+    switch (control[0])
+    {
+        case LINK_CTL_RATE_PROPOSE: // acknowledge and switch once acknowledgement is sent
+            verbprintf(1, "LINK: peer proposes %d Baud %s\n", rate_values[control[1]], modulation_names[control[2]]);
+
+            if ((!link_arguments->link_adapt) || (!link_allowed((rate_t) control[1], (modulation_t) control[2])))
+            {
+                verbprintf(1, "LINK: proposal rejected\n"); // not acknowledged: the peer times out and stays
+                break;
+            }
+
+            link_ctl[0] = LINK_CTL_RATE_ACK;
+            link_ctl[1] = control[1];
+            link_ctl[2] = control[2];
+            link_ctl_pending = 1;
+            link_switch_on_sent = 1;
+            link_proposal = 0; // peer proposal takes precedence
+            break;
+        case LINK_CTL_RATE_ACK: // switch if this is the acknowledgement of our proposal
+            if ((link_proposal) && (control[1] == link_ctl[1]) && (control[2] == link_ctl[2]))
+            {
+                link_switch((rate_t) control[1], (modulation_t) control[2]);
+            }
+            break;
+        default:
+            verbprintf(1, "LINK: unknown control message %d\n", control[0]);
+            break;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Returns 1 if a control message is waiting to be sent
+uint8_t link_control_pending()
+// ------------------------------------------------------------------------------------------------
+{
+    return (link_ctl_pending) || (link_axc_reset_pending);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Send a pending control message. A dictionary reset request goes first and the rate message, if
+// any, is sent at the next call. Radio must be ready for transmission.
+void link_send_control(spi_parms_t *spi_parms, arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t axc_reset = LINK_CTL_AXC_RESET;
+
+    if (link_axc_reset_pending)
+    {
+        radio_send_control(spi_parms, arguments, &axc_reset, 1);
+        link_axc_reset_pending = 0;
+        return;
+    }
+
+    if (!link_ctl_pending)
+    {
+        return;
+    }
+
+    radio_send_control(spi_parms, arguments, link_ctl, sizeof(link_ctl));
+    link_ctl_pending = 0;
+
+    if (link_switch_on_sent)
+    {
+        link_switch_on_sent = 0;
+        link_switch((rate_t) link_ctl[1], (modulation_t) link_ctl[2]);
+    }
+    else if (link_ctl[0] == LINK_CTL_RATE_PROPOSE)
+    {
+        link_proposal = 1;
+        gettimeofday(&link_proposal_time, NULL);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Ask the peers to reset their address compression dictionary. Kept apart from rate messages so
+// that both can wait to be sent at the same time.
+void link_request_axc_reset()
+// ------------------------------------------------------------------------------------------------
+{
+    link_axc_reset_pending = 1;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Periodic check of proposal and fallback timeouts
+void link_check(arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    if (!arguments->link_adapt)
+    {
+        return;
+    }
+
+    if ((link_proposal) && (link_elapsed_s(&link_proposal_time) >= LINK_PROPOSAL_S))
+    {
+        verbprintf(1, "LINK: proposal not acknowledged\n");
+        link_proposal = 0;
+    }
+
+    if (((link_arguments->rate != link_base_rate) || (link_arguments->modulation != link_base_modulation))
+        && (link_elapsed_s(&link_last_good) >= LINK_FALLBACK_S))
+    {
+        verbprintf(1, "LINK: no good block for %d s, falling back to initial profile\n", LINK_FALLBACK_S);
+        link_switch(link_base_rate, link_base_modulation);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Print peers statistics
+void link_print_stats(int verbose_min)
+// ------------------------------------------------------------------------------------------------
+{
+    int i;
+
+    verbprintf(verbose_min, "LINK: %d Baud %s\n",
+        rate_values[link_arguments->rate], modulation_names[link_arguments->modulation]);
+
+    for (i=0; i<LINK_MAX_PEERS; i++)
+    {
+        if (link_peers[i].in_use)
+        {
+            verbprintf(verbose_min, "LINK: peer %d: %d good %d bad blocks, RSSI %.1f dBm, LQI %.1f\n",
+                link_peers[i].address,
+                link_peers[i].blocks_ok,
+                link_peers[i].blocks_crc,
+                link_peers[i].rssi_avg,
+                link_peers[i].lqi_avg);
+        }
+    }
+}
@@ -0,0 +1,60 @@
+/******************************************************************************/
+/* PiCC1101  - Radio serial link using CC1101 module and Raspberry-Pi         */
+/*                                                                            */
+/* Link quality monitoring and adaptive data rate                             */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef _LINK_H_
+#define _LINK_H_
+
+#include <stdint.h>
+
+#include "main.h"
+#include "pi_cc_spi.h"
+#include "radio.h"
+
+#define LINK_MAX_PEERS        8     // Number of peers tracked
+#define LINK_WINDOW          32     // Number of blocks in a link quality evaluation window
+#define LINK_ERRORS_DOWN      4     // CRC errors within a window that trigger a step down
+#define LINK_RSSI_UP_DBM  -85.0     // Minimum average RSSI to step up
+#define LINK_LQI_UP         115     // Minimum average LQI (0x7F minus chip value, higher is better) to step up
+#define LINK_PROPOSAL_S       2     // Seconds to wait for a proposal acknowledgement
+#define LINK_FALLBACK_S      20     // Seconds without a good block before returning to the initial profile
+
+typedef enum link_control_e
+{
+    LINK_CTL_NONE = 0,
+    LINK_CTL_RATE_PROPOSE,    // Propose new rate and modulation: payload is rate index and modulation index
+    LINK_CTL_RATE_ACK,        // Acknowledge proposed rate and modulation: payload is the same as proposal
+    LINK_CTL_AXC_RESET,       // Ask the peer to reset its address compression dictionary: no payload
+    LINK_CTL_TDMA_BEACON,     // TDMA superframe start: payload is the schedule (see tdma.c)
+    NUM_LINK_CTL
+} link_control_t;
+
+typedef struct link_peer_s
+{
+    uint8_t  in_use;          // Peer slot is allocated
+    uint8_t  address;         // Peer link address
+    uint32_t blocks_ok;       // Number of blocks received with good CRC
+    uint32_t blocks_crc;      // Number of blocks received with bad CRC
+    float    rssi_avg;        // Running average of RSSI in dBm
+    float    lqi_avg;         // Running average of LQI (higher is better)
+    uint8_t  window_blocks;   // Blocks in current evaluation window
+    uint8_t  window_errors;   // CRC errors in current evaluation window
+} link_peer_t;
+
+void         link_init(spi_parms_t *spi_parms, radio_parms_t *radio_parms, arguments_t *arguments);
+link_peer_t *link_get_peer(uint8_t address);
+void         link_rx_block(uint8_t address, uint8_t rssi_dec, uint8_t crc_lqi);
+void         link_rx_dropped(uint32_t count);
+void         link_rx_control(uint8_t *control, uint8_t size);
+uint8_t      link_control_pending();
+void         link_send_control(spi_parms_t *spi_parms, arguments_t *arguments);
+void         link_request_axc_reset();
+void         link_check(arguments_t *arguments);
+void         link_print_stats(int verbose_min);
+
+#endif
@@ -0,0 +1,388 @@
+/******************************************************************************/
+/* PiCC1101  - Radio serial link using CC1101 module and Raspberry-Pi         */
+/*                                                                            */
+/* Superframe payload compression                                             */
+/*                                                                            */
+/* Fast LZ77 compression in the LZ4 block format. A sequence is:              */
+/*   token: literal length (4 bits) and match length minus 4 (4 bits)         */
+/*   literal length extension bytes if 15 (255 means more follow)             */
+/*   literals                                                                 */
+/*   match offset (2 bytes little endian)                                     */
+/*   match length extension bytes if 15 (255 means more follow)               */
+/* The last sequence has literals only. Matches may reach into a preset       */
+/* dictionary primed with AX.25, IP and TCP headers and common text that      */
+/* logically precedes each superframe. A one byte header tells whether the    */
+/* superframe is compressed or sent as is when it does not shrink.            */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#include <string.h>
+
+#include "lzc.h"
+#include "radio.h"
+#include "util.h"
+
+static const uint8_t lzc_dictionary[] =
+    "\r\nContent-Type: text/html; charset=UTF-8\r\nContent-Length: "
+    "\r\nConnection: keep-alive\r\nCache-Control: no-cache\r\n"
+    "HTTP/1.1 200 OK\r\nServer: \r\nDate: GMT\r\n"
+    "GET / HTTP/1.1\r\nHost: \r\nUser-Agent: \r\nAccept: */*\r\n\r\n"
+    "<html><head><title></title></head><body></body></html>\n"
+    "<a href=\"http://www.\"></a><p></p><br>\n"
+    "login: Password: Welcome to $ # cd ls -l exit\r\n"
+    "the and that with for this from you are have not \r\n"
+    "\x03\xf0"                                     // AX.25 UI no layer 3
+    "\x03\xcc\x45\x00\x00"                         // AX.25 UI IP, IPv4 header start
+    "\x40\x00\x40\x06\x00\x00\x2c"                 // DF, TTL 64, TCP, 44.x.x.x AMPRNet
+    "\x45\x00\x00\x28\x00\x00\x40\x00\x40\x06"     // IPv4 TCP ACK only
+    "\x50\x10\x00\x00\x00\x00"                     // TCP header ACK
+    "\x50\x18\x00\x00\x00\x00"                     // TCP header PSH ACK
+    "\x00\x16\x00\x17\x00\x50"                     // ssh, telnet and http ports
+    "\x86\xa2\x40\x40\x40\x40\x60"                 // QST destination
+    "\x82\xa0\xa4\xa6\x40\x40\x60";                // APRS destination
+
+#define LZC_DICT_SIZE (sizeof(lzc_dictionary) - 1)
+
+static uint8_t     lzc_window[LZC_DICT_SIZE + RADIO_BUFSIZE]; // Preset dictionary followed by data
+static uint8_t     lzc_work[RADIO_BUFSIZE];                   // Compressed data
+static uint32_t    lzc_hash[1<<LZC_HASH_BITS];                // Last window position of each hashed 4 byte sequence
+static lzc_stats_t lzc_stats;
+
+// === Static functions declarations ==============================================================
+
+static uint32_t lzc_hash4(uint8_t *p);
+static uint8_t  *lzc_put_length(uint8_t *op, uint8_t *op_end, uint32_t length);
+static uint32_t lzc_encode(uint32_t size, uint8_t *out, uint32_t max_out);
+static uint32_t lzc_decode(uint8_t *in, uint32_t size, uint32_t max_out);
+
+// === Static functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Hash of the 4 bytes sequence at p
+uint32_t lzc_hash4(uint8_t *p)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t v = p[0] | (p[1]<<8) | (p[2]<<16) | ((uint32_t) p[3]<<24);
+    return (v * 2654435761U) >> (32 - LZC_HASH_BITS);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Write length extension bytes for a length that exceeded 15 in the token. Returns NULL on overflow
+uint8_t *lzc_put_length(uint8_t *op, uint8_t *op_end, uint32_t length)
+// ------------------------------------------------------------------------------------------------
+{
+    for (; length >= 255; length -= 255)
+    {
+        if (op >= op_end)
+        {
+            return NULL;
+        }
+
+        *op++ = 255;
+    }
+
+    if (op >= op_end)
+    {
+        return NULL;
+    }
+
+    *op++ = length;
+    return op;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Compress size bytes found in the window after the dictionary. Returns the compressed size or 0
+// if it does not fit in max_out bytes
+uint32_t lzc_encode(uint32_t size, uint8_t *out, uint32_t max_out)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t ip, anchor, ref, h, lit_len, match_len, end = LZC_DICT_SIZE + size;
+    uint8_t  *op = out, *op_end = out + max_out, *token;
+
+    memset(lzc_hash, 0, sizeof(lzc_hash));
+
+    for (ip = 0; ip + LZC_MIN_MATCH <= LZC_DICT_SIZE; ip++) // prime with dictionary
+    {
+        lzc_hash[lzc_hash4(&lzc_window[ip])] = ip;
+    }
+
+    ip = LZC_DICT_SIZE;
+    anchor = ip;
+
+    while (ip + LZC_MIN_MATCH <= end)
+    {
+        h = lzc_hash4(&lzc_window[ip]);
+        ref = lzc_hash[h];
+        lzc_hash[h] = ip;
+
+        if ((ref >= ip) || (ip - ref > LZC_MAX_OFFSET) || (memcmp(&lzc_window[ref], &lzc_window[ip], LZC_MIN_MATCH) != 0))
+        {
+            ip++;
+            continue;
+        }
+
+        for (match_len = LZC_MIN_MATCH; (ip + match_len < end) && (lzc_window[ref + match_len] == lzc_window[ip + match_len]); match_len++);
+
+        lit_len = ip - anchor;
+
+        if (op + 1 + lit_len + 2 > op_end)
+        {
+            return 0;
+        }
+
+        token = op++;
+        *token = ((lit_len < 15 ? lit_len : 15)<<4) | (match_len - LZC_MIN_MATCH < 15 ? match_len - LZC_MIN_MATCH : 15);
+
+        if ((lit_len >= 15) && !(op = lzc_put_length(op, op_end, lit_len - 15)))
+        {
+            return 0;
+        }
+
+        if (op + lit_len + 2 > op_end)
+        {
+            return 0;
+        }
+
+        memcpy(op, &lzc_window[anchor], lit_len);
+        op += lit_len;
+        *op++ = (ip - ref) & 0xFF;
+        *op++ = (ip - ref) >> 8;
+
+        if ((match_len - LZC_MIN_MATCH >= 15) && !(op = lzc_put_length(op, op_end, match_len - LZC_MIN_MATCH - 15)))
+        {
+            return 0;
+        }
+
+        ip += match_len;
+        anchor = ip;
+
+        if (ip - 2 + LZC_MIN_MATCH <= end) // make the end of the match findable
+        {
+            lzc_hash[lzc_hash4(&lzc_window[ip - 2])] = ip - 2;
+        }
+    }
+
+    lit_len = end - anchor; // last literals
+
+    if (op + 1 > op_end)
+    {
+        return 0;
+    }
+
+    *op++ = (lit_len < 15 ? lit_len : 15)<<4;
+
+    if ((lit_len >= 15) && !(op = lzc_put_length(op, op_end, lit_len - 15)))
+    {
+        return 0;
+    }
+
+    if (op + lit_len > op_end)
+    {
+        return 0;
+    }
+
+    memcpy(op, &lzc_window[anchor], lit_len);
+    op += lit_len;
+
+    return op - out;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Decompress size bytes into the window after the dictionary. Returns the decompressed size or 0
+// if the input is corrupt or the result does not fit in max_out bytes
+uint32_t lzc_decode(uint8_t *in, uint32_t size, uint32_t max_out)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t  *ip = in, *ip_end = in + size, token;
+    uint32_t op = LZC_DICT_SIZE, op_end = LZC_DICT_SIZE + max_out, length, offset;
+
+    while (ip < ip_end)
+    {
+        token = *ip++;
+        length = token>>4;
+
+        if (length == 15)
+        {
+            do
+            {
+                if (ip >= ip_end)
+                {
+                    return 0;
+                }
+
+                length += *ip;
+            } while (*ip++ == 255);
+        }
+
+        if ((ip + length > ip_end) || (op + length > op_end))
+        {
+            return 0;
+        }
+
+        memcpy(&lzc_window[op], ip, length);
+        ip += length;
+        op += length;
+
+        if (ip == ip_end) // last sequence
+        {
+            break;
+        }
+
+        if (ip + 2 > ip_end)
+        {
+            return 0;
+        }
+
+        offset = ip[0] | (ip[1]<<8);
+        ip += 2;
+        length = (token & 0x0F) + LZC_MIN_MATCH;
+
+        if (length == 15 + LZC_MIN_MATCH)
+        {
+            do
+            {
+                if (ip >= ip_end)
+                {
+                    return 0;
+                }
+
+                length += *ip;
+            } while (*ip++ == 255);
+        }
+
+        if ((offset == 0) || (offset > op) || (op + length > op_end))
+        {
+            return 0;
+        }
+
+        for (; length > 0; length--, op++) // byte by byte as source and destination may overlap
+        {
+            lzc_window[op] = lzc_window[op - offset];
+        }
+    }
+
+    return op - LZC_DICT_SIZE;
+}
+
+// === Public functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Initialize compression
+void lzc_init()
+// ------------------------------------------------------------------------------------------------
+{
+    memcpy(lzc_window, lzc_dictionary, LZC_DICT_SIZE);
+    memset(&lzc_stats, 0, sizeof(lzc_stats));
+}
+
+// ------------------------------------------------------------------------------------------------
+// Compress a superframe in place prepending the header byte. Sends it as is if it does not shrink.
+// The caller must leave room for the header byte. Returns the new size or 0 if the superframe
+// cannot be sent.
+uint32_t lzc_compress(uint8_t *packet, uint32_t size, uint32_t max_size)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t compressed_size = 0;
+
+    if (size == 0)
+    {
+        return 0;
+    }
+
+    if ((size >= max_size) || (size >= RADIO_BUFSIZE))
+    {
+        verbprintf(1, "LZC: no room for header in superframe of %d bytes, dropped\n", size);
+        return 0;
+    }
+
+    memcpy(&lzc_window[LZC_DICT_SIZE], packet, size);
+
+    if (size > LZC_MIN_MATCH)
+    {
+        compressed_size = lzc_encode(size, lzc_work, size - 1); // must save at least the header byte
+    }
+
+    lzc_stats.superframes++;
+    lzc_stats.bytes_in += size;
+
+    if (compressed_size == 0)
+    {
+        memmove(&packet[1], packet, size);
+        packet[0] = LZC_RAW;
+        size++;
+        lzc_stats.skipped++;
+    }
+    else
+    {
+        packet[0] = LZC_LZ;
+        memcpy(&packet[1], lzc_work, compressed_size);
+        size = compressed_size + 1;
+    }
+
+    lzc_stats.bytes_out += size;
+    lzc_print_stats(2);
+
+    return size;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Restore a superframe in place. Returns the new size or 0 if it cannot be decompressed.
+uint32_t lzc_expand(uint8_t *packet, uint32_t size, uint32_t max_size)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t expanded_size;
+
+    if (size == 0)
+    {
+        return 0;
+    }
+
+    if (packet[0] == LZC_RAW)
+    {
+        memmove(packet, &packet[1], size - 1);
+        return size - 1;
+    }
+    else if (packet[0] != LZC_LZ)
+    {
+        verbprintf(1, "LZC: unknown superframe header %02X, dropped\n", packet[0]);
+        return 0;
+    }
+
+    if (max_size > RADIO_BUFSIZE)
+    {
+        max_size = RADIO_BUFSIZE;
+    }
+
+    expanded_size = lzc_decode(&packet[1], size - 1, max_size);
+
+    if (expanded_size == 0)
+    {
+        verbprintf(1, "LZC: corrupt superframe, dropped\n");
+        return 0;
+    }
+
+    memcpy(packet, &lzc_window[LZC_DICT_SIZE], expanded_size);
+    verbprintf(2, "LZC: %d bytes expanded to %d\n", size, expanded_size);
+
+    return expanded_size;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Print compression statistics of the link
+void lzc_print_stats(int verbose_min)
+// ------------------------------------------------------------------------------------------------
+{
+    if (lzc_stats.bytes_in == 0)
+    {
+        return;
+    }
+
+    verbprintf(verbose_min, "LZC: %d superframes (%d sent as is), %llu bytes compressed to %llu (%.1f%%)\n",
+        lzc_stats.superframes,
+        lzc_stats.skipped,
+        (unsigned long long) lzc_stats.bytes_in,
+        (unsigned long long) lzc_stats.bytes_out,
+        (100.0 * lzc_stats.bytes_out) / lzc_stats.bytes_in);
+}
@@ -0,0 +1,36 @@
+/******************************************************************************/
+/* PiCC1101  - Radio serial link using CC1101 module and Raspberry-Pi         */
+/*                                                                            */
+/* Superframe payload compression                                             */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef _LZC_H_
+#define _LZC_H_
+
+#include <stdint.h>
+
+#include "main.h"
+
+#define LZC_RAW          0x00   // Superframe header: payload is sent as is
+#define LZC_LZ           0x01   // Superframe header: payload is compressed
+#define LZC_HASH_BITS      12   // Size of the match finder hash table (log2)
+#define LZC_MIN_MATCH       4   // Minimum match length
+#define LZC_MAX_OFFSET  65535   // Maximum match distance
+
+typedef struct lzc_stats_s
+{
+    uint32_t superframes;       // Number of superframes sent
+    uint32_t skipped;           // Number of superframes sent as is because they did not shrink
+    uint64_t bytes_in;          // Payload bytes before compression
+    uint64_t bytes_out;         // Payload bytes after compression including headers
+} lzc_stats_t;
+
+void     lzc_init();
+uint32_t lzc_compress(uint8_t *packet, uint32_t size, uint32_t max_size);
+uint32_t lzc_expand(uint8_t *packet, uint32_t size, uint32_t max_size);
+void     lzc_print_stats(int verbose_min);
+
+#endif
@@ -18,11 +18,17 @@
 #include "serial.h"
 #include "pi_cc_spi.h"
 #include "radio.h"
+#include "bond.h"
+#include "port.h"
 #include "kiss.h"
+#include "kserv.h"
+#include "tun.h"
+#include "test.h"
 
 arguments_t   arguments;
 serial_t      serial_parameters;
 spi_parms_t   spi_parameters;
+spi_parms_t   spi_rx_parameters;  // Reception module in full duplex
 radio_parms_t radio_parameters;
 
 char *test_mode_names[] = {
@@ -32,7 +38,8 @@ char *test_mode_names[] = {
     "Simple Rx with polling. Packet < 64 bytes",
     "Simple Rx with packet interrupt handling. Packet up to 255 bytes",
     "Simple echo test starting with Tx",
-    "Simple echo test starting with Rx"
+    "Simple echo test starting with Rx",
+    "KISS escape benchmark (no radio)"
 };
 
 char *modulation_names[] = {
@@ -43,26 +50,6 @@ char *modulation_names[] = {
     "GFSK",
 };
 
-uint32_t rate_values[] = {
-    50,
-    110,
-    300,
-    600,
-    1200,
-    2400,
-    4800,
-    9600,
-    14400,
-    19200,
-    28800,
-    38400,
-    57600,
-    76800,
-    115200,
-    250000,
-    500000
-};
-
 uint8_t nb_preamble_bytes[] = {
     2,
     3,
@@ -104,9 +91,42 @@ static struct argp_option options[] = {
     {"tnc-serial-speed",  'B', "SERIAL_SPEED", 0, "TNC Serial speed in Bauds (default : 9600)"},
     {"tnc-serial-window",  300, "TX_WINDOW_US", 0, "TNC time window in microseconds for concatenating serial frames. 0: no concatenation (default: 40ms))"},
     {"tnc-radio-window",  301, "RX_WINDOW_US", 0, "TNC time window in microseconds for concatenating radio frames. 0: no concatenation (default: 0))"},
+    {"tnc-adaptive-windows",  333, 0, 0, "Adapt the serial and radio windows to frame arrivals, queue depth and block airtime. Fixed windows are ignored (default: off)"},
     {"tnc-keyup-delay",  302, "KEYUP_DELAY_US", 0, "TNC keyup delay in microseconds (default: 10ms). In KISS mode it can be changed live via kissparms."},
     {"tnc-keydown-delay",  303, "KEYDOWN_DELAY_US", 0, "FUTUR USE: TNC keydown delay in microseconds (default: 0 inactive)"},
     {"tnc-switchover-delay",  304, "SWITCHOVER_DELAY_US", 0, "FUTUR USE: TNC switchover delay in microseconds (default: 0 inactive)"},
+    {"link-adapt",  305, "MAX_RATE_INDEX", 0, "Adapt data rate and modulation to link quality up to this rate index. Both ends must use it (default: off)"},
+    {"link-adapt-min",  306, "MIN_RATE_INDEX", 0, "Minimum rate index for link adaptation (default: initial rate -R)"},
+    {"fscal-cache",  307, 0, 0, "Calibrate frequency synthesizer once at startup and disable automatic calibration (default: off)"},
+    {"fscal-file",  308, "FSCAL_FILE", 0, "File to load and save frequency synthesizer calibration values. Implies --fscal-cache (default: none)"},
+    {"channel-spacing",  309, "SPACING_HZ", 0, "Channel spacing in Hz. Channel 0 is at the base frequency -f (default: 0 minimum of about 25.4 kHz)"},
+    {"hop-channels",  310, "CHANNEL_LIST", 0, "Comma separated list of channel numbers or ranges e.g. 0-7,12. Hops over these channels if more than one (default: 0 no hopping)"},
+    {"hop-seed",  311, "SEED", 0, "Seed of the pseudo-random hopping sequence. Both ends must use the same (default: 1)"},
+    {"hop-dwell",  337, "DWELL_MS", 0, "Time spent on each channel when hopping in milliseconds. Both ends must use the same (default: 200)"},
+    {"csma",  312, 0, 0, "Use p-persistent CSMA with KISS persistence and slot time parameters before transmitting (default: off)"},
+    {"cs-threshold",  313, "THRESHOLD_DB", 0, "Carrier sense threshold in dB relative to AGC target from -8 to 7 (default: 0)"},
+    {"ax25-compress",  314, 0, 0, "Compress AX.25 address fields on the radio link. Both ends must use it (default: off)"},
+    {"compress",  315, 0, 0, "Compress superframes on the radio link when they shrink. Both ends must use it (default: off)"},
+    {"fast-turnaround",  316, 0, 0, "Minimize Rx/Tx turnaround going through FSTXON instead of IDLE. Turnaround times are printed at verbosity 2 (default: off)"},
+    {"tdma-slots",  317, "NB_SLOTS", 0, "TDMA coordinator: number of slots in the superframe from 1 to 64 (default: 0 no TDMA)"},
+    {"tdma-slot-time",  318, "SLOT_MS", 0, "TDMA coordinator: slot duration in milliseconds from 1 to 65535 (default: 100)"},
+    {"tdma-node",  319, "NODE", 0, "TDMA node number from 0 to 63. Node transmits in this slot. Node 0 is the coordinator (default: 0)"},
+    {"duplex-spi-device",  320, "SPI_DEVICE", 0, "Full duplex: SPI device of a second module dedicated to reception (default: none half duplex)"},
+    {"duplex-frequency",  321, "FREQUENCY_HZ", 0, "Full duplex: reception frequency in Hz. Transmission is on the main frequency (default: 433900000)"},
+    {"duplex-gdo",  322, "GDO0,GDO2", 0, "Full duplex: Wiring Pi pins connected to GDO0 and GDO2 of the reception module (default: 3,4)"},
+    {"bond-spi-devices",  323, "SPI_DEVICES", 0, "Bonding: comma separated SPI devices of up to 3 additional modules on the next channels (default: none)"},
+    {"bond-gdo",  324, "GDO0,GDO2,...", 0, "Bonding: Wiring Pi pins connected to GDO0 and GDO2 of each additional module (default: 21,22,26,27,28,29)"},
+    {"link-address",  325, "ADDRESS", 0, "Link address of this node from 1 to 254. Blocks for other nodes are dropped by the chip. All nodes must use addresses (default: 0 no addresses)"},
+    {"link-dest",  326, "ADDRESS", 0, "Link address data blocks are sent to from 1 to 255. 255 is broadcast (default: 255)"},
+    {"afc",  328, 0, 0, "Automatic frequency control: track the frequency offset of peers with the chip estimate (default: off)"},
+    {"crc-autoflush",  327, 0, 0, "Let the chip flush blocks with bad CRC. Only for blocks fitting in the FIFO with packet length up to 61 (default: off)"},
+    {"pty-link",  330, "LINK_PATH", 0, "Create a pseudo terminal instead of opening the serial device and link its slave end here for kissattach (default: none use -D)"},
+    {"kiss-server",  331, "ADDRESS", 0, "Serve KISS to several clients on a TCP port, HOST:PORT or a Unix socket path starting with / instead of the serial link (default: none)"},
+    {"tx-priority",  332, 0, 0, "Send AX.25 supervisory frames, TCP ACKs and small frames before bulk frames (default: arrival order)"},
+    {"tcp-ack-thinning",  334, 0, 0, "Replace a queued TCP ACK in a UI frame by a later ACK of the same flow (default: off)"},
+    {"tun",  335, "IFNAME", 0, "Carry IP packets of this TUN network interface created by the program instead of using the serial link (default: none)"},
+    {"tun-mtu",  336, "MTU", 0, "MTU of the TUN network interface (default: 8192)"},
+    {"kiss-ports",  329, "CH:RATE:MOD,...", 0, "KISS ports 1 and up: comma separated channel, rate index and modulation index of each. Port 0 is the main profile (default: none single port)"},
     {0}
 };
 
@@ -117,6 +137,8 @@ static void delete_args(arguments_t *arguments);
 static void terminate(const int signal_) {
 // ------------------------------------------------------------------------------------------------
     printf("PICC: Terminating with signal %d\n", signal_);
+    close_serial(&serial_parameters);
+    kserv_close();
     delete_args(&arguments);
     exit(1);
 }
@@ -184,10 +206,46 @@ static void init_args(arguments_t *arguments)
     arguments->preamble = PREAMBLE_4;
     arguments->tnc_serial_window = 40000;
     arguments->tnc_radio_window = 0;
+    arguments->tnc_adaptive_windows = 0;
     arguments->tnc_keyup_delay = 4000;
     arguments->tnc_keydown_delay = 0;
     arguments->tnc_switchover_delay = 0;
     arguments->real_time = 0;
+    arguments->link_adapt = 0;
+    arguments->link_rate_min = NUM_RATE;
+    arguments->link_rate_max = RATE_50;
+    arguments->fscal_cache = 0;
+    arguments->fscal_file = 0;
+    arguments->chanspc_hz = 0;
+    arguments->hop_channels = 0;
+    arguments->hop_nb_channels = 0;
+    arguments->hop_seed = 1;
+    arguments->hop_dwell_ms = 200;
+    arguments->csma = 0;
+    arguments->cs_threshold = 0;
+    arguments->ax25_compress = 0;
+    arguments->lz_compress = 0;
+    arguments->fast_turnaround = 0;
+    arguments->tdma_slots = 0;
+    arguments->tdma_slot_ms = 100;
+    arguments->tdma_node = 0;
+    arguments->duplex_spi_device = 0;
+    arguments->duplex_freq_hz = 433900000;
+    arguments->duplex_gdo0 = 3;
+    arguments->duplex_gdo2 = 4;
+    arguments->bond_spi_devices = 0;
+    arguments->bond_gdo = 0;
+    arguments->link_address = 0;
+    arguments->link_dest = 255;
+    arguments->crc_autoflush = 0;
+    arguments->afc = 0;
+    arguments->kiss_ports = 0;
+    arguments->pty_link = 0;
+    arguments->kiss_server = 0;
+    arguments->tx_priority = 0;
+    arguments->tcp_ack_thinning = 0;
+    arguments->tun_name = 0;
+    arguments->tun_mtu = TUN_MTU_DEFAULT;
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -207,6 +265,42 @@ void delete_args(arguments_t *arguments)
     {
         free(arguments->test_phrase);
     }
+    if (arguments->fscal_file)
+    {
+        free(arguments->fscal_file);
+    }
+    if (arguments->hop_channels)
+    {
+        free(arguments->hop_channels);
+    }
+    if (arguments->duplex_spi_device)
+    {
+        free(arguments->duplex_spi_device);
+    }
+    if (arguments->bond_spi_devices)
+    {
+        free(arguments->bond_spi_devices);
+    }
+    if (arguments->bond_gdo)
+    {
+        free(arguments->bond_gdo);
+    }
+    if (arguments->kiss_ports)
+    {
+        free(arguments->kiss_ports);
+    }
+    if (arguments->pty_link)
+    {
+        free(arguments->pty_link);
+    }
+    if (arguments->kiss_server)
+    {
+        free(arguments->kiss_server);
+    }
+    if (arguments->tun_name)
+    {
+        free(arguments->tun_name);
+    }
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -229,8 +323,59 @@ static void print_args(arguments_t *arguments)
     fprintf(stderr, "Preamble size .......: %d bytes\n", nb_preamble_bytes[arguments->preamble]);
     fprintf(stderr, "FEC .................: %s\n", (arguments->fec ? "on" : "off"));
     fprintf(stderr, "Whitening ...........: %s\n", (arguments->whitening ? "on" : "off"));
+    fprintf(stderr, "FS calibration ......: %s\n", (arguments->fscal_cache ? "once" : "automatic"));
+    fprintf(stderr, "Channel spacing .....: %d Hz\n", arguments->chanspc_hz);
+    fprintf(stderr, "Hopping channels ....: %d\n", arguments->hop_nb_channels);
+    fprintf(stderr, "Hopping dwell time ..: %d ms\n", arguments->hop_dwell_ms);
+    fprintf(stderr, "CSMA ................: %s\n", (arguments->csma ? "on" : "off"));
+    fprintf(stderr, "CS threshold ........: %d dB\n", arguments->cs_threshold);
+    fprintf(stderr, "AX.25 compression ...: %s\n", (arguments->ax25_compress ? "on" : "off"));
+    fprintf(stderr, "Compression .........: %s\n", (arguments->lz_compress ? "on" : "off"));
+    fprintf(stderr, "Fast turnaround .....: %s\n", (arguments->fast_turnaround ? "on" : "off"));
+    fprintf(stderr, "CRC autoflush .......: %s\n", (arguments->crc_autoflush ? "on" : "off"));
+    fprintf(stderr, "AFC .................: %s\n", (arguments->afc ? "on" : "off"));
+
+    if ((arguments->tdma_slots) || (arguments->tdma_node))
+    {
+        fprintf(stderr, "TDMA node ...........: %d\n", arguments->tdma_node);
+
+        if (arguments->tdma_node == 0)
+        {
+            fprintf(stderr, "TDMA slots ..........: %d of %d ms\n", arguments->tdma_slots, arguments->tdma_slot_ms);
+        }
+    }
+
     fprintf(stderr, "SPI device ..........: %s\n", arguments->spi_device);
 
+    if (arguments->duplex_spi_device)
+    {
+        fprintf(stderr, "Duplex SPI device ...: %s\n", arguments->duplex_spi_device);
+        fprintf(stderr, "Duplex frequency ....: %d Hz\n", arguments->duplex_freq_hz);
+        fprintf(stderr, "Duplex GDO0,GDO2 ....: %d,%d\n", arguments->duplex_gdo0, arguments->duplex_gdo2);
+    }
+
+    if (arguments->bond_spi_devices)
+    {
+        fprintf(stderr, "Bonded SPI devices ..: %s\n", arguments->bond_spi_devices);
+        fprintf(stderr, "Bonded GDO0,GDO2 ....: %s\n", arguments->bond_gdo);
+    }
+
+    if (arguments->kiss_ports)
+    {
+        fprintf(stderr, "KISS ports 1.. ......: %s\n", arguments->kiss_ports);
+    }
+
+    if (arguments->link_address)
+    {
+        fprintf(stderr, "Link address ........: %d\n", arguments->link_address);
+        fprintf(stderr, "Link destination ....: %d\n", arguments->link_dest);
+    }
+
+    if (arguments->link_adapt)
+    {
+        fprintf(stderr, "Link adaptation .....: %d to %d Baud\n", rate_values[arguments->link_rate_min], rate_values[arguments->link_rate_max]);
+    }
+
     if (arguments->test_mode != TEST_NONE)
     {
         fprintf(stderr, "Test mode ...........: %s\n", test_mode_names[arguments->test_mode]);
@@ -240,9 +385,27 @@ static void print_args(arguments_t *arguments)
 
     fprintf(stderr, "--- serial ---\n");
     fprintf(stderr, "TNC device ..........: %s\n", arguments->serial_device);
+    fprintf(stderr, "PTY link ............: %s\n", (arguments->pty_link ? arguments->pty_link : "none"));
+    fprintf(stderr, "Tx priority .........: %s\n", (arguments->tx_priority ? "on" : "off"));
+    fprintf(stderr, "TCP ACK thinning ....: %s\n", (arguments->tcp_ack_thinning ? "on" : "off"));
+    fprintf(stderr, "KISS server .........: %s\n", (arguments->kiss_server ? arguments->kiss_server : "none"));
+
+    if (arguments->tun_name)
+    {
+        fprintf(stderr, "TUN interface .......: %s MTU %d\n", arguments->tun_name, arguments->tun_mtu);
+    }
+    else
+    {
+        fprintf(stderr, "TUN interface .......: none\n");
+    }
+
     fprintf(stderr, "TNC speed ...........: %d Baud\n", arguments->serial_speed_n);
 
-    if (arguments->tnc_serial_window)
+    if (arguments->tnc_adaptive_windows)
+    {
+        fprintf(stderr, "TNC serial window ...: adaptive\n");
+    }
+    else if (arguments->tnc_serial_window)
     {
         fprintf(stderr, "TNC serial window ...: %.2f ms\n", arguments->tnc_serial_window / 1000.0);
     }
@@ -251,7 +414,11 @@ static void print_args(arguments_t *arguments)
         fprintf(stderr, "TNC serial window ...: none\n");   
     }
 
-    if (arguments->tnc_radio_window)
+    if (arguments->tnc_adaptive_windows)
+    {
+        fprintf(stderr, "TNC radio window ....: adaptive\n");
+    }
+    else if (arguments->tnc_radio_window)
     {
         fprintf(stderr, "TNC radio window ....: %.2f ms\n", arguments->tnc_radio_window / 1000.0);
     }
@@ -310,6 +477,64 @@ static rate_t get_rate(uint8_t rate_index)
     }
 }
 
+// ------------------------------------------------------------------------------------------------
+// Get channel list from comma separated channel numbers or ranges. Duplicates are ignored.
+// Returns 0 if the list is valid
+static int get_channel_list(arguments_t *arguments, char *arg)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t in_list[256];
+    long    first, last, channel;
+    char    *p = arg, *end;
+
+    if (!arguments->hop_channels)
+    {
+        arguments->hop_channels = malloc(256);
+    }
+
+    memset(in_list, 0, sizeof(in_list));
+    arguments->hop_nb_channels = 0;
+
+    while (*p)
+    {
+        first = strtol(p, &end, 10);
+        last = first;
+
+        if (end == p)
+            return 1;
+
+        if (*end == '-')
+        {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+
+            if (end == p)
+                return 1;
+        }
+
+        if ((first < 0) || (last > 255) || (first > last))
+            return 1;
+
+        for (channel = first; channel <= last; channel++)
+        {
+            if (!in_list[channel])
+            {
+                in_list[channel] = 1;
+                arguments->hop_channels[arguments->hop_nb_channels++] = channel;
+            }
+        }
+
+        if (*end == ',')
+            end++;
+        else if (*end)
+            return 1;
+
+        p = end;
+    }
+
+    return (arguments->hop_nb_channels == 0);
+}
+
 // ------------------------------------------------------------------------------------------------
 // Option parser 
 static error_t parse_opt (int key, char *arg, struct argp_state *state)
@@ -319,6 +544,7 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state)
     char        *end;  // Used to indicate if ASCII to int was successful
     uint8_t     i8;
     uint32_t    i32;
+    long        value; // Signed so that negative numbers are caught by range checks
 
     switch (key){
         // Verbosity 
@@ -477,6 +703,186 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state)
             if (*end)
                 argp_usage(state);
             break; 
+        // Link adaptation maximum rate
+        case 305:
+            i8 = strtol(arg, &end, 10); 
+            if (*end)
+                argp_usage(state);
+            else
+            {
+                arguments->link_adapt = 1;
+                arguments->link_rate_max = get_rate(i8);
+            }
+            break;
+        // Link adaptation minimum rate
+        case 306:
+            i8 = strtol(arg, &end, 10); 
+            if (*end)
+                argp_usage(state);
+            else
+                arguments->link_rate_min = get_rate(i8);
+            break;
+        // Frequency synthesizer calibration cache
+        case 307:
+            arguments->fscal_cache = 1;
+            break;
+        // Frequency synthesizer calibration file
+        case 308:
+            arguments->fscal_cache = 1;
+            arguments->fscal_file = strdup(arg);
+            break;
+        // Channel spacing
+        case 309:
+            arguments->chanspc_hz = strtol(arg, &end, 10);
+            if (*end)
+                argp_usage(state);
+            break; 
+        // Frequency hopping channel list
+        case 310:
+            if (get_channel_list(arguments, arg) != 0)
+                argp_usage(state);
+            break;
+        // Frequency hopping sequence seed
+        case 311:
+            arguments->hop_seed = strtoul(arg, &end, 10);
+            if (*end)
+                argp_usage(state);
+            break; 
+        // Frequency hopping dwell time
+        case 337:
+            arguments->hop_dwell_ms = strtoul(arg, &end, 10);
+            if (*end)
+                argp_usage(state);
+            break; 
+        // p-persistent CSMA
+        case 312:
+            arguments->csma = 1;
+            break;
+        // Carrier sense threshold
+        case 313:
+            i32 = strtol(arg, &end, 10);
+            if ((*end) || ((int32_t) i32 < -8) || ((int32_t) i32 > 7))
+                argp_usage(state);
+            else
+                arguments->cs_threshold = (int32_t) i32;
+            break; 
+        // AX.25 address compression
+        case 314:
+            arguments->ax25_compress = 1;
+            break;
+        // Superframe compression
+        case 315:
+            arguments->lz_compress = 1;
+            break;
+        // Fast Rx/Tx turnaround
+        case 316:
+            arguments->fast_turnaround = 1;
+            break;
+        // TDMA number of slots
+        case 317:
+            i32 = strtol(arg, &end, 10);
+            if ((*end) || (i32 > 64))
+                argp_usage(state);
+            else
+                arguments->tdma_slots = i32;
+            break; 
+        // TDMA slot duration
+        case 318:
+            i32 = strtol(arg, &end, 10);
+            if ((*end) || (i32 < 1) || (i32 > 65535))
+                argp_usage(state);
+            else
+                arguments->tdma_slot_ms = i32;
+            break; 
+        // TDMA node number
+        case 319:
+            i32 = strtol(arg, &end, 10);
+            if ((*end) || (i32 > 63))
+                argp_usage(state);
+            else
+                arguments->tdma_node = i32;
+            break; 
+        // Full duplex reception module SPI device
+        case 320:
+            arguments->duplex_spi_device = strdup(arg);
+            break;
+        // Full duplex reception frequency
+        case 321:
+            arguments->duplex_freq_hz = strtol(arg, &end, 10);
+            if (*end)
+                argp_usage(state);
+            break; 
+        // Full duplex reception module interrupt lines
+        case 322:
+            if (sscanf(arg, "%d,%d", &arguments->duplex_gdo0, &arguments->duplex_gdo2) != 2)
+                argp_usage(state);
+            break; 
+        // Bonded modules SPI devices
+        case 323:
+            arguments->bond_spi_devices = strdup(arg);
+            break;
+        // Bonded modules interrupt lines
+        case 324:
+            arguments->bond_gdo = strdup(arg);
+            break;
+        // Link address of this node
+        case 325:
+            value = strtol(arg, &end, 10);
+            if ((*end) || (value < 0) || (value > 254))
+                argp_usage(state);
+            else
+                arguments->link_address = value;
+            break; 
+        // Link address of data blocks destination
+        case 326:
+            value = strtol(arg, &end, 10);
+            if ((*end) || (value < 1) || (value > 255))
+                argp_usage(state);
+            else
+                arguments->link_dest = value;
+            break; 
+        // Flush blocks with bad CRC in the chip
+        case 327:
+            arguments->crc_autoflush = 1;
+            break;
+        // Automatic frequency control
+        case 328:
+            arguments->afc = 1;
+            break;
+        // KISS ports radio profiles
+        case 329:
+            arguments->kiss_ports = strdup(arg);
+            break;
+        // Built-in pseudo terminal
+        case 330:
+            arguments->pty_link = strdup(arg);
+            break;
+        // KISS server
+        case 331:
+            arguments->kiss_server = strdup(arg);
+            break;
+        // Tx priority queues
+        case 332:
+            arguments->tx_priority = 1;
+            break;
+        // Adaptive serial and radio windows
+        case 333:
+            arguments->tnc_adaptive_windows = 1;
+            break;
+        // TCP ACK thinning
+        case 334:
+            arguments->tcp_ack_thinning = 1;
+            break;
+        // TUN network interface
+        case 335:
+            arguments->tun_name = strdup(arg);
+            break;
+        // TUN network interface MTU
+        case 336:
+            arguments->tun_mtu = strtol(arg, &end, 10);
+            if (*end)
+                argp_usage(state);
+            break;
         default:
             return ARGP_ERR_UNKNOWN;
     }
@@ -539,12 +945,127 @@ int main (int argc, char **argv)
     {
         arguments.spi_device = strdup("/dev/spidev0.0");
     }
+    if (arguments.link_rate_min > arguments.rate)
+    {
+        arguments.link_rate_min = arguments.rate;
+    }
+    if (arguments.link_rate_max < arguments.rate)
+    {
+        arguments.link_rate_max = arguments.rate;
+    }
+    if ((arguments.crc_autoflush) && (arguments.packet_length + 2 >= PI_CCxxx0_FIFO_SIZE)) // block and status bytes must fit in the FIFO
+    {
+        fprintf(stderr, "PICC: CRC autoflush is not used with packet length over %d\n", PI_CCxxx0_FIFO_SIZE - 3);
+        arguments.crc_autoflush = 0;
+    }
+    if (arguments.variable_length) // link control blocks are marked by a zero length byte
+    {
+        if ((arguments.link_adapt) || (arguments.tdma_slots) || (arguments.tdma_node) || (arguments.ax25_compress))
+        {
+            fprintf(stderr, "PICC: link adaptation, TDMA and AX.25 compression are not used with variable length\n");
+        }
+
+        arguments.link_adapt = 0;
+        arguments.tdma_slots = 0;
+        arguments.tdma_node = 0;
+        arguments.ax25_compress = 0;
+    }
+    if (arguments.duplex_spi_device) // point to point link on two frequencies
+    {
+        if ((arguments.hop_nb_channels > 1) || (arguments.csma) || (arguments.tdma_slots) || (arguments.tdma_node) || (arguments.fast_turnaround))
+        {
+            fprintf(stderr, "PICC: hopping, CSMA, TDMA and fast turnaround are not used in full duplex\n");
+        }
+
+        arguments.hop_nb_channels = (arguments.hop_nb_channels > 0 ? 1 : 0);
+        arguments.csma = 0;
+        arguments.tdma_slots = 0;
+        arguments.tdma_node = 0;
+        arguments.fast_turnaround = 0;
+    }
+    if (arguments.bond_spi_devices) // several modules on consecutive channels
+    {
+        if (!arguments.bond_gdo)
+        {
+            arguments.bond_gdo = strdup("21,22,26,27,28,29");
+        }
+
+        if ((arguments.hop_nb_channels > 1) || (arguments.csma) || (arguments.tdma_slots) || (arguments.tdma_node) || (arguments.fast_turnaround) || (arguments.duplex_spi_device))
+        {
+            fprintf(stderr, "PICC: hopping, CSMA, TDMA, fast turnaround and full duplex are not used with bonding\n");
+        }
+
+        arguments.hop_nb_channels = (arguments.hop_nb_channels > 0 ? 1 : 0);
+        arguments.csma = 0;
+        arguments.tdma_slots = 0;
+        arguments.tdma_node = 0;
+        arguments.fast_turnaround = 0;
+
+        if (arguments.duplex_spi_device)
+        {
+            free(arguments.duplex_spi_device);
+            arguments.duplex_spi_device = 0;
+        }
+    }
+
+    if (arguments.kiss_ports) // radio profile follows the KISS port of each frame
+    {
+        if ((arguments.hop_nb_channels > 1) || (arguments.link_adapt) || (arguments.tdma_slots) || (arguments.tdma_node) || (arguments.duplex_spi_device) || (arguments.bond_spi_devices))
+        {
+            fprintf(stderr, "PICC: hopping, link adaptation, TDMA, full duplex and bonding are not used with KISS ports\n");
+        }
+
+        arguments.hop_nb_channels = (arguments.hop_nb_channels > 0 ? 1 : 0);
+        arguments.link_adapt = 0;
+        arguments.tdma_slots = 0;
+        arguments.tdma_node = 0;
+
+        if (arguments.duplex_spi_device)
+        {
+            free(arguments.duplex_spi_device);
+            arguments.duplex_spi_device = 0;
+        }
+
+        if (arguments.bond_spi_devices)
+        {
+            free(arguments.bond_spi_devices);
+            arguments.bond_spi_devices = 0;
+        }
+    }
+
+    if ((arguments.afc) && ((arguments.fscal_cache) || (arguments.fast_turnaround) || (arguments.duplex_spi_device) || (arguments.bond_spi_devices))) // offset changes need a calibration when leaving IDLE
+    {
+        fprintf(stderr, "PICC: AFC is not used with cached FS calibration, fast turnaround, full duplex and bonding\n");
+        arguments.afc = 0;
+    }
 
     print_args(&arguments);
 
+    if (arguments.test_mode == TEST_KISS_BENCH) // no radio involved
+    {
+        kiss_test_benchmark(&arguments);
+        delete_args(&arguments);
+        return 0;
+    }
+
     init_radio_parms(&radio_parameters, &arguments);
     ret = init_radio(&radio_parameters, &spi_parameters, &arguments);
 
+    if ((ret == 0) && (arguments.duplex_spi_device))
+    {
+        ret = init_radio_duplex(&radio_parameters, &spi_rx_parameters, &arguments);
+    }
+
+    if (ret == 0)
+    {
+        ret = bond_init(&radio_parameters, &spi_parameters, &arguments);
+    }
+
+    if (ret == 0)
+    {
+        ret = port_init(&spi_parameters, &radio_parameters, &arguments);
+    }
+
     if (ret != 0)
     {
         fprintf(stderr, "PICC: Cannot initialize radio link, RC=%d\n", ret);
@@ -584,7 +1105,7 @@ int main (int argc, char **argv)
     else
     {
         kiss_init(&arguments);
-        kiss_run(&serial_parameters, &spi_parameters, &arguments);    
+        kiss_run(&serial_parameters, &spi_parameters, &radio_parameters, &arguments);    
     }
 
     delete_args(&arguments);
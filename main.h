@@ -15,6 +15,7 @@ typedef enum test_mode_e {
     TEST_RX_INTERRUPT,
     TEST_TX_ECHO,
     TEST_RX_ECHO,
+    TEST_KISS_BENCH,
     NUM_TEST
 } test_mode_t;
 
@@ -95,10 +96,46 @@ typedef struct arguments_s {
     uint32_t     packet_delay;         // Delay before sending packet on serial or radio in 4 2-FSK symbols approximately
     uint32_t     tnc_serial_window;    // Time window in microseconds for concatenating serial frames (0: no concatenation)
     uint32_t     tnc_radio_window;     // Time window in microseconds for concatenating radio frames (0: no concatenation)
+    uint8_t      tnc_adaptive_windows; // Adapt the serial and radio windows to the traffic instead of fixed windows
     uint32_t     tnc_keyup_delay;      // TNC keyup delay in microseconds
     uint32_t     tnc_keydown_delay;    // TNC keydown delay in microseconds
     uint32_t     tnc_switchover_delay; // TNC Rx/Tx switchover delay in microseconds
     uint8_t      real_time;            // Engage so called "real time" scheduling
+    uint8_t      link_adapt;           // Adapt data rate and modulation to link quality
+    rate_t       link_rate_min;        // Minimum rate index for link adaptation
+    rate_t       link_rate_max;        // Maximum rate index for link adaptation
+    uint8_t      fscal_cache;          // Calibrate frequency synthesizer once and disable automatic calibration
+    char         *fscal_file;          // File to store frequency synthesizer calibration values
+    uint32_t     chanspc_hz;           // Channel spacing in Hz
+    uint8_t      *hop_channels;        // List of channel numbers for frequency hopping
+    int          hop_nb_channels;      // Number of channels in the list. Hopping when more than one
+    uint32_t     hop_seed;             // Seed of the pseudo-random hopping sequence
+    uint32_t     hop_dwell_ms;         // Time spent on each channel when hopping in milliseconds
+    uint8_t      csma;                 // Use p-persistent CSMA channel access in KISS mode
+    int8_t       cs_threshold;         // Carrier sense absolute threshold in dB relative to AGC magnitude target
+    uint8_t      ax25_compress;        // Compress AX.25 address fields on the radio link
+    uint8_t      lz_compress;          // Compress superframes on the radio link
+    uint8_t      fast_turnaround;      // Minimize Rx/Tx turnaround
+    uint8_t      tdma_slots;           // Number of TDMA slots in a superframe (coordinator). 0 if no TDMA
+    uint32_t     tdma_slot_ms;         // TDMA slot duration in milliseconds (coordinator)
+    uint8_t      tdma_node;            // TDMA node number and slot owned. 0 is the coordinator
+    char         *duplex_spi_device;   // SPI device of the module dedicated to reception. Full duplex if set
+    uint32_t     duplex_freq_hz;       // Reception frequency in Hz in full duplex
+    int          duplex_gdo0;          // Wiring Pi pin connected to GDO0 of the reception module
+    int          duplex_gdo2;          // Wiring Pi pin connected to GDO2 of the reception module
+    char         *bond_spi_devices;    // Comma separated SPI devices of the additional bonded modules. Bonding if set
+    char         *bond_gdo;            // Comma separated Wiring Pi pins connected to GDO0 and GDO2 of each bonded module
+    uint8_t      link_address;         // Link address of this node filtered by the chip. 0 if blocks are not addressed
+    uint8_t      link_dest;            // Link address data blocks are sent to. 255 is broadcast
+    uint8_t      crc_autoflush;        // Let the chip flush blocks with bad CRC
+    uint8_t      afc;                  // Automatic frequency control from the frequency offset estimates
+    char         *pty_link;            // Path of the link to the slave end of a built-in pseudo terminal. Used instead of the serial device if set
+    uint8_t      tx_priority;          // Send frames by priority class instead of arrival order
+    uint8_t      tcp_ack_thinning;     // Replace queued TCP ACKs in UI frames by later ACKs of the same flow
+    char         *tun_name;            // Name of the TUN network interface for IP packets. Used instead of the serial link if set
+    uint32_t     tun_mtu;              // MTU of the TUN network interface
+    char         *kiss_server;         // KISS server address: TCP port, HOST:PORT or Unix socket path starting with /. Used instead of the serial link if set
+    char         *kiss_ports;          // Comma separated channel:rate:modulation profiles of KISS ports 1 and up. Ports if set
 } arguments_t;
 
 #endif
@@ -0,0 +1,213 @@
+/******************************************************************************/
+/* PiCC1101  - Radio serial link using CC1101 module and Raspberry-Pi         */
+/*                                                                            */
+/* Modem register sets for data rate, modulation and deviation                */
+/*                                                                            */
+/* Hardware independent so that it can be used by the table generator         */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#include <math.h>
+
+#include "modem.h"
+
+uint32_t rate_values[] = {
+    50,
+    110,
+    300,
+    600,
+    1200,
+    2400,
+    4800,
+    9600,
+    14400,
+    19200,
+    28800,
+    38400,
+    57600,
+    76800,
+    115200,
+    250000,
+    500000
+};
+
+// 4x4 channel bandwidth limits
+float chanbw_limits[] = {
+    812000.0,
+    650000.0,
+    541000.0,
+    464000.0,
+    406000.0,
+    325000.0,
+    270000.0,
+    232000.0,
+    203000.0,
+    162000.0,
+    135000.0,
+    116000.0,
+    102000.0,
+    81000.0,
+    68000.0,
+    58000.0
+};
+
+// Modulation indexes in the register table
+float modem_indexes[] = {
+    0.25,
+    0.5,
+    1.0,
+    2.0
+};
+
+// Rate skews in the register table
+float modem_skews[] = {
+    0.9,
+    0.95,
+    1.0,
+    1.05,
+    1.1
+};
+
+// === Static functions declarations ==============================================================
+
+static uint8_t get_chanbw_word(float bw);
+static int     find_value(float *values, int nb_values, float value);
+
+// === Static functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Calculate CHANBW word (CHANBW_E<<2 + CHANBW_M) according to CC1101 bandwidth steps
+uint8_t get_chanbw_word(float bw)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t e_index, m_index;
+
+    for (e_index=0; e_index<4; e_index++)
+    {
+        for (m_index=0; m_index<4; m_index++)
+        {
+            if (bw > chanbw_limits[4*e_index + m_index])
+            {
+                return (e_index<<2) + m_index;
+            }
+        }
+    }
+
+    return 0x0F;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Find index of a tabulated value. Returns -1 if not found.
+int find_value(float *values, int nb_values, float value)
+// ------------------------------------------------------------------------------------------------
+{
+    int i;
+
+    for (i=0; i<nb_values; i++)
+    {
+        if (fabs(values[i] - value) < 1e-4)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// === Public functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Calculate modulation format word MOD_FORMAT[2..0]
+uint8_t modem_mod_word(modulation_t modulation_code)
+// ------------------------------------------------------------------------------------------------
+{
+    switch (modulation_code)
+    {
+        case MOD_OOK:
+            return 3;
+            break;
+        case MOD_FSK2:
+            return 0;
+            break;
+        case MOD_FSK4:
+            return 4;
+            break;
+        case MOD_MSK:
+            return 7;
+            break;
+        case MOD_GFSK:
+            return 1;
+            break;
+        default:
+            return 0;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Calculate data rate, channel bandwidth, modulation and deviation registers.
+//   o DRATE = (Fxosc / 2^28) * (256 + DRATE_M) * 2^DRATE_E
+//   o CHANBW = Fxosc / (8(4+CHANBW_M) * 2^CHANBW_E)
+//   o DEVIATION = (Fxosc / 2^17) * (8 + DEVIATION_M) * 2^DEVIATION_E
+// Deviations below the lowest step are set to the lowest step.
+void modem_get_regs(rate_t rate, modulation_t modulation, float modulation_index, float rate_skew, uint32_t f_xtal, modem_regs_t *regs)
+// ------------------------------------------------------------------------------------------------
+{
+    double  drate, deviat, xtal;
+    int     drate_e, deviat_e;
+    uint8_t drate_m, deviat_m, chanbw;
+
+    drate = (double) rate_values[rate];
+    drate *= rate_skew;
+
+    if ((modulation == MOD_FSK4) && (drate > 300000.0))
+    {
+        drate = 300000.0;
+    }
+
+    deviat = drate * modulation_index;
+    xtal = (double) f_xtal;
+
+    chanbw = get_chanbw_word(2.0*(deviat + drate)); // Apply Carson's rule for bandwidth
+
+    drate_e = (int) (floor(log2( drate*(1<<20) / xtal )));
+    drate_m = (uint8_t) (((drate*(1<<28)) / (xtal * (1<<drate_e))) - 256);
+    drate_e &= 0x0F; // it is 4 bits long
+
+    deviat_e = (int) (floor(log2( deviat*(1<<14) / xtal )));
+
+    if (deviat_e < 0)
+    {
+        deviat_e = 0;
+        deviat_m = 0;
+    }
+    else
+    {
+        deviat_m = (uint8_t) (((deviat*(1<<17)) / (xtal * (1<<deviat_e))) - 8);
+    }
+
+    deviat_e &= 0x07; // it is 3 bits long
+    deviat_m &= 0x07; // it is 3 bits long
+
+    regs->mdmcfg4 = (chanbw<<4) + drate_e;
+    regs->mdmcfg3 = drate_m;
+    regs->mdmcfg2 = modem_mod_word(modulation)<<4;
+    regs->deviatn = (deviat_e<<4) + deviat_m;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Index of the register set in the table. Returns -1 if modulation index or rate skew is not tabulated.
+int modem_profile_index(rate_t rate, modulation_t modulation, float modulation_index, float rate_skew)
+// ------------------------------------------------------------------------------------------------
+{
+    int index_i = find_value(modem_indexes, MODEM_NUM_INDEX, modulation_index);
+    int skew_i  = find_value(modem_skews, MODEM_NUM_SKEW, rate_skew);
+
+    if ((index_i < 0) || (skew_i < 0) || (rate >= NUM_RATE) || (modulation >= NUM_MOD))
+    {
+        return -1;
+    }
+
+    return (((rate * NUM_MOD) + modulation) * MODEM_NUM_INDEX + index_i) * MODEM_NUM_SKEW + skew_i;
+}
@@ -0,0 +1,39 @@
+/******************************************************************************/
+/* PiCC1101  - Radio serial link using CC1101 module and Raspberry-Pi         */
+/*                                                                            */
+/* Modem register sets for data rate, modulation and deviation                */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef _MODEM_H_
+#define _MODEM_H_
+
+#include <stdint.h>
+
+#include "main.h"
+
+#define MODEM_F_XTAL       26000000 // Crystal frequency the register table is computed for (Hz)
+#define MODEM_NUM_INDEX    4        // Number of tabulated modulation indexes
+#define MODEM_NUM_SKEW     5        // Number of tabulated rate skews
+#define MODEM_NUM_PROFILES (NUM_RATE * NUM_MOD * MODEM_NUM_INDEX * MODEM_NUM_SKEW)
+
+typedef struct modem_regs_s
+{
+    uint8_t mdmcfg4;  // Channel bandwidth and data rate exponent
+    uint8_t mdmcfg3;  // Data rate mantissa
+    uint8_t mdmcfg2;  // Modulation format. Sync word qualifier is added at run time
+    uint8_t deviatn;  // Deviation exponent and mantissa
+} modem_regs_t;
+
+extern float  chanbw_limits[];
+extern float  modem_indexes[];
+extern float  modem_skews[];
+extern const  modem_regs_t modem_table[MODEM_NUM_PROFILES]; // Generated at build time by gen_modem_table
+
+uint8_t modem_mod_word(modulation_t modulation_code);
+void    modem_get_regs(rate_t rate, modulation_t modulation, float modulation_index, float rate_skew, uint32_t f_xtal, modem_regs_t *regs);
+int     modem_profile_index(rate_t rate, modulation_t modulation, float modulation_index, float rate_skew);
+
+#endif
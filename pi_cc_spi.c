@@ -138,14 +138,14 @@ void PI_CC_Wait(unsigned int cycles)
 }
 
 // ------------------------------------------------------------------------------------------------
-int PI_CC_SPISetup(spi_parms_t *spi_parms, arguments_t *arguments)
+int PI_CC_SPISetup(spi_parms_t *spi_parms, char *spi_device)
 // ------------------------------------------------------------------------------------------------
 {
     spi_parms->ret = 0;
 
     do
     {
-        spi_parms->fd = open(arguments->spi_device, O_RDWR);
+        spi_parms->fd = open(spi_device, O_RDWR);
         if (spi_parms->fd < 0)
         {
             perror("SPI: can't open device");
@@ -81,7 +81,7 @@ typedef struct spi_parms_s
 
 void PI_CC_SPIParmsDefaults(spi_parms_t *spi_parms);
 void PI_CC_Wait(unsigned int);
-int  PI_CC_SPISetup(spi_parms_t *spi_parms, arguments_t *arguments);
+int  PI_CC_SPISetup(spi_parms_t *spi_parms, char *spi_device);
 int  PI_CC_SPIWriteReg(spi_parms_t *spi_parms, uint8_t addr, uint8_t byte);
 int  PI_CC_SPIWriteBurstReg(spi_parms_t *spi_parms, uint8_t addr, const uint8_t *bytes, uint8_t count);
 int  PI_CC_SPIReadReg(spi_parms_t *spi_parms, uint8_t addr, uint8_t *byte);
@@ -0,0 +1,234 @@
+/******************************************************************************/
+/* PiCC1101  - Radio serial link using CC1101 module and Raspberry-Pi         */
+/*                                                                            */
+/* KISS ports mapped to radio profiles                                        */
+/*                                                                            */
+/* Each KISS port is a channel, rate and modulation. Port 0 is the profile    */
+/* given by the main options. Frames are sent with the profile of their port  */
+/* and reception stays on it for a while to catch the answer before it        */
+/* returns to port 0. Frames received are given the port of the profile they  */
+/* were received with. Modem registers come from the pre-computed table and   */
+/* channel calibrations from the cache so a switch is a few SPI bursts.       */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "port.h"
+#include "hop.h"
+#include "fscal.h"
+#include "modem.h"
+#include "util.h"
+
+static spi_parms_t    *port_spi_parms;
+static radio_parms_t  *port_radio_parms;
+static arguments_t    *port_arguments;
+static port_profile_t port_profiles[PORT_MAX];
+static uint8_t        port_nb;              // Number of ports configured. 0 if ports are not used.
+static uint8_t        port_index;           // Port the radio is tuned to
+static struct timeval port_last_activity;   // Time the last block was sent or received on the current port
+
+// === Static functions declarations ==============================================================
+
+static int port_parse(char **ports, port_profile_t *profile);
+
+// === Static functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Take the next CHANNEL:RATE:MODULATION profile from the list. Returns 0 if found.
+int port_parse(char **ports, port_profile_t *profile)
+// ------------------------------------------------------------------------------------------------
+{
+    long value[3];
+    char *end;
+    int  i;
+
+    for (i=0; i<3; i++)
+    {
+        value[i] = strtol(*ports, &end, 10);
+
+        if ((end == *ports) || ((i < 2) && (*end != ':')))
+        {
+            return 1;
+        }
+
+        *ports = (*end ? end + 1 : end);
+    }
+
+    if ((end[0] != ',') && (end[0] != '\0'))
+    {
+        return 1;
+    }
+
+    if ((value[0] < 0) || (value[0] > 255) || (value[1] < 0) || (value[1] >= NUM_RATE) || (value[2] < 0) || (value[2] >= NUM_MOD))
+    {
+        return 1;
+    }
+
+    profile->channel = value[0];
+    profile->rate = (rate_t) value[1];
+    profile->modulation = (modulation_t) value[2];
+    return 0;
+}
+
+// === Public functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Build the port profiles. Port 0 is the current profile. With the calibration cache the channels
+// of all ports are calibrated now and the radio is left in IDLE state on the channel of port 0.
+int port_init(spi_parms_t *spi_parms, radio_parms_t *radio_parms, arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    char    *ports = arguments->kiss_ports;
+    uint8_t channels[PORT_MAX];
+    int     i;
+
+    port_spi_parms = spi_parms;
+    port_radio_parms = radio_parms;
+    port_arguments = arguments;
+    port_nb = 0;
+    port_index = 0;
+
+    if (!ports)
+    {
+        return 0;
+    }
+
+    port_profiles[0].channel = hop_channel();
+    port_profiles[0].rate = arguments->rate;
+    port_profiles[0].modulation = arguments->modulation;
+    port_nb = 1;
+
+    while ((*ports) && (port_nb < PORT_MAX))
+    {
+        if (port_parse(&ports, &port_profiles[port_nb]))
+        {
+            fprintf(stderr, "PORT: invalid profile for port %d in %s\n", port_nb, arguments->kiss_ports);
+            port_nb = 0;
+            return 1;
+        }
+
+        port_nb++;
+    }
+
+    for (i=0; i<port_nb; i++)
+    {
+        channels[i] = port_profiles[i].channel;
+        port_profiles[i].in_use = 1;
+        verbprintf(1, "PORT: %d channel %d %d Baud %s%s\n", i, port_profiles[i].channel,
+            rate_values[port_profiles[i].rate], modulation_names[port_profiles[i].modulation],
+            (modem_profile_index(port_profiles[i].rate, port_profiles[i].modulation, arguments->modulation_index, arguments->rate_skew) < 0 ? " (computed)" : ""));
+    }
+
+    gettimeofday(&port_last_activity, NULL);
+
+    if (arguments->fscal_cache) // only the hopping sequence was calibrated
+    {
+        return fscal_init(spi_parms, radio_parms, arguments, channels, port_nb);
+    }
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Returns 1 if KISS ports are mapped to radio profiles
+uint8_t port_active()
+// ------------------------------------------------------------------------------------------------
+{
+    return (port_nb > 0);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Returns 1 if the port is configured
+uint8_t port_valid(uint8_t port)
+// ------------------------------------------------------------------------------------------------
+{
+    return (port < port_nb);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Port the radio is tuned to
+uint8_t port_current()
+// ------------------------------------------------------------------------------------------------
+{
+    return port_index;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Tune to the profile of the port. Radio must not be busy. Leaves the radio in IDLE state when
+// switching.
+void port_select(uint8_t port)
+// ------------------------------------------------------------------------------------------------
+{
+    port_profile_t *profile;
+
+    if ((!port_valid(port)) || (port == port_index))
+    {
+        return;
+    }
+
+    profile = &port_profiles[port];
+
+    verbprintf(2, "PORT: switch from %d to %d\n", port_index, port);
+
+    if ((profile->rate != port_arguments->rate) || (profile->modulation != port_arguments->modulation))
+    {
+        port_arguments->rate = profile->rate;
+        port_arguments->modulation = profile->modulation;
+        radio_set_modem(port_spi_parms, port_radio_parms, port_arguments);
+    }
+    else
+    {
+        radio_turn_idle(port_spi_parms);
+    }
+
+    if (port_arguments->fscal_cache)
+    {
+        fscal_set_channel(port_spi_parms, profile->channel);
+    }
+    else
+    {
+        PI_CC_SPIWriteReg(port_spi_parms, PI_CCxxx0_CHANNR, profile->channel); // calibrated at next Rx or Tx
+    }
+
+    port_index = port;
+    port_activity();
+}
+
+// ------------------------------------------------------------------------------------------------
+// A block was sent or received on the current port
+void port_activity()
+// ------------------------------------------------------------------------------------------------
+{
+    gettimeofday(&port_last_activity, NULL);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Return to port 0 when nothing was sent or received on another port for a while
+void port_check()
+// ------------------------------------------------------------------------------------------------
+{
+    struct timeval now, elapsed;
+
+    if ((port_index == 0) || (!port_active()))
+    {
+        return;
+    }
+
+    gettimeofday(&now, NULL);
+    timeval_subtract(&elapsed, &now, &port_last_activity);
+
+    if (elapsed.tv_sec < PORT_DWELL_S)
+    {
+        return;
+    }
+
+    radio_wait_free(port_spi_parms);
+    port_select(0);
+    radio_init_rx(port_spi_parms, port_arguments);
+    radio_turn_rx(port_spi_parms);
+}
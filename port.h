@@ -0,0 +1,38 @@
+/******************************************************************************/
+/* PiCC1101  - Radio serial link using CC1101 module and Raspberry-Pi         */
+/*                                                                            */
+/* KISS ports mapped to radio profiles                                        */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef _PORT_H_
+#define _PORT_H_
+
+#include <stdint.h>
+
+#include "main.h"
+#include "pi_cc_spi.h"
+#include "radio.h"
+
+#define PORT_MAX      16     // KISS port numbers are 4 bits
+#define PORT_DWELL_S   2     // Seconds Rx stays on the profile of the last port used before returning to port 0
+
+typedef struct port_profile_s
+{
+    uint8_t      in_use;         // Port is configured
+    uint8_t      channel;        // Channel number
+    rate_t       rate;           // Rate index
+    modulation_t modulation;     // Modulation
+} port_profile_t;
+
+int     port_init(spi_parms_t *spi_parms, radio_parms_t *radio_parms, arguments_t *arguments);
+uint8_t port_active();
+uint8_t port_valid(uint8_t port);
+uint8_t port_current();
+void    port_select(uint8_t port);
+void    port_activity();
+void    port_check();
+
+#endif
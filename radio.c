@@ -12,11 +12,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/eventfd.h>
 #include <wiringPi.h>
 
 #include "main.h"
 #include "util.h"
 #include "radio.h"
+#include "link.h"
+#include "hop.h"
+#include "afc.h"
 #include "pi_cc_spi.h"
 #include "pi_cc_cc1100-cc2500.h"
 
@@ -55,58 +59,58 @@ char *state_names[] = {
     "undefined"         // 31
 };
 
-// 4x4 channel bandwidth limits
-float chanbw_limits[] = {
-    812000.0,
-    650000.0,
-    541000.0,
-    464000.0,
-    406000.0,
-    325000.0,
-    270000.0,
-    232000.0,
-    203000.0,
-    162000.0,
-    135000.0,
-    116000.0,
-    102000.0,
-    81000.0,
-    68000.0,
-    58000.0
-};
-
-static radio_int_data_t *p_radio_int_data = 0;
-static radio_int_data_t radio_int_data;
-uint32_t blocks_sent;
-uint32_t blocks_received;
+static radio_int_data_t radio_int_data[RADIO_MAX_UNITS];
+static int              radio_nb_units;    // Number of modules in use
 uint32_t packets_sent;
 uint32_t packets_received;
+static uint8_t        fast_turnaround;   // Turnaround optimized Rx/Tx transitions
+static struct timeval tx_request_time;   // Time transmission was requested (Rx to Tx turnaround)
+static struct timeval tx_end_time;       // Time transmission ended (Tx to Rx turnaround)
+static struct timeval rx_block_time;     // Time the last block taken from the Rx ring was received
+static int8_t         rx_block_freqest;  // Frequency offset estimate of the last block taken from the Rx ring
+static uint8_t        rx_block[PI_CCxxx0_PACKET_COUNT_SIZE+2]; // Last block taken from the Rx ring
+static uint8_t        link_address;      // Link address of this node. 0 if blocks are not addressed
+static uint8_t        link_dest;         // Link address data blocks are sent to
+static uint8_t        block_len_index;   // Index of the block length byte in a block
+static uint8_t        block_dest_index;  // Index of the destination address byte in a block (addressed blocks)
+static uint8_t        block_src_index;   // Index of the source address byte in a block (addressed blocks)
+static uint8_t        block_hop_index;   // Index of the hop position byte followed by the hop phase byte in a block. 0 if not hopping
+static uint8_t        block_header;      // Block header size. The block countdown is its last byte.
+static uint8_t        crc_autoflush;     // Blocks with bad CRC are flushed by the chip
+static int            radio_event_fd = -1; // Event signaled by the interrupt handlers when a block is queued
 
 // === Static functions declarations ==============================================================
 
-static float    rssi_dbm(uint8_t rssi_dec);
 static uint32_t get_freq_word(uint32_t freq_xtal, uint32_t freq_hz);
-static uint8_t  get_mod_word(modulation_t modulation_code);
 static uint32_t get_if_word(uint32_t freq_xtal, uint32_t if_hz);
-static void     get_chanbw_words(float bw, radio_parms_t *radio_parms);
+static void     get_chanspc_words(uint32_t freq_xtal, uint32_t chanspc_hz, uint8_t *chanspc_m, uint8_t *chanspc_e);
 static void     get_rate_words(arguments_t *arguments, radio_parms_t *radio_parms);
 static void     wait_for_state(spi_parms_t *spi_parms, ccxxx0_state_t state, uint32_t timeout);
-static void     print_received_packet(int verbose_min);
+static uint32_t elapsed_us(struct timeval *since);
+static radio_int_data_t *radio_unit(spi_parms_t *spi_parms);
+static void     radio_add_unit(spi_parms_t *spi_parms, int wpi_gdo0, int wpi_gdo2, uint8_t rx_only, uint8_t rx_continuous);
+static uint8_t  radio_take_block(radio_int_data_t *int_data);
+static void     print_received_packet(radio_int_data_t *int_data, uint8_t count, int verbose_min);
+static uint8_t  radio_format_block(radio_int_data_t *int_data, arguments_t *arguments, uint8_t *block_start, uint32_t size, uint8_t block_countdown);
+static void     radio_start_block(spi_parms_t *spi_parms, uint8_t block_countdown);
+static void     radio_end_block(spi_parms_t *spi_parms, uint8_t block_countdown);
 static void     radio_send_block(spi_parms_t *spi_parms, uint8_t block_countdown);
-static uint8_t  radio_receive_block(spi_parms_t *spi_parms, arguments_t *arguments, uint8_t *block, uint32_t *size, uint8_t *crc);
+static uint8_t  radio_receive_block(radio_int_data_t *int_data, arguments_t *arguments, uint8_t count, uint8_t *block, uint32_t *size, uint8_t *crc);
+static void     radio_receive_control(spi_parms_t *spi_parms, arguments_t *arguments, radio_int_data_t *int_data, uint8_t count);
 static uint8_t  crc_check(uint8_t *block);
+static void     radio_signal_event();
 
 // === Interupt handlers ==========================================================================
 
 // ------------------------------------------------------------------------------------------------
 // Processes packets up to 255 bytes
-void int_packet(void)
+void int_packet(radio_int_data_t *p_radio_int_data)
 // ------------------------------------------------------------------------------------------------
 {
-    uint8_t x_byte, *p_byte, int_line, rssi_dec, crc_lqi;
+    uint8_t x_byte, *p_byte, int_line, rssi_dec, crc_lqi, slot;
     int i;
 
-    int_line = digitalRead(WPI_GDO0); // Sense interrupt line to determine if it was a raising or falling edge
+    int_line = digitalRead(p_radio_int_data->wpi_gdo0); // Sense interrupt line to determine if it was a raising or falling edge
 
     if (p_radio_int_data->mode == RADIOMODE_RX)
     {
@@ -151,14 +155,57 @@ void int_packet(void)
 
             if (p_radio_int_data->packet_receive) // packet has been received
             {
+                if ((p_radio_int_data->addr_filter) || (p_radio_int_data->crc_autoflush)) // chip may have discarded the block
+                {
+                    PI_CC_SPIReadStatus(p_radio_int_data->spi_parms, PI_CCxxx0_RXBYTES, &x_byte);
+                    x_byte &= 0x7F;
+
+                    if (x_byte < p_radio_int_data->bytes_remaining) // address check failed or CRC failed and FIFO flushed: chip went back to Rx
+                    {
+                        if (x_byte) // drain what the chip has left
+                        {
+                            PI_CC_SPIReadBurstReg(p_radio_int_data->spi_parms, PI_CCxxx0_RXFIFO, &p_byte, x_byte);
+                        }
+
+                        p_radio_int_data->blocks_dropped++;
+                        p_radio_int_data->packet_receive = 0;
+                        verbprintf(3, "RADIO: block discarded by the chip (%d)\n", p_radio_int_data->blocks_dropped);
+                        return;
+                    }
+                }
+
                 PI_CC_SPIReadBurstReg(p_radio_int_data->spi_parms, PI_CCxxx0_RXFIFO, &p_byte, p_radio_int_data->bytes_remaining);
                 memcpy((uint8_t *) &(p_radio_int_data->rx_buf[p_radio_int_data->byte_index]), p_byte, p_radio_int_data->bytes_remaining);
                 p_radio_int_data->byte_index += p_radio_int_data->bytes_remaining;
                 p_radio_int_data->bytes_remaining = 0;
 
-                radio_int_data.mode = RADIOMODE_NONE;
+                if (p_radio_int_data->packet_rx_count - p_radio_int_data->blocks_received < RADIO_RX_RING) // queue block
+                {
+                    slot = p_radio_int_data->packet_rx_count % RADIO_RX_RING;
+                    memcpy((uint8_t *) p_radio_int_data->rx_ring[slot], (uint8_t *) p_radio_int_data->rx_buf, p_radio_int_data->rx_count);
+                    p_radio_int_data->rx_ring_count[slot] = p_radio_int_data->rx_count;
+                    gettimeofday((struct timeval *) &p_radio_int_data->rx_ring_time[slot], NULL);
+
+                    if (p_radio_int_data->read_freqest) // valid until the next sync word
+                    {
+                        PI_CC_SPIReadStatus(p_radio_int_data->spi_parms, PI_CCxxx0_FREQEST, &x_byte);
+                        p_radio_int_data->rx_ring_freqest[slot] = x_byte;
+                    }
+
+                    p_radio_int_data->packet_rx_count++;
+                    radio_signal_event();
+                }
+                else
+                {
+                    verbprintf(1, "RADIO: Rx ring full, block dropped\n");
+                }
+
+                if (!p_radio_int_data->rx_continuous) // else stay ready for the next block
+                {
+                    p_radio_int_data->mode = RADIOMODE_NONE;
+                }
+
                 p_radio_int_data->packet_receive = 0; // reception is done
-                p_radio_int_data->packet_rx_count++;
             }            
         }        
     }    
@@ -178,7 +225,8 @@ void int_packet(void)
                 p_radio_int_data->packet_send);
             if (p_radio_int_data->packet_send) // packet has been sent
             {
-                radio_int_data.mode = RADIOMODE_NONE;
+                gettimeofday((struct timeval *) &p_radio_int_data->tx_time, NULL);
+                p_radio_int_data->mode = RADIOMODE_NONE;
                 p_radio_int_data->packet_send = 0; // De-assert packet transmission after packet has been sent
                 p_radio_int_data->packet_tx_count++;
                 verbprintf(3, "Sent packet #%d. Remaining bytes to send: %d\n", p_radio_int_data->packet_tx_count, p_radio_int_data->bytes_remaining);
@@ -197,12 +245,12 @@ void int_packet(void)
 // ------------------------------------------------------------------------------------------------
 // Processes packets that do not fit in Rx or Tx FIFOs and 255 bytes long maximum
 // FIFO threshold interrupt handler 
-void int_threshold(void)
+void int_threshold(radio_int_data_t *p_radio_int_data)
 // ------------------------------------------------------------------------------------------------
 {
     uint8_t i, int_line, bytes_to_send, x_byte, *p_byte;
 
-    int_line = digitalRead(WPI_GDO2); // Sense interrupt line to determine if it was a raising or falling edge
+    int_line = digitalRead(p_radio_int_data->wpi_gdo2); // Sense interrupt line to determine if it was a raising or falling edge
 
     if ((p_radio_int_data->mode == RADIOMODE_RX) && (int_line)) // Filling of Rx FIFO - Read next 59 bytes
     {
@@ -248,22 +296,21 @@ void int_threshold(void)
     }
 }
 
-// === Static functions ===========================================================================
-
 // ------------------------------------------------------------------------------------------------
-// Calculate RSSI in dBm from decimal RSSI read out of RSSI status register
-float rssi_dbm(uint8_t rssi_dec)
-// ------------------------------------------------------------------------------------------------
-{
-    if (rssi_dec < 128)
-    {
-        return (rssi_dec / 2.0) - 74.0;
-    }
-    else
-    {
-        return ((rssi_dec - 256) / 2.0) - 74.0;
-    }
-}
+// Interrupt handlers of each module. Wiring Pi handlers take no argument.
+static void int_packet_0(void)    { int_packet(&radio_int_data[0]); }
+static void int_packet_1(void)    { int_packet(&radio_int_data[1]); }
+static void int_packet_2(void)    { int_packet(&radio_int_data[2]); }
+static void int_packet_3(void)    { int_packet(&radio_int_data[3]); }
+static void int_threshold_0(void) { int_threshold(&radio_int_data[0]); }
+static void int_threshold_1(void) { int_threshold(&radio_int_data[1]); }
+static void int_threshold_2(void) { int_threshold(&radio_int_data[2]); }
+static void int_threshold_3(void) { int_threshold(&radio_int_data[3]); }
+
+static void (*int_packet_handlers[RADIO_MAX_UNITS])(void)    = {int_packet_0, int_packet_1, int_packet_2, int_packet_3};
+static void (*int_threshold_handlers[RADIO_MAX_UNITS])(void) = {int_threshold_0, int_threshold_1, int_threshold_2, int_threshold_3};
+
+// === Static functions ===========================================================================
 
 // ------------------------------------------------------------------------------------------------
 // Calculate frequency word FREQ[23..0]
@@ -284,99 +331,80 @@ uint32_t get_if_word(uint32_t freq_xtal, uint32_t if_hz)
 }
 
 // ------------------------------------------------------------------------------------------------
-// Calculate modulation format word MOD_FORMAT[2..0]
-uint8_t get_mod_word(modulation_t modulation_code)
-// ------------------------------------------------------------------------------------------------
-{
-    switch (modulation_code)
-    {
-        case MOD_OOK:
-            return 3;
-            break;
-        case MOD_FSK2:
-            return 0;
-            break;
-        case MOD_FSK4:
-            return 4;
-            break;
-        case MOD_MSK:
-            return 7;
-            break;
-        case MOD_GFSK:
-            return 1;
-            break;
-        default:
-            return 0;
-    }
-}
-
-// ------------------------------------------------------------------------------------------------
-// Calculate CHANBW words according to CC1101 bandwidth steps
-void get_chanbw_words(float bw, radio_parms_t *radio_parms)
+// Calculate channel spacing words CHANSPC_M and CHANSPC_E
+// Spacing = (Fxosc / 2^18) * (256 + CHANSPC_M) * 2^CHANSPC_E. Zero or out of range values are clamped.
+void get_chanspc_words(uint32_t freq_xtal, uint32_t chanspc_hz, uint8_t *chanspc_m, uint8_t *chanspc_e)
 // ------------------------------------------------------------------------------------------------
 {
-    uint8_t e_index, m_index;
+    uint64_t m;
+    uint8_t  e;
 
-    for (e_index=0; e_index<4; e_index++)
+    for (e = 0; e < 4; e++)
     {
-        for (m_index=0; m_index<4; m_index++)
+        m = ((uint64_t) chanspc_hz * (1<<18)) / ((uint64_t) freq_xtal * (1<<e));
+
+        if (m < 256)
         {
-            if (bw > chanbw_limits[4*e_index + m_index])
-            {
-                radio_parms->chanbw_e = e_index;
-                radio_parms->chanbw_m = m_index;
-                return;
-            }
+            *chanspc_m = 0; // below minimum spacing
+            *chanspc_e = e;
+            return;
+        }
+        else if (m < 512)
+        {
+            *chanspc_m = m - 256;
+            *chanspc_e = e;
+            return;
         }
     }
 
-    radio_parms->chanbw_e = 3;
-    radio_parms->chanbw_m = 3;
+    *chanspc_m = 255; // above maximum spacing
+    *chanspc_e = 3;
 }
 
 // ------------------------------------------------------------------------------------------------
-// Calculate data rate, channel bandwidth and deviation words. Assumes 26 MHz crystal.
-//   o DRATE = (Fxosc / 2^28) * (256 + DRATE_M) * 2^DRATE_E
-//   o CHANBW = Fxosc / (8(4+CHANBW_M) * 2^CHANBW_E)
-//   o DEVIATION = (Fxosc / 2^17) * (8 + DEVIATION_M) * 2^DEVIATION_E
+// Get data rate, channel bandwidth, modulation and deviation registers and words. The register set
+// is taken from the build time table if rate skew and modulation index are tabulated else computed.
 void get_rate_words(arguments_t *arguments, radio_parms_t *radio_parms)
 // ------------------------------------------------------------------------------------------------
 {
-    double drate, deviat, f_xtal;
+    int profile = modem_profile_index(arguments->rate, arguments->modulation, arguments->modulation_index, arguments->rate_skew);
 
-    drate = (double) rate_values[arguments->rate];
-    drate *= arguments->rate_skew;
-
-    if ((arguments->modulation == MOD_FSK4) && (drate > 300000.0))
+    if ((arguments->modulation == MOD_FSK4) && (rate_values[arguments->rate] * arguments->rate_skew > 300000.0))
     {
         fprintf(stderr, "RADIO: forcibly set data rate to 300 kBaud for 4-FSK\n");
-        drate = 300000.0;
     }
 
-    deviat = drate * arguments->modulation_index;
-    f_xtal = (double) radio_parms->f_xtal;
-
-    get_chanbw_words(2.0*(deviat + drate), radio_parms); // Apply Carson's rule for bandwidth
-
-    radio_parms->drate_e = (uint8_t) (floor(log2( drate*(1<<20) / f_xtal )));
-    radio_parms->drate_m = (uint8_t) (((drate*(1<<28)) / (f_xtal * (1<<radio_parms->drate_e))) - 256);
-    radio_parms->drate_e &= 0x0F; // it is 4 bits long
+    if ((profile >= 0) && (radio_parms->f_xtal == MODEM_F_XTAL))
+    {
+        radio_parms->modem_regs = modem_table[profile];
+    }
+    else
+    {
+        modem_get_regs(arguments->rate, arguments->modulation, arguments->modulation_index, arguments->rate_skew, 
+            radio_parms->f_xtal, &radio_parms->modem_regs);
+    }
 
-    radio_parms->deviat_e = (uint8_t) (floor(log2( deviat*(1<<14) / f_xtal )));
-    radio_parms->deviat_m = (uint8_t) (((deviat*(1<<17)) / (f_xtal * (1<<radio_parms->deviat_e))) - 8);
-    radio_parms->deviat_e &= 0x07; // it is 3 bits long
-    radio_parms->deviat_m &= 0x07; // it is 3 bits long
+    radio_parms->modem_profile = profile;
+    radio_parms->chanbw_e = (radio_parms->modem_regs.mdmcfg4>>6) & 0x03;
+    radio_parms->chanbw_m = (radio_parms->modem_regs.mdmcfg4>>4) & 0x03;
+    radio_parms->drate_e  = radio_parms->modem_regs.mdmcfg4 & 0x0F;
+    radio_parms->drate_m  = radio_parms->modem_regs.mdmcfg3;
+    radio_parms->deviat_e = (radio_parms->modem_regs.deviatn>>4) & 0x07;
+    radio_parms->deviat_m = radio_parms->modem_regs.deviatn & 0x07;
 
     radio_parms->chanspc_e &= 0x03; // it is 2 bits long
 }
 
 // ------------------------------------------------------------------------------------------------
-// Poll FSM state waiting for given state until timeout (approx ms)
+// Poll FSM state waiting for given state until timeout (approx ms). Polls every 10us so that
+// transitions are caught as soon as they occur.
 void wait_for_state(spi_parms_t *spi_parms, ccxxx0_state_t state, uint32_t timeout)
 // ------------------------------------------------------------------------------------------------
 {
     uint8_t fsm_state;
 
+    timeout *= 100; // in 10us units
+
     while(timeout)
     {
         PI_CC_SPIReadStatus(spi_parms, PI_CCxxx0_MARCSTATE, &fsm_state);
@@ -387,7 +415,7 @@ void wait_for_state(spi_parms_t *spi_parms, ccxxx0_state_t state, uint32_t timeo
             break;
         }
 
-        usleep(1000);
+        usleep(10);
         timeout--;
     }
 
@@ -404,23 +432,97 @@ void wait_for_state(spi_parms_t *spi_parms, ccxxx0_state_t state, uint32_t timeo
 }
 
 // ------------------------------------------------------------------------------------------------
-void print_received_packet(int verbose_min)
-// Print a received packet stored in the interrupt data block
+// Microseconds elapsed since given time
+uint32_t elapsed_us(struct timeval *since)
+// ------------------------------------------------------------------------------------------------
+{
+    struct timeval now, delta;
+
+    gettimeofday(&now, NULL);
+    timeval_subtract(&delta, &now, since);
+
+    return ts_us(&delta);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Get the interrupt data of the module using this SPI link. Defaults to the first module.
+radio_int_data_t *radio_unit(spi_parms_t *spi_parms)
+// ------------------------------------------------------------------------------------------------
+{
+    int i;
+
+    for (i=0; i<radio_nb_units; i++)
+    {
+        if (radio_int_data[i].spi_parms == spi_parms)
+        {
+            return &radio_int_data[i];
+        }
+    }
+
+    return &radio_int_data[0];
+}
+
+// ------------------------------------------------------------------------------------------------
+// Register a module with its SPI link and interrupt lines
+void radio_add_unit(spi_parms_t *spi_parms, int wpi_gdo0, int wpi_gdo2, uint8_t rx_only, uint8_t rx_continuous)
+// ------------------------------------------------------------------------------------------------
+{
+    radio_int_data_t *int_data = &radio_int_data[radio_nb_units++];
+
+    int_data->spi_parms = spi_parms;
+    int_data->wpi_gdo0 = wpi_gdo0;
+    int_data->wpi_gdo2 = wpi_gdo2;
+    int_data->rx_only = rx_only;
+    int_data->rx_continuous = rx_continuous;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Wake up the main loop waiting on the radio event
+void radio_signal_event()
+// ------------------------------------------------------------------------------------------------
+{
+    uint64_t one = 1;
+
+    if (radio_event_fd >= 0)
+    {
+        write(radio_event_fd, &one, sizeof(one));
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Copy the next received block of a module from its Rx ring to rx_block. Returns its size.
+uint8_t radio_take_block(radio_int_data_t *int_data)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t slot = int_data->blocks_received % RADIO_RX_RING;
+    uint8_t count = int_data->rx_ring_count[slot];
+
+    memcpy(rx_block, (uint8_t *) int_data->rx_ring[slot], count);
+    rx_block_time = *((struct timeval *) &int_data->rx_ring_time[slot]);
+    rx_block_freqest = (int8_t) int_data->rx_ring_freqest[slot];
+    int_data->blocks_received++;
+
+    return count;
+}
+
+// ------------------------------------------------------------------------------------------------
+void print_received_packet(radio_int_data_t *int_data, uint8_t count, int verbose_min)
+// Print the received block taken from the Rx ring
 // ------------------------------------------------------------------------------------------------
 {
     uint8_t rssi_dec, crc_lqi;
     int i;
 
     verbprintf(verbose_min, "Rx: packet length %d, FIFO was hit %d times\n", 
-        radio_int_data.rx_count,
-        radio_int_data.threshold_hits);
-    print_block(verbose_min+2, (uint8_t *) radio_int_data.rx_buf, radio_int_data.rx_count);
+        count,
+        int_data->threshold_hits);
+    print_block(verbose_min+2, rx_block, count);
 
-    rssi_dec = radio_int_data.rx_buf[radio_int_data.rx_count-2];
-    crc_lqi  = radio_int_data.rx_buf[radio_int_data.rx_count-1];
-    radio_int_data.rx_buf[radio_int_data.rx_count-2] = '\0';
+    rssi_dec = rx_block[count-2];
+    crc_lqi  = rx_block[count-1];
+    rx_block[count-2] = '\0';
 
-    verbprintf(verbose_min, "%d: (%03d) \"%s\"\n", radio_int_data.rx_buf[1], radio_int_data.rx_buf[0] - 1, &radio_int_data.rx_buf[2]);
+    verbprintf(verbose_min, "%d: (%03d) \"%s\"\n", rx_block[block_header-1], rx_block[block_len_index] - (block_header-1), &rx_block[block_header]);
     verbprintf(verbose_min, "RSSI: %.1f dBm. LQI=%d. CRC=%d\n", 
         rssi_dbm(rssi_dec),
         0x7F - (crc_lqi & 0x7F),
@@ -431,28 +533,58 @@ void print_received_packet(int verbose_min)
 // === Public functions ===========================================================================
 
 // ------------------------------------------------------------------------------------------------
-// Initialize interrupt data and mechanism
-void init_radio_int(spi_parms_t *spi_parms, arguments_t *arguments)
+// Calculate RSSI in dBm from decimal RSSI read out of RSSI status register
+float rssi_dbm(uint8_t rssi_dec)
+// ------------------------------------------------------------------------------------------------
+{
+    if (rssi_dec < 128)
+    {
+        return (rssi_dec / 2.0) - 74.0;
+    }
+    else
+    {
+        return ((rssi_dec - 256) / 2.0) - 74.0;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Initialize interrupt data and mechanism of all modules
+void init_radio_int(arguments_t *arguments)
 // ------------------------------------------------------------------------------------------------
 {
-    radio_int_data.mode = RADIOMODE_NONE;
-    radio_int_data.packet_rx_count = 0;
-    radio_int_data.packet_tx_count = 0;
+    radio_int_data_t *int_data;
+    int i;
+
     packets_sent = 0;
     packets_received = 0;
-    radio_int_data.spi_parms = spi_parms;
-    radio_int_data.wait_us = 8000000 / rate_values[arguments->rate]; // approximately 2-FSK byte delay
-    p_radio_int_data = &radio_int_data;
 
-    wiringPiISR(WPI_GDO0, INT_EDGE_BOTH, &int_packet);       // set interrupt handler for packet interrupts
+    if (radio_event_fd < 0)
+    {
+        radio_event_fd = eventfd(0, EFD_NONBLOCK);
+    }
 
-    if (arguments->packet_length >= PI_CCxxx0_FIFO_SIZE)
+    for (i=0; i<radio_nb_units; i++)
     {
-        wiringPiISR(WPI_GDO2, INT_EDGE_BOTH, &int_threshold); // set interrupt handler for FIFO threshold interrupts
+        int_data = &radio_int_data[i];
+        int_data->mode = RADIOMODE_NONE;
+        int_data->packet_rx_count = 0;
+        int_data->packet_tx_count = 0;
+        int_data->blocks_received = 0;
+        int_data->blocks_dropped = 0;
+        int_data->blocks_dropped_seen = 0;
+        int_data->blocks_sent = 0;
+        int_data->wait_us = 8000000 / rate_values[arguments->rate]; // approximately 2-FSK byte delay
+
+        wiringPiISR(int_data->wpi_gdo0, INT_EDGE_BOTH, int_packet_handlers[i]);       // set interrupt handler for packet interrupts
+
+        if (arguments->packet_length >= PI_CCxxx0_FIFO_SIZE)
+        {
+            wiringPiISR(int_data->wpi_gdo2, INT_EDGE_BOTH, int_threshold_handlers[i]); // set interrupt handler for FIFO threshold interrupts
+        }
     }
 
-    verbprintf(1, "Unit delay .............: %d us\n", radio_int_data.wait_us);
-    verbprintf(1, "Packet delay ...........: %d us\n", arguments->packet_delay * radio_int_data.wait_us);
+    verbprintf(1, "Unit delay .............: %d us\n", radio_int_data[0].wait_us);
+    verbprintf(1, "Packet delay ...........: %d us\n", arguments->packet_delay * radio_int_data[0].wait_us);
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -470,6 +602,66 @@ void radio_turn_rx(spi_parms_t *spi_parms)
 {
     PI_CC_SPIStrobe(spi_parms, PI_CCxxx0_SRX);
     wait_for_state(spi_parms, CCxxx0_STATE_RX, 10); // Wait max 10ms
+
+    if (tx_end_time.tv_sec) // back from transmission
+    {
+        verbprintf(2, "RADIO: Tx to Rx turnaround %d us\n", elapsed_us(&tx_end_time));
+        tx_end_time.tv_sec = 0;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Prepare for transmission of a packet. With fast turnaround the radio goes from Rx straight to the
+// FSTXON state where the synthesizer keeps running. FIFOs are flushed only if they are not empty.
+void radio_prepare_tx(spi_parms_t *spi_parms)
+// ------------------------------------------------------------------------------------------------
+{
+    radio_int_data_t *int_data = radio_unit(spi_parms);
+    uint8_t rx_bytes, tx_bytes;
+
+    gettimeofday(&tx_request_time, NULL);
+
+    if (int_data->rx_continuous) // stop taking blocks
+    {
+        int_data->mode = RADIOMODE_NONE;
+        int_data->packet_receive = 0;
+    }
+
+    if (!fast_turnaround)
+    {
+        radio_turn_idle(spi_parms);   // Inhibit radio operations
+        radio_flush_fifos(spi_parms); // Flush result of any Rx activity
+        return;
+    }
+
+    PI_CC_SPIReadStatus(spi_parms, PI_CCxxx0_RXBYTES, &rx_bytes);
+    PI_CC_SPIReadStatus(spi_parms, PI_CCxxx0_TXBYTES, &tx_bytes);
+
+    if ((rx_bytes) || (tx_bytes)) // leftovers or overflow/underflow: flushing needs IDLE state
+    {
+        verbprintf(3, "RADIO: flushing FIFOs before Tx (Rx:%02X Tx:%02X)\n", rx_bytes, tx_bytes);
+        radio_turn_idle(spi_parms);
+        radio_flush_fifos(spi_parms);
+    }
+
+    PI_CC_SPIStrobe(spi_parms, PI_CCxxx0_SFSTXON); // From Rx this bypasses clear channel assessment at STX
+}
+
+// ------------------------------------------------------------------------------------------------
+// Clear channel assessment. Radio must be in Rx state. Returns 1 if the channel is clear.
+uint8_t radio_channel_clear(spi_parms_t *spi_parms)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t pkt_status;
+
+    if (radio_unit(spi_parms)->packet_receive) // reception in progress
+    {
+        return 0;
+    }
+
+    PI_CC_SPIReadStatus(spi_parms, PI_CCxxx0_PKTSTATUS, &pkt_status);
+
+    return (pkt_status & 0x10)>>4; // CCA bit: RSSI below threshold and not receiving a packet
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -486,24 +678,62 @@ void radio_flush_fifos(spi_parms_t *spi_parms)
 void init_radio_parms(radio_parms_t *radio_parms, arguments_t *arguments)
 // ------------------------------------------------------------------------------------------------
 {
-    radio_parms->f_xtal        = 26000000;         // 26 MHz Xtal
+    int i;
+
+    radio_parms->f_xtal        = MODEM_F_XTAL;     // 26 MHz Xtal
     radio_parms->f_if          = 310000;           // 304.6875 kHz (lowest point below 310 kHz)
     radio_parms->sync_ctl      = SYNC_30_over_32;  // 30/32 sync word bits detected
-    radio_parms->chanspc_m     = 0;                // Do not use channel spacing for the moment defaulting to 0
-    radio_parms->chanspc_e     = 0;                // Do not use channel spacing for the moment defaulting to 0
+    get_chanspc_words(radio_parms->f_xtal, arguments->chanspc_hz, &radio_parms->chanspc_m, &radio_parms->chanspc_e);
     radio_parms->modulation    = (radio_modulation_t) arguments->modulation;
     radio_parms->fec           = arguments->fec;
-    radio_int_data.packet_length = arguments->packet_length;
 
     if (arguments->variable_length)
     {
         radio_parms->packet_config = PKTLEN_VARIABLE;  // Use variable packet length
-        radio_int_data.packet_config = PKTLEN_VARIABLE;
     }
     else
     {
         radio_parms->packet_config = PKTLEN_FIXED;     // Use fixed packet length
-        radio_int_data.packet_config = PKTLEN_FIXED;
+    }
+
+    // Block header is length and countdown. Addressed blocks add destination and source addresses.
+    // The chip checks the destination address in the first byte after the length byte in variable
+    // length mode and in the first byte of the block in fixed length mode. With hopping the timing
+    // of the sender comes before the countdown (see hop.c).
+    link_address = arguments->link_address;
+    link_dest = arguments->link_dest;
+    crc_autoflush = arguments->crc_autoflush;
+
+    if (link_address)
+    {
+        block_dest_index = (arguments->variable_length ? 1 : 0);
+        block_len_index  = (arguments->variable_length ? 0 : 1);
+        block_src_index  = 2;
+        block_header     = 4;
+    }
+    else
+    {
+        block_len_index  = 0;
+        block_header     = 2;
+    }
+
+    if (arguments->hop_nb_channels > 1)
+    {
+        block_hop_index  = block_header - 1;
+        block_header    += 2;
+    }
+    else
+    {
+        block_hop_index  = 0;
+    }
+
+    for (i=0; i<RADIO_MAX_UNITS; i++)
+    {
+        radio_int_data[i].packet_length = arguments->packet_length;
+        radio_int_data[i].packet_config = radio_parms->packet_config;
+        radio_int_data[i].addr_filter = (link_address != 0);
+        radio_int_data[i].crc_autoflush = crc_autoflush;
+        radio_int_data[i].read_freqest = arguments->afc;
     }
 }
 
@@ -513,7 +743,6 @@ int init_radio(radio_parms_t *radio_parms, spi_parms_t *spi_parms, arguments_t *
 // ------------------------------------------------------------------------------------------------
 {
     int ret = 0;
-    uint8_t  reg_word;
 
     verbprintf(1, "\ninit_radio...\n");
 
@@ -535,9 +764,38 @@ int init_radio(radio_parms_t *radio_parms, spi_parms_t *spi_parms, arguments_t *
         }
     }
 
+    ret = init_radio_unit(radio_parms, spi_parms, arguments, arguments->spi_device, arguments->freq_hz);
+
+    if (ret != 0)
+    {
+        return ret;
+    }
+
+    radio_add_unit(spi_parms, WPI_GDO0, WPI_GDO2, 0, (arguments->bond_spi_devices != 0)); // bonded modules stay in Rx
+
+    // Tune to the first channel of the channel plan. Calibrate once if requested.
+    ret = hop_init(spi_parms, radio_parms, arguments);
+
+    if (ret != 0)
+    {
+        fprintf(stderr, "RADIO: cannot calibrate frequency synthesizer, RC=%d\n", ret);
+        return ret;
+    }
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Open the SPI link of a module, reset the chip and write register settings
+int init_radio_unit(radio_parms_t *radio_parms, spi_parms_t *spi_parms, arguments_t *arguments, char *spi_device, uint32_t freq_hz)
+// ------------------------------------------------------------------------------------------------
+{
+    int ret = 0;
+    uint8_t  reg_word;
+
     // open SPI link
     PI_CC_SPIParmsDefaults(spi_parms);
-    ret = PI_CC_SPISetup(spi_parms, arguments);
+    ret = PI_CC_SPISetup(spi_parms, spi_device);
 
     if (ret != 0)
     {
@@ -600,16 +858,20 @@ int init_radio(radio_parms_t *radio_parms, spi_parms_t *spi_parms, arguments_t *
     // PKTCTRL1: Packet automation control #1
     // . bits 7:5: 000 -> Preamble quality estimator threshold
     // . bit  4:   unused
-    // . bit  3:   0   -> Automatic flush of Rx FIFO disabled (too many side constraints see doc)
+    // . bit  3:   0   -> Automatic flush of Rx FIFO disabled
+    //             1   -> Automatic flush of Rx FIFO when CRC is not OK. Only when the block fits in the FIFO.
     // . bit  2:   1   -> Append two status bytes to the payload (RSSI and LQI + CRC OK)
     // . bits 1:0: 00  -> No address check of received packets
-    PI_CC_SPIWriteReg(spi_parms, PI_CCxxx0_PKTCTRL1, 0x04); // Packet automation control.
+    //             11  -> Address check with 0x00 and 0xFF broadcast when a link address is given
+    reg_word = 0x04 + (crc_autoflush ? 0x08 : 0x00) + (link_address ? 0x03 : 0x00);
+    PI_CC_SPIWriteReg(spi_parms, PI_CCxxx0_PKTCTRL1, reg_word); // Packet automation control.
 
-    PI_CC_SPIWriteReg(spi_parms, PI_CCxxx0_ADDR,     0x00); // Device address for packet filtration (unused, see just above).
-    PI_CC_SPIWriteReg(spi_parms, PI_CCxxx0_CHANNR,   0x00); // Channel number (unused, use direct frequency programming).
+    PI_CC_SPIWriteReg(spi_parms, PI_CCxxx0_ADDR,     link_address); // Device address for packet filtration (see just above).
+    PI_CC_SPIWriteReg(spi_parms, PI_CCxxx0_CHANNR,   0x00); // Channel number. Set from the channel plan at the end (see hop.c).
 
     // FSCTRL0: Frequency offset added to the base frequency before being used by the
     // frequency synthesizer. (2s-complement). Multiplied by Fxtal/2^14
+    // Starts at 0 and is adjusted by automatic frequency control if engaged (see afc.c)
     PI_CC_SPIWriteReg(spi_parms, PI_CCxxx0_FSCTRL0,  0x00); // Freq synthesizer control.
 
     // FSCTRL1: The desired IF frequency to employ in RX. Subtracted from FS base frequency
@@ -624,7 +886,7 @@ int init_radio(radio_parms_t *radio_parms, spi_parms_t *spi_parms, arguments_t *
     // FREQ1 is FREQ[15..8]
     // FREQ0 is FREQ[7..0]
     // Fxtal = 26 MHz and FREQ = 0x10A762 => Fo = 432.99981689453125 MHz
-    radio_parms->freq_word = get_freq_word(radio_parms->f_xtal, arguments->freq_hz);
+    radio_parms->freq_word = get_freq_word(radio_parms->f_xtal, freq_hz);
     PI_CC_SPIWriteReg(spi_parms, PI_CCxxx0_FREQ2,    ((radio_parms->freq_word>>16) & 0xFF)); // Freq control word, high byte
     PI_CC_SPIWriteReg(spi_parms, PI_CCxxx0_FREQ1,    ((radio_parms->freq_word>>8)  & 0xFF)); // Freq control word, mid byte.
     PI_CC_SPIWriteReg(spi_parms, PI_CCxxx0_FREQ0,    (radio_parms->freq_word & 0xFF));       // Freq control word, low byte.
@@ -637,35 +899,22 @@ int init_radio(radio_parms_t *radio_parms, spi_parms_t *spi_parms, arguments_t *
     //      Factory defaults: M=0, E=1 => BW = 26/128 ~ 203 kHz
     // Low nibble:
     // . bits 3:0: 13 -> DRATE_E: data rate base 2 exponent => here 13 (multiply by 8192)
-    reg_word = (radio_parms->chanbw_e<<6) + (radio_parms->chanbw_m<<4) + radio_parms->drate_e;
-    PI_CC_SPIWriteReg(spi_parms, PI_CCxxx0_MDMCFG4,  reg_word); // Modem configuration.
-
     // MODCFG3 Modem configuration: DRATE_M data rate mantissa as per formula:
     //    Rate = (256 + DRATE_M).2^DRATE_E.Fxosc / 2^28 
     // Here DRATE_M = 59, DRATE_E = 13 => Rate = 250 kBaud
-    PI_CC_SPIWriteReg(spi_parms, PI_CCxxx0_MDMCFG3,  radio_parms->drate_m); // Modem configuration.
-
     // MODCFG2 Modem configuration: DC block, modulation, Manchester, sync word
     // o bit 7:    0   -> Enable DC blocking (1: disable)
     // o bits 6:4: xxx -> (provided)
     // o bit 3:    0   -> Manchester disabled (1: enable)
     // o bits 2:0: 011 -> Sync word qualifier is 30/32 (static init in radio interface)
-    reg_word = (get_mod_word(arguments->modulation)<<4) + radio_parms->sync_ctl;
-    PI_CC_SPIWriteReg(spi_parms, PI_CCxxx0_MDMCFG2,  reg_word); // Modem configuration.
-
     // MODCFG1 Modem configuration: FEC, Preamble, exponent for channel spacing
     // o bit 7:    0   -> FEC disabled (1: enable)
     // o bits 6:4: 2   -> number of preamble bytes (0:2, 1:3, 2:4, 3:6, 4:8, 5:12, 6:16, 7:24)
     // o bits 3:2: unused
     // o bits 1:0: CHANSPC_E: exponent of channel spacing (here: 2)
-    reg_word = (arguments->fec<<7) + (((int) arguments->preamble)<<4) + (radio_parms->chanspc_e);
-    PI_CC_SPIWriteReg(spi_parms, PI_CCxxx0_MDMCFG1,  reg_word); // Modem configuration.
-
     // MODCFG0 Modem configuration: CHANSPC_M: mantissa of channel spacing following this formula:
     //    Df = (Fxosc / 2^18) * (256 + CHANSPC_M) * 2^CHANSPC_E
     //    Here: (26 /  ) * 2016 = 0.199951171875 MHz (200 kHz)
-    PI_CC_SPIWriteReg(spi_parms, PI_CCxxx0_MDMCFG0,  radio_parms->chanspc_m); // Modem configuration.
-
     // DEVIATN: Modem deviation
     // o bit 7:    0   -> not used
     // o bits 6:4: 0   -> DEVIATION_E: deviation exponent
@@ -682,8 +931,7 @@ int init_radio(radio_parms_t *radio_parms, spi_parms_t *spi_parms, arguments_t *
     //
     //   OOK      : No effect
     //    
-    reg_word = (radio_parms->deviat_e<<4) + (radio_parms->deviat_m);
-    PI_CC_SPIWriteReg(spi_parms, PI_CCxxx0_DEVIATN,  reg_word); // Modem dev (when FSK mod en)
+    radio_write_modem(spi_parms, radio_parms, arguments); // MDMCFG4 to DEVIATN in one burst
 
     // MCSM2: Main Radio State Machine. See documentation.
     PI_CC_SPIWriteReg(spi_parms, PI_CCxxx0_MCSM2 ,   0x00); //MainRadio Cntrl State Machine
@@ -694,18 +942,20 @@ int init_radio(radio_parms_t *radio_parms, spi_parms_t *spi_parms, arguments_t *
     //   0 (00): Always clear
     //   1 (01): Clear if RSSI below threshold
     //   2 (10): Always claar unless receiving a packet
-    //   3 (11): Claar if RSSI below threshold unless receiving a packet
+    //   3 (11): Claar if RSSI below threshold unless receiving a packet <== (CCA bit of PKTSTATUS used for CSMA)
     // o bits 3:2: RXOFF_MODE: Select to what state it should go when a packet has been received
-    //   0 (00): IDLE <== 
+    //   0 (00): IDLE
     //   1 (01): FSTXON
     //   2 (10): TX
-    //   3 (11): RX (stay)
+    //   3 (11): RX (stay) <==
     // o bits 1:0: TXOFF_MODE: Select what should happen when a packet has been sent
     //   0 (00): IDLE <==
     //   1 (01): FSTXON
     //   2 (10): TX (stay)
     //   3 (11): RX 
-    PI_CC_SPIWriteReg(spi_parms, PI_CCxxx0_MCSM1 ,   0x3C); //MainRadio Cntrl State Machine
+    //   With fast turnaround TXOFF_MODE is set to RX (or FSTXON between blocks of a packet) <==
+    fast_turnaround = arguments->fast_turnaround;
+    PI_CC_SPIWriteReg(spi_parms, PI_CCxxx0_MCSM1 ,   (fast_turnaround ? 0x3F : 0x3C)); //MainRadio Cntrl State Machine
 
     // MCSM0: Main Radio State Machine.
     // o bits 7:6: not used
@@ -805,8 +1055,8 @@ int init_radio(radio_parms_t *radio_parms, spi_parms_t *spi_parms, arguments_t *
     //   3 (11): 14 dB increase in RSSI value
     // o bits 3:0: CARRIER_SENSE_ABS_THR: Sets the absolute RSSI threshold for asserting carrier sense. 
     //   The 2-complement signed threshold is programmed in steps of 1 dB and is relative to the MAGN_TARGET setting.
-    //   0 is at MAGN_TARGET setting.
-    PI_CC_SPIWriteReg(spi_parms, PI_CCxxx0_AGCCTRL1, 0x00); // AGC control.
+    //   0 is at MAGN_TARGET setting. Set from the carrier sense threshold option.
+    PI_CC_SPIWriteReg(spi_parms, PI_CCxxx0_AGCCTRL1, (arguments->cs_threshold & 0x0F)); // AGC control.
 
     // AGCCTRL0: AGC Control
     // o bits 7:6: HYST_LEVEL: Sets the level of hysteresis on the magnitude deviation
@@ -884,6 +1134,132 @@ int init_radio(radio_parms_t *radio_parms, spi_parms_t *spi_parms, arguments_t *
     return 0;
 }
 
+// ------------------------------------------------------------------------------------------------
+// Initialize the second module of a full duplex link. It is dedicated to reception on its own
+// frequency while the first module is used for transmission.
+int init_radio_duplex(radio_parms_t *radio_parms, spi_parms_t *spi_parms, arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    radio_parms_t rx_radio_parms = *radio_parms; // keeps the Tx frequency word
+    int ret;
+
+    verbprintf(1, "\ninit_radio_duplex...\n");
+
+    ret = init_radio_unit(&rx_radio_parms, spi_parms, arguments, arguments->duplex_spi_device, arguments->duplex_freq_hz);
+
+    if (ret != 0)
+    {
+        return ret;
+    }
+
+    radio_add_unit(spi_parms, arguments->duplex_gdo0, arguments->duplex_gdo2, 1, 1);
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Initialize an additional module of a bonded link. It uses the modem settings of the first module
+// on its own channel and stays in Rx between blocks.
+int init_radio_bonded(radio_parms_t *radio_parms, spi_parms_t *spi_parms, arguments_t *arguments, char *spi_device, int wpi_gdo0, int wpi_gdo2, uint8_t channel)
+// ------------------------------------------------------------------------------------------------
+{
+    radio_parms_t bond_radio_parms = *radio_parms;
+    int ret;
+
+    verbprintf(1, "\ninit_radio_bonded %s...\n", spi_device);
+
+    if (radio_nb_units == RADIO_MAX_UNITS)
+    {
+        fprintf(stderr, "RADIO: too many modules\n");
+        return 1;
+    }
+
+    ret = init_radio_unit(&bond_radio_parms, spi_parms, arguments, spi_device, arguments->freq_hz);
+
+    if (ret != 0)
+    {
+        return ret;
+    }
+
+    PI_CC_SPIWriteReg(spi_parms, PI_CCxxx0_CHANNR, channel); // calibrated at next Rx or Tx
+    radio_add_unit(spi_parms, wpi_gdo0, wpi_gdo2, 0, 1);
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Get the SPI link of the module used for reception. It is the module dedicated to reception in
+// full duplex else the given module.
+spi_parms_t *radio_get_rx_unit(spi_parms_t *spi_parms)
+// ------------------------------------------------------------------------------------------------
+{
+    int i;
+
+    for (i=0; i<radio_nb_units; i++)
+    {
+        if (radio_int_data[i].rx_only)
+        {
+            return radio_int_data[i].spi_parms;
+        }
+    }
+
+    return spi_parms;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Reprogram data rate, modulation and deviation on the fly from the rate and modulation arguments.
+// Leaves the radio in IDLE state.
+void radio_set_modem(spi_parms_t *spi_parms, radio_parms_t *radio_parms, arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    struct timeval tstart, tstop, tdelay;
+    int i;
+
+    gettimeofday(&tstart, NULL);
+    radio_turn_idle(spi_parms);
+
+    radio_parms->modulation = (radio_modulation_t) arguments->modulation;
+    get_rate_words(arguments, radio_parms);
+    radio_write_modem(spi_parms, radio_parms, arguments);
+
+    for (i=0; i<radio_nb_units; i++) // all modules share the same modem settings
+    {
+        if (radio_int_data[i].spi_parms != spi_parms)
+        {
+            radio_turn_idle(radio_int_data[i].spi_parms);
+            radio_write_modem(radio_int_data[i].spi_parms, radio_parms, arguments);
+        }
+
+        radio_int_data[i].wait_us = 8000000 / rate_values[arguments->rate]; // approximately 2-FSK byte delay
+    }
+
+    gettimeofday(&tstop, NULL);
+    timeval_subtract(&tdelay, &tstop, &tstart);
+    verbprintf(2, "RADIO: modem profile %d set in %d us\n", radio_parms->modem_profile, ts_us(&tdelay));
+
+    if (arguments->verbose_level > 1)
+    {
+        print_radio_parms(radio_parms);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Write modem registers MDMCFG4, MDMCFG3, MDMCFG2, MDMCFG1, MDMCFG0 and DEVIATN in one burst
+void radio_write_modem(spi_parms_t *spi_parms, radio_parms_t *radio_parms, arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t regs[6];
+
+    regs[0] = radio_parms->modem_regs.mdmcfg4;                                                 // MDMCFG4
+    regs[1] = radio_parms->modem_regs.mdmcfg3;                                                 // MDMCFG3
+    regs[2] = radio_parms->modem_regs.mdmcfg2 + radio_parms->sync_ctl;                         // MDMCFG2
+    regs[3] = (arguments->fec<<7) + (((int) arguments->preamble)<<4) + (radio_parms->chanspc_e); // MDMCFG1
+    regs[4] = radio_parms->chanspc_m;                                                          // MDMCFG0
+    regs[5] = radio_parms->modem_regs.deviatn;                                                 // DEVIATN
+
+    PI_CC_SPIWriteBurstReg(spi_parms, PI_CCxxx0_MDMCFG4, regs, 6);
+}
+
 // ------------------------------------------------------------------------------------------------
 // Print status registers to stderr
 int  print_radio_status(spi_parms_t *spi_parms)
@@ -1011,20 +1387,97 @@ float radio_get_byte_time(radio_parms_t *radio_parms)
     return base_time;
 }
 
+// ------------------------------------------------------------------------------------------------
+// Set the frequency offset of all modules in FSCTRL0 units (Fxtal/2^14). It is applied by the
+// synthesizer at its next calibration.
+void radio_set_freq_offset(int8_t offset)
+// ------------------------------------------------------------------------------------------------
+{
+    int i;
+
+    for (i=0; i<radio_nb_units; i++)
+    {
+        PI_CC_SPIWriteReg(radio_int_data[i].spi_parms, PI_CCxxx0_FSCTRL0, (uint8_t) offset);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Get the file descriptor that becomes readable when a block has been received by any module
+int radio_get_event_fd()
+// ------------------------------------------------------------------------------------------------
+{
+    return radio_event_fd;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Acknowledge the radio event once the received blocks are being processed
+void radio_clear_event()
+// ------------------------------------------------------------------------------------------------
+{
+    uint64_t count;
+
+    read(radio_event_fd, &count, sizeof(count));
+}
+
+// ------------------------------------------------------------------------------------------------
+// Get the number of packet bytes a block can carry
+uint8_t radio_get_block_payload(arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    return arguments->packet_length - block_header;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Get the time a full block takes on air in microseconds including preamble, sync word, CRC and
+// the delay between blocks
+uint32_t radio_get_block_time(radio_parms_t *radio_parms, arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t block_bytes = nb_preamble_bytes[arguments->preamble] + 4 + arguments->packet_length + 2;
+
+    return (uint32_t) (block_bytes * radio_get_byte_time(radio_parms)) + arguments->packet_delay * radio_int_data[0].wait_us;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Get the time the last block processed was received as seen by the packet interrupt
+void radio_get_rx_time(struct timeval *rx_time)
+// ------------------------------------------------------------------------------------------------
+{
+    *rx_time = rx_block_time;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Get the link address of the sender of the last block processed. 0 if blocks are not addressed.
+uint8_t radio_get_rx_source()
+// ------------------------------------------------------------------------------------------------
+{
+    return (link_address ? rx_block[block_src_index] : 0);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Get the time the last block was sent by a module as seen by the packet interrupt
+void radio_get_tx_time(spi_parms_t *spi_parms, struct timeval *tx_time)
+// ------------------------------------------------------------------------------------------------
+{
+    *tx_time = *((struct timeval *) &radio_unit(spi_parms)->tx_time);
+}
+
 // ------------------------------------------------------------------------------------------------
 // Wait for approximately an amount of 2-FSK symbols bytes
 void radio_wait_a_bit(uint32_t amount)
 // ------------------------------------------------------------------------------------------------
 {
-    usleep(amount * radio_int_data.wait_us);
+    usleep(amount * radio_int_data[0].wait_us);
 }
 
 // ------------------------------------------------------------------------------------------------
-// Wait for the reception or transmission to finish
-void radio_wait_free()
+// Wait for the reception or transmission of a module to finish
+void radio_wait_free(spi_parms_t *spi_parms)
 // ------------------------------------------------------------------------------------------------
 {
-    while((radio_int_data.packet_receive) || (radio_int_data.packet_send))
+    radio_int_data_t *int_data = radio_unit(spi_parms);
+
+    while((int_data->packet_receive) || (int_data->packet_send))
     {
         radio_wait_a_bit(4);
     }
@@ -1035,53 +1488,113 @@ void radio_wait_free()
 void radio_init_rx(spi_parms_t *spi_parms, arguments_t *arguments)
 // ------------------------------------------------------------------------------------------------
 {
-    blocks_received = radio_int_data.packet_rx_count;
-    radio_int_data.mode = RADIOMODE_RX;
-    radio_int_data.packet_receive = 0;    
-    radio_int_data.threshold_hits = 0;
+    radio_int_data_t *int_data = radio_unit(spi_parms);
+
+    if ((int_data->rx_continuous) && (int_data->mode == RADIOMODE_RX)) // kept ready by the interrupt handler
+    {
+        return;
+    }
+
+    int_data->mode = RADIOMODE_RX;
+    int_data->packet_receive = 0;    
+    int_data->threshold_hits = 0;
     radio_set_packet_length(spi_parms, arguments->packet_length);
     
     PI_CC_SPIWriteReg(spi_parms, PI_CCxxx0_IOCFG2, 0x00); // GDO2 output pin config RX mode
 }
 
 // ------------------------------------------------------------------------------------------------
-// Receive of a block
-uint8_t radio_receive_block(spi_parms_t *spi_parms, arguments_t *arguments, uint8_t *block, uint32_t *size, uint8_t *crc)
+// Receive of a block taken from the Rx ring
+uint8_t radio_receive_block(radio_int_data_t *int_data, arguments_t *arguments, uint8_t count, uint8_t *block, uint32_t *size, uint8_t *crc)
 // ------------------------------------------------------------------------------------------------
 {
     uint8_t block_countdown, block_size;
 
-    block_size = radio_int_data.rx_buf[0] - 1; // remove block countdown byte
-    block_countdown = radio_int_data.rx_buf[1];
+    block_size = rx_block[block_len_index] - (block_header - 1); // remove header bytes after length
+    block_countdown = rx_block[block_header - 1];
 
     if (arguments->variable_length)
     {
-        *crc = (radio_int_data.rx_buf[radio_int_data.rx_count - 1] & 0x80)>>7;
+        *crc = (rx_block[count - 1] & 0x80)>>7;
     }
     else
     {
-        *crc = (radio_int_data.rx_buf[arguments->packet_length + 1] & 0x80)>>7;
+        *crc = (rx_block[arguments->packet_length + 1] & 0x80)>>7;
+    }
+
+    link_rx_block((link_address ? rx_block[block_src_index] : 0), rx_block[count - 2], rx_block[count - 1]);
+
+    if (*crc)
+    {
+        afc_rx_block((link_address ? rx_block[block_src_index] : 0), rx_block_freqest);
+
+        if (block_hop_index)
+        {
+            hop_rx_timing(rx_block[block_hop_index], rx_block[block_hop_index + 1], count - 2);
+        }
     }
 
-    memcpy(block, (uint8_t *) &radio_int_data.rx_buf[2], block_size);
+    memcpy(block, &rx_block[block_header], block_size);
     *size += block_size;
 
-    verbprintf(1, "Rx: packet #%d:%d >%d\n", radio_int_data.packet_rx_count, block_countdown, *size);
-    print_received_packet(2);
+    verbprintf(1, "Rx: packet #%d:%d >%d\n", int_data->blocks_received, block_countdown, *size);
+    print_received_packet(int_data, count, 2);
 
     return block_countdown; // block countdown
 }
 
+// ------------------------------------------------------------------------------------------------
+// Receive of a link control block taken from the Rx ring
+void radio_receive_control(spi_parms_t *spi_parms, arguments_t *arguments, radio_int_data_t *int_data, uint8_t count)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t crc_lqi = rx_block[count - 1];
+
+    link_rx_block((link_address ? rx_block[block_src_index] : 0), rx_block[count - 2], crc_lqi);
+    verbprintf(1, "Rx: control block #%d\n", int_data->blocks_received);
+    print_block(4, rx_block, count);
+
+    if (crc_lqi & PI_CCxxx0_CRC_OK)
+    {
+        afc_rx_block((link_address ? rx_block[block_src_index] : 0), rx_block_freqest);
+
+        if (block_hop_index)
+        {
+            hop_rx_timing(rx_block[block_hop_index], rx_block[block_hop_index + 1], count - 2);
+        }
+
+        link_rx_control(&rx_block[block_header - 1], count - 2 - (block_header - 1));
+        packets_received++;
+    }
+    else
+    {
+        verbprintf(1, "RADIO: CRC error, aborting control block\n");
+    }
+
+    radio_init_rx(spi_parms, arguments); // init for new block to receive Rx
+}
+
 // ------------------------------------------------------------------------------------------------
 // Receive of a packet
 uint32_t radio_receive_packet(spi_parms_t *spi_parms, arguments_t *arguments, uint8_t *packet)
 // ------------------------------------------------------------------------------------------------
 {
-    uint8_t  crc, block_countdown, block_count = 0;
+    radio_int_data_t *int_data = radio_unit(spi_parms);
+    uint8_t  crc, count, block_countdown, block_count = 0;
     uint32_t packet_size = 0;
     uint32_t timeout, timeout_value = (arguments->packet_length < 32 ? 16 : arguments->packet_length / 2); // timeout value in bocks of 4 2-FSK bytes
 
-    if (blocks_received == radio_int_data.packet_rx_count) // no block received
+    if (int_data->blocks_dropped != int_data->blocks_dropped_seen) // blocks discarded by the chip since last time
+    {
+        if ((int_data->crc_autoflush) && (!int_data->addr_filter)) // else they may be blocks for other nodes
+        {
+            link_rx_dropped(int_data->blocks_dropped - int_data->blocks_dropped_seen);
+        }
+
+        int_data->blocks_dropped_seen = int_data->blocks_dropped;
+    }
+
+    if (int_data->blocks_received == int_data->packet_rx_count) // no block received
     {
         return 0;
     }
@@ -1089,7 +1602,21 @@ uint32_t radio_receive_packet(spi_parms_t *spi_parms, arguments_t *arguments, ui
     {
         do
         {
-            block_countdown = radio_receive_block(spi_parms, arguments, &packet[packet_size], &packet_size, &crc);
+            count = radio_take_block(int_data);
+
+            if (rx_block[block_len_index] == 0) // zero length is a link control block
+            {
+                radio_receive_control(spi_parms, arguments, int_data, count);
+
+                if (block_count) // in the middle of a packet
+                {
+                    verbprintf(1, "RADIO: control block within packet, aborting packet\n");
+                }
+
+                return 0;
+            }
+
+            block_countdown = radio_receive_block(int_data, arguments, count, &packet[packet_size], &packet_size, &crc);
             radio_init_rx(spi_parms, arguments); // init for new block to receive Rx
 
             if (!block_count)
@@ -1114,7 +1641,7 @@ uint32_t radio_receive_packet(spi_parms_t *spi_parms, arguments_t *arguments, ui
             timeout = timeout_value;
 
             // Wait for the next block to be received if any is expected
-            while((block_countdown > 0) && (blocks_received == radio_int_data.packet_rx_count) && (timeout))
+            while((block_countdown > 0) && (int_data->blocks_received == int_data->packet_rx_count) && (timeout))
             {
                 radio_wait_a_bit(4);
                 timeout--;
@@ -1135,43 +1662,110 @@ uint32_t radio_receive_packet(spi_parms_t *spi_parms, arguments_t *arguments, ui
 }
 
 // ------------------------------------------------------------------------------------------------
-// Transmission of a block
-void radio_send_block(spi_parms_t *spi_parms, uint8_t block_countdown)
+// Put the next block of a packet in the Tx buffer of a module. Returns the number of packet bytes
+// it carries.
+uint8_t radio_format_block(radio_int_data_t *int_data, arguments_t *arguments, uint8_t *block_start, uint32_t size, uint8_t block_countdown)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t block_payload = arguments->packet_length - block_header;
+    uint8_t block_length = (size > block_payload ? block_payload : size);
+
+    if (arguments->variable_length)
+    {
+        int_data->tx_count = block_length + block_header;
+    }
+    else
+    {
+        int_data->tx_count = arguments->packet_length; // same block size for all
+    }
+
+    memset((uint8_t *) int_data->tx_buf, 0, arguments->packet_length);
+    memcpy((uint8_t *) &int_data->tx_buf[block_header], block_start, block_length);
+    int_data->tx_buf[block_len_index] = block_length + block_header - 1; // size takes header bytes after it into account
+    int_data->tx_buf[block_header - 1] = block_countdown; 
+
+    if (link_address)
+    {
+        int_data->tx_buf[block_dest_index] = link_dest;
+        int_data->tx_buf[block_src_index] = link_address;
+    }
+
+    if (block_hop_index)
+    {
+        hop_tx_timing((uint8_t *) &int_data->tx_buf[block_hop_index], (uint8_t *) &int_data->tx_buf[block_hop_index + 1]);
+    }
+
+    return block_length;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Start transmission of the block in the Tx buffer of a module
+void radio_start_block(spi_parms_t *spi_parms, uint8_t block_countdown)
 // ------------------------------------------------------------------------------------------------
 {
+    radio_int_data_t *int_data = radio_unit(spi_parms);
     uint8_t  initial_tx_count; // Number of bytes to send in first batch
-    int      i, ret;
 
-    radio_int_data.mode = RADIOMODE_TX;
-    radio_int_data.packet_send = 0;
-    radio_int_data.threshold_hits = 0;
+    int_data->mode = RADIOMODE_TX;
+    int_data->packet_send = 0;
+    int_data->threshold_hits = 0;
 
-    radio_set_packet_length(spi_parms, radio_int_data.tx_count);
+    radio_set_packet_length(spi_parms, int_data->tx_count);
 
     PI_CC_SPIWriteReg(spi_parms, PI_CCxxx0_IOCFG2,   0x02); // GDO2 output pin config TX mode
 
     // Initial number of bytes to put in FIFO is either the number of bytes to send or the FIFO size whichever is
     // the smallest. Actual size blocks you need to take size minus one byte.
-    initial_tx_count = (radio_int_data.tx_count > PI_CCxxx0_FIFO_SIZE-1 ? PI_CCxxx0_FIFO_SIZE-1 : radio_int_data.tx_count);
+    initial_tx_count = (int_data->tx_count > PI_CCxxx0_FIFO_SIZE-1 ? PI_CCxxx0_FIFO_SIZE-1 : int_data->tx_count);
 
     // Initial fill of TX FIFO
-    PI_CC_SPIWriteBurstReg(spi_parms, PI_CCxxx0_TXFIFO, (uint8_t *) radio_int_data.tx_buf, initial_tx_count);
-    radio_int_data.byte_index = initial_tx_count;
-    radio_int_data.bytes_remaining = radio_int_data.tx_count - initial_tx_count;
-    blocks_sent = radio_int_data.packet_tx_count;
+    PI_CC_SPIWriteBurstReg(spi_parms, PI_CCxxx0_TXFIFO, (uint8_t *) int_data->tx_buf, initial_tx_count);
+    int_data->byte_index = initial_tx_count;
+    int_data->bytes_remaining = int_data->tx_count - initial_tx_count;
+    int_data->blocks_sent = int_data->packet_tx_count;
+
+    if (fast_turnaround) // Wait in FSTXON between blocks and go back to Rx after the last one
+    {
+        PI_CC_SPIWriteReg(spi_parms, PI_CCxxx0_MCSM1, (block_countdown > 0 ? 0x3D : 0x3F));
+    }
 
     PI_CC_SPIStrobe(spi_parms, PI_CCxxx0_STX); // Kick-off Tx
 
-    while (blocks_sent == radio_int_data.packet_tx_count)
+    if ((tx_request_time.tv_sec) && (verbose_level >= 2)) // first block of packet
+    {
+        wait_for_state(spi_parms, CCxxx0_STATE_TX, 1);
+        verbprintf(2, "RADIO: Rx to Tx turnaround %d us\n", elapsed_us(&tx_request_time));
+    }
+
+    tx_request_time.tv_sec = 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Wait for the end of transmission of a block started on a module
+void radio_end_block(spi_parms_t *spi_parms, uint8_t block_countdown)
+// ------------------------------------------------------------------------------------------------
+{
+    radio_int_data_t *int_data = radio_unit(spi_parms);
+
+    while (int_data->blocks_sent == int_data->packet_tx_count)
     {
         radio_wait_a_bit(4);
     }
 
-    verbprintf(1, "Tx: packet #%d:%d\n", radio_int_data.packet_tx_count, block_countdown);
-    print_block(4, (uint8_t *) radio_int_data.tx_buf, radio_int_data.tx_count);
+    verbprintf(1, "Tx: packet #%d:%d\n", int_data->packet_tx_count, block_countdown);
+    print_block(4, (uint8_t *) int_data->tx_buf, int_data->tx_count);
 
-    blocks_sent = radio_int_data.packet_tx_count;
-    verbprintf(2,"Tx: packet length %d, FIFO threshold was hit %d times\n", radio_int_data.tx_count, radio_int_data.threshold_hits);
+    int_data->blocks_sent = int_data->packet_tx_count;
+    verbprintf(2,"Tx: packet length %d, FIFO threshold was hit %d times\n", int_data->tx_count, int_data->threshold_hits);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Transmission of a block
+void radio_send_block(spi_parms_t *spi_parms, uint8_t block_countdown)
+// ------------------------------------------------------------------------------------------------
+{
+    radio_start_block(spi_parms, block_countdown);
+    radio_end_block(spi_parms, block_countdown);
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -1179,26 +1773,14 @@ void radio_send_block(spi_parms_t *spi_parms, uint8_t block_countdown)
 void radio_send_packet(spi_parms_t *spi_parms, arguments_t *arguments, uint8_t *packet, uint32_t size)
 // ------------------------------------------------------------------------------------------------
 {
-    int     block_countdown = size / (arguments->packet_length - 2);
+    int     block_countdown = size / radio_get_block_payload(arguments);
     uint8_t *block_start = packet;
     uint8_t block_length;
-
-    radio_int_data.tx_count = arguments->packet_length; // same block size for all
+    radio_int_data_t *int_data = radio_unit(spi_parms);
 
     while (block_countdown >= 0)
     {
-        block_length = (size > arguments->packet_length - 2 ? arguments->packet_length - 2 : size);
-
-        if (arguments->variable_length)
-        {
-            radio_int_data.tx_count = block_length + 2;
-        }
-
-        memset((uint8_t *) radio_int_data.tx_buf, 0, arguments->packet_length);
-        memcpy((uint8_t *) &radio_int_data.tx_buf[2], block_start, block_length);
-        radio_int_data.tx_buf[0] = block_length + 1; // size takes countdown counter into account
-        radio_int_data.tx_buf[1] = (uint8_t) block_countdown; 
-
+        block_length = radio_format_block(int_data, arguments, block_start, size, block_countdown);
         radio_send_block(spi_parms, block_countdown);
 
         if (block_countdown > 0)
@@ -1211,5 +1793,92 @@ void radio_send_packet(spi_parms_t *spi_parms, arguments_t *arguments, uint8_t *
         block_countdown--;
     }
 
+    gettimeofday(&tx_end_time, NULL);
+    packets_sent++;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Transmission of one packet on each of several modules at the same time. Blocks of the same rank
+// are started together on all modules and the next rank starts when all of them have been sent.
+void radio_send_parallel(spi_parms_t **spi_parms, int nb_units, arguments_t *arguments, uint8_t **packets, uint32_t *sizes)
+// ------------------------------------------------------------------------------------------------
+{
+    int      block_countdown[RADIO_MAX_UNITS], i, remaining;
+    uint32_t offset[RADIO_MAX_UNITS];
+
+    for (i=0; i<nb_units; i++)
+    {
+        block_countdown[i] = sizes[i] / radio_get_block_payload(arguments);
+        offset[i] = 0;
+    }
+
+    do
+    {
+        for (i=0; i<nb_units; i++) // load and kick-off the next block of each module
+        {
+            if (block_countdown[i] >= 0)
+            {
+                offset[i] += radio_format_block(radio_unit(spi_parms[i]), arguments, &packets[i][offset[i]], sizes[i] - offset[i], block_countdown[i]);
+                radio_start_block(spi_parms[i], block_countdown[i]);
+            }
+        }
+
+        remaining = 0;
+
+        for (i=0; i<nb_units; i++) // wait for all of them
+        {
+            if (block_countdown[i] >= 0)
+            {
+                radio_end_block(spi_parms[i], block_countdown[i]);
+                block_countdown[i]--;
+            }
+
+            if (block_countdown[i] >= 0)
+            {
+                remaining = 1;
+            }
+        }
+
+        if (remaining)
+        {
+            radio_wait_a_bit(arguments->packet_delay);
+        }
+    } while (remaining);
+
+    gettimeofday(&tx_end_time, NULL);
+    packets_sent += nb_units;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Transmission of a link control block. It is a single block with a zero length byte that
+// cannot occur for data blocks since they contain at least the block countdown.
+void radio_send_control(spi_parms_t *spi_parms, arguments_t *arguments, uint8_t *control, uint8_t size)
+// ------------------------------------------------------------------------------------------------
+{
+    radio_int_data_t *int_data = radio_unit(spi_parms);
+
+    if (size > arguments->packet_length - (block_header - 1))
+    {
+        size = arguments->packet_length - (block_header - 1);
+    }
+
+    int_data->tx_count = arguments->packet_length;
+    memset((uint8_t *) int_data->tx_buf, 0, arguments->packet_length);
+    memcpy((uint8_t *) &int_data->tx_buf[block_header - 1], control, size);
+    int_data->tx_buf[block_len_index] = 0;
+
+    if (link_address) // link control concerns all nodes
+    {
+        int_data->tx_buf[block_dest_index] = RADIO_ADDR_BROADCAST;
+        int_data->tx_buf[block_src_index] = link_address;
+    }
+
+    if (block_hop_index)
+    {
+        hop_tx_timing((uint8_t *) &int_data->tx_buf[block_hop_index], (uint8_t *) &int_data->tx_buf[block_hop_index + 1]);
+    }
+
+    radio_send_block(spi_parms, 0);
+    gettimeofday(&tx_end_time, NULL);
     packets_sent++;
-}
\ No newline at end of file
+}
@@ -10,8 +10,11 @@
 #ifndef _RADIO_H_
 #define _RADIO_H_
 
+#include <sys/time.h>
+
 #include "pi_cc_spi.h"
 #include "pi_cc_cc1100-cc2500.h"
+#include "modem.h"
 
 #define WPI_GDO0 5 // For Wiring Pi, 5 is GPIO_24 connected to GDO0
 #define WPI_GDO2 6 // For Wiring Pi, 6 is GPIO_25 connected to GDO2
@@ -20,6 +23,9 @@
 #define RX_FIFO_UNLOAD 59 // With the default FIFO thresholds selected this is the number of bytes to unload from the Rx FIFO
 
 #define RADIO_BUFSIZE (1<<16)   // 256 max radio block size times a maximum of 256 radio blocs
+#define RADIO_MAX_UNITS 4       // Maximum number of CC1101 modules
+#define RADIO_RX_RING   16      // Number of received blocks that can wait to be processed
+#define RADIO_ADDR_BROADCAST 0xFF // Link address of blocks for all nodes (0x00 is also accepted)
 
 typedef enum sync_word_e
 {
@@ -69,6 +75,8 @@ typedef struct radio_parms_s
     uint8_t            chanbw_e;      // Channel bandwidth exponent
     uint8_t            deviat_m;      // Deviation mantissa
     uint8_t            deviat_e;      // Deviation exponent
+    modem_regs_t       modem_regs;    // Modem register set
+    int                modem_profile; // Index of the modem register set in the table or -1 if computed
 } radio_parms_t;
 
 typedef enum radio_int_scheme_e 
@@ -99,41 +107,74 @@ typedef volatile struct radio_int_data_s
     uint8_t      tx_count;               // Number of bytes in Tx buffer
     uint8_t      rx_buf[PI_CCxxx0_PACKET_COUNT_SIZE+2]; // Rx buffer
     uint8_t      rx_count;               // Number of bytes in Rx buffer
+    uint8_t      rx_ring[RADIO_RX_RING][PI_CCxxx0_PACKET_COUNT_SIZE+2]; // Received blocks waiting to be processed
+    uint8_t      rx_ring_count[RADIO_RX_RING];       // Number of bytes of each received block
+    struct timeval rx_ring_time[RADIO_RX_RING];      // Time each block was received
+    uint8_t      rx_ring_freqest[RADIO_RX_RING];     // Frequency offset estimate of each block
+    uint32_t     blocks_received;        // Number of received blocks taken from the ring
+    uint32_t     blocks_sent;            // Number of sent blocks accounted for
     uint8_t      bytes_remaining;        // Bytes remaining to be read from or written to buffer (composite mode)
     uint8_t      byte_index;             // Current byte index in buffer
     uint8_t      packet_receive;         // Indicates reception of a packet is in progress
     uint8_t      packet_send;            // Indicates transmission of a packet is in progress
     uint32_t     wait_us;                // Unit wait time of approximately 4 2-FSK symbols
     uint8_t      threshold_hits;         // Number of times the FIFO threshold is hit during packet processing
+    struct timeval tx_time;              // Time the last block was sent
+    int          wpi_gdo0;               // Wiring Pi pin connected to GDO0
+    int          wpi_gdo2;               // Wiring Pi pin connected to GDO2
+    uint8_t      rx_only;                // Module is dedicated to reception (full duplex)
+    uint8_t      rx_continuous;          // Module stays in Rx between blocks (full duplex and bonding)
+    uint8_t      addr_filter;            // Blocks are filtered by address in the chip
+    uint8_t      crc_autoflush;          // Blocks with bad CRC are flushed by the chip
+    uint32_t     blocks_dropped;         // Number of blocks discarded by the chip (address or CRC)
+    uint32_t     blocks_dropped_seen;    // Number of discarded blocks already accounted for
+    uint8_t      read_freqest;           // Read the frequency offset estimate of each block (AFC)
 } radio_int_data_t;
 
 extern char     *state_names[];
-extern float    chanbw_limits[];
 extern uint32_t packets_sent;
 extern uint32_t packets_received;
-extern uint32_t blocks_sent;
-extern uint32_t blocks_received;
 
 void     init_radio_parms(radio_parms_t *radio_parms, arguments_t *arguments);
 int      init_radio(radio_parms_t *radio_parms,  spi_parms_t *spi_parms, arguments_t *arguments);
-void     init_radio_int(spi_parms_t *spi_parms, arguments_t *arguments);
+int      init_radio_unit(radio_parms_t *radio_parms, spi_parms_t *spi_parms, arguments_t *arguments, char *spi_device, uint32_t freq_hz);
+int      init_radio_duplex(radio_parms_t *radio_parms, spi_parms_t *spi_parms, arguments_t *arguments);
+int      init_radio_bonded(radio_parms_t *radio_parms, spi_parms_t *spi_parms, arguments_t *arguments, char *spi_device, int wpi_gdo0, int wpi_gdo2, uint8_t channel);
+spi_parms_t *radio_get_rx_unit(spi_parms_t *spi_parms);
+void     init_radio_int(arguments_t *arguments);
 void     radio_init_rx(spi_parms_t *spi_parms, arguments_t *arguments);
 void     radio_flush_fifos(spi_parms_t *spi_parms);
 
 void     radio_turn_idle(spi_parms_t *spi_parms);
 void     radio_turn_rx(spi_parms_t *spi_parms);
+uint8_t  radio_channel_clear(spi_parms_t *spi_parms);
+void     radio_prepare_tx(spi_parms_t *spi_parms);
+
+void     radio_set_modem(spi_parms_t *spi_parms, radio_parms_t *radio_parms, arguments_t *arguments);
+void     radio_write_modem(spi_parms_t *spi_parms, radio_parms_t *radio_parms, arguments_t *arguments);
 
 void     print_radio_parms(radio_parms_t *radio_parms);
 int      print_radio_status(spi_parms_t *spi_parms);
 
 int      radio_set_packet_length(spi_parms_t *spi_parms, uint8_t pkt_len);
 uint8_t  radio_get_packet_length(spi_parms_t *spi_parms);
+float    rssi_dbm(uint8_t rssi_dec);
 float    radio_get_rate(radio_parms_t *radio_parms);
 float    radio_get_byte_time(radio_parms_t *radio_parms);
+int      radio_get_event_fd();
+void     radio_clear_event();
+uint8_t  radio_get_block_payload(arguments_t *arguments);
+void     radio_set_freq_offset(int8_t offset);
+uint32_t radio_get_block_time(radio_parms_t *radio_parms, arguments_t *arguments);
+void     radio_get_rx_time(struct timeval *rx_time);
+uint8_t  radio_get_rx_source();
+void     radio_get_tx_time(spi_parms_t *spi_parms, struct timeval *tx_time);
 void     radio_wait_a_bit(uint32_t amount);
-void     radio_wait_free();
+void     radio_wait_free(spi_parms_t *spi_parms);
 
 void     radio_send_packet(spi_parms_t *spi_parms, arguments_t *arguments, uint8_t *packet, uint32_t size);
 uint32_t radio_receive_packet(spi_parms_t *spi_parms, arguments_t *arguments, uint8_t *packet);
+void     radio_send_parallel(spi_parms_t **spi_parms, int nb_units, arguments_t *arguments, uint8_t **packets, uint32_t *sizes);
+void     radio_send_control(spi_parms_t *spi_parms, arguments_t *arguments, uint8_t *control, uint8_t size);
 
 #endif
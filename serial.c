@@ -7,10 +7,15 @@
 /*                                                                            */
 /******************************************************************************/
 
+#define _GNU_SOURCE     // posix_openpt, grantpt, unlockpt, ptsname
+
 #include <fcntl.h>      // File control definitions
 #include <errno.h>      // Error number definitions
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "main.h"
 #include "serial.h"
@@ -108,11 +113,60 @@ speed_t get_serial_speed(uint32_t speed, uint32_t *speed_n)
 }
 
 // ------------------------------------------------------------------------------------------------
-// Init serial interface (TNC)
+// Create a pseudo terminal and publish its slave end with a symbolic link. The program talks to
+// the master end. The slave end is kept open so that the master is not hung up while the AX.25
+// stack is not attached. Returns the master file descriptor or -1 on error.
+static int open_pty(serial_t *serial_parameters, char *link_path)
+// ------------------------------------------------------------------------------------------------
+{
+    struct stat link_stat;
+    char *slave_path;
+    int  master;
+
+    master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+    if ((master < 0) || (grantpt(master) != 0) || (unlockpt(master) != 0) || (!(slave_path = ptsname(master))))
+    {
+        printf("Error %d creating pseudo terminal: %s\n", errno, strerror(errno));
+        return -1;
+    }
+
+    serial_parameters->pty_slave = open(slave_path, O_RDWR | O_NOCTTY);
+
+    if ((lstat(link_path, &link_stat) == 0) && (S_ISLNK(link_stat.st_mode))) // left over by a previous run
+    {
+        unlink(link_path);
+    }
+
+    if (symlink(slave_path, link_path) != 0)
+    {
+        printf("Error %d linking %s to %s: %s\n", errno, link_path, slave_path, strerror(errno));
+    }
+    else
+    {
+        serial_parameters->pty_link = strdup(link_path);
+    }
+
+    fprintf(stderr, "Pseudo terminal .....: %s -> %s\n", link_path, slave_path);
+    return master;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Init serial interface (TNC). Either the serial device or a built-in pseudo terminal.
 void set_serial_parameters(serial_t *serial_parameters, arguments_t *arguments)
 // ------------------------------------------------------------------------------------------------
 {
-    serial_parameters->SERIAL_TNC = open(arguments->serial_device, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    serial_parameters->pty_slave = -1;
+    serial_parameters->pty_link = 0;
+
+    if (arguments->pty_link)
+    {
+        serial_parameters->SERIAL_TNC = open_pty(serial_parameters, arguments->pty_link);
+    }
+    else
+    {
+        serial_parameters->SERIAL_TNC = open(arguments->serial_device, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    }
 
     memset (&serial_parameters->tty, 0, sizeof serial_parameters->tty);
 
@@ -168,3 +222,23 @@ int read_serial(serial_t *serial_parameters, char *buf, int buflen)
     return read(serial_parameters->SERIAL_TNC, buf, buflen);
 } 
 
+// ------------------------------------------------------------------------------------------------
+// Close serial interface. Removes the link to the built-in pseudo terminal.
+void close_serial(serial_t *serial_parameters)
+// ------------------------------------------------------------------------------------------------
+{
+    if (!serial_parameters->pty_link)
+    {
+        return;
+    }
+
+    unlink(serial_parameters->pty_link);
+    free(serial_parameters->pty_link);
+    serial_parameters->pty_link = 0;
+
+    if (serial_parameters->pty_slave >= 0)
+    {
+        close(serial_parameters->pty_slave);
+        serial_parameters->pty_slave = -1;
+    }
+}
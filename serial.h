@@ -18,11 +18,14 @@ typedef struct serial_s
     int SERIAL_TNC;
     struct termios tty;
     struct termios tty_old;
+    int  pty_slave;  // Slave end of the built-in pseudo terminal kept open. -1 if none
+    char *pty_link;  // Symbolic link to the slave end of the built-in pseudo terminal
 } serial_t;
 
 speed_t get_serial_speed(uint32_t speed, uint32_t *speed_n);
 void set_serial_parameters(serial_t *serial_parameters, arguments_t *arguments);
 int write_serial(serial_t *serial_parameters, char *msg, int msglen);
 int read_serial(serial_t *serial_parameters, char *buf, int buflen);
+void close_serial(serial_t *serial_parameters);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,367 @@
+/******************************************************************************/
+/* PiCC1101  - Radio serial link using CC1101 module and Raspberry-Pi         */
+/*                                                                            */
+/* Beacon synchronized TDMA                                                   */
+/*                                                                            */
+/* The coordinator (node 0) sends a beacon as a link control block at the     */
+/* start of each superframe. The beacon gives the number of slots and their   */
+/* duration. The superframe starts when the beacon ends: the coordinator      */
+/* takes the time its transmission completes and the other nodes the time    */
+/* its reception completes. Node k transmits only in slot k and only if the   */
+/* packet ends before the guard time at the end of the slot. Slot 0 belongs   */
+/* to the coordinator. Between beacons a node runs free on the superframe    */
+/* period measured from the beacons received or on the slots and the beacon  */
+/* airtime until it has measured it.                                          */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "tdma.h"
+#include "link.h"
+#include "util.h"
+
+static uint8_t        tdma_active;        // TDMA mode is engaged
+static uint8_t        tdma_coordinator;   // This node sends the beacons
+static uint8_t        tdma_node;          // Slot owned by this node
+static uint8_t        tdma_nb_slots;      // Number of slots in the superframe
+static uint32_t       tdma_slot_us;       // Slot duration in microseconds
+static uint16_t       tdma_superframe;    // Superframe number
+static uint8_t        tdma_synced;        // Superframe timing is known
+static struct timeval tdma_start;         // Start of the current superframe: end of its beacon
+static uint32_t       tdma_period_us;     // Superframe period measured from the beacons. Zero if not known.
+
+// === Static functions declarations ==============================================================
+
+static uint64_t tdma_elapsed_us(struct timeval *since);
+static uint32_t tdma_bytes(uint32_t time_us, radio_parms_t *radio_parms, arguments_t *arguments);
+static uint64_t tdma_period(radio_parms_t *radio_parms, arguments_t *arguments);
+
+// === Static functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Microseconds elapsed since given time
+uint64_t tdma_elapsed_us(struct timeval *since)
+// ------------------------------------------------------------------------------------------------
+{
+    struct timeval now, delta, start = *since; // subtraction alters its second operand
+
+    gettimeofday(&now, NULL);
+
+    if (timeval_subtract(&delta, &now, &start)) // negative
+    {
+        return 0;
+    }
+
+    return delta.tv_sec * 1000000ULL + delta.tv_usec;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Maximum packet size in bytes that can be sent in the given time. Only full blocks are counted.
+// One byte less than full blocks so that the block countdown does not add an empty block.
+uint32_t tdma_bytes(uint32_t time_us, radio_parms_t *radio_parms, arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t blocks = time_us / (radio_get_block_time(radio_parms, arguments) + TDMA_BLOCK_MARGIN_US);
+
+    if (blocks == 0)
+    {
+        return 0;
+    }
+
+    if (blocks > 256) // block countdown is one byte
+    {
+        blocks = 256;
+    }
+
+    return blocks * radio_get_block_payload(arguments) - 1;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Time from the start of a superframe to the start of the next one: the slots and the beacon.
+// Measured period if known and not shorter.
+uint64_t tdma_period(radio_parms_t *radio_parms, arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    uint64_t period = (uint64_t) tdma_nb_slots * tdma_slot_us + radio_get_block_time(radio_parms, arguments);
+
+    return (tdma_period_us > period ? tdma_period_us : period);
+}
+
+// === Public functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Initialize TDMA. The coordinator takes the schedule from the arguments, the other nodes wait
+// for a beacon. Returns 0 if there is no TDMA or the slots of the coordinator can hold a block.
+uint8_t tdma_init(radio_parms_t *radio_parms, arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    tdma_active = (arguments->tdma_slots > 0) || (arguments->tdma_node > 0);
+    tdma_coordinator = (arguments->tdma_node == 0);
+    tdma_node = arguments->tdma_node;
+    tdma_nb_slots = arguments->tdma_slots;
+    tdma_slot_us = arguments->tdma_slot_ms * 1000;
+    tdma_superframe = 0;
+    tdma_synced = 0;
+    tdma_period_us = 0;
+
+    if (!tdma_active)
+    {
+        return 0;
+    }
+
+    if (tdma_coordinator)
+    {
+        if (tdma_slot_capacity(radio_parms, arguments) == 0)
+        {
+            fprintf(stderr, "TDMA: slots of %d ms cannot hold a block with the %d ms guard time\n", tdma_slot_us / 1000, TDMA_GUARD_US / 1000);
+            return 1;
+        }
+
+        verbprintf(1, "TDMA: coordinator, %d slots of %d ms\n", tdma_nb_slots, tdma_slot_us / 1000);
+    }
+    else
+    {
+        verbprintf(1, "TDMA: node %d waiting for beacon\n", tdma_node);
+    }
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Returns 1 if the coordinator has to send the beacon of the next superframe
+uint8_t tdma_beacon_due()
+// ------------------------------------------------------------------------------------------------
+{
+    if ((!tdma_active) || (!tdma_coordinator))
+    {
+        return 0;
+    }
+
+    return (!tdma_synced) || (tdma_elapsed_us(&tdma_start) >= (uint64_t) tdma_nb_slots * tdma_slot_us);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Milliseconds until the coordinator has to send the next beacon. Zero if due now or if this node
+// does not send beacons.
+uint32_t tdma_beacon_wait_ms()
+// ------------------------------------------------------------------------------------------------
+{
+    uint64_t elapsed, period;
+
+    if ((!tdma_active) || (!tdma_coordinator) || (!tdma_synced))
+    {
+        return 0;
+    }
+
+    elapsed = tdma_elapsed_us(&tdma_start);
+    period = (uint64_t) tdma_nb_slots * tdma_slot_us;
+
+    return (elapsed >= period ? 0 : (period - elapsed) / 1000);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Send the beacon that starts a new superframe. Radio must be ready for transmission.
+// Beacon is control code, number of slots, slot duration in ms and superframe number (LSB first)
+void tdma_send_beacon(spi_parms_t *spi_parms, arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t  beacon[6];
+    uint32_t slot_ms = tdma_slot_us / 1000;
+
+    tdma_superframe++;
+
+    beacon[0] = LINK_CTL_TDMA_BEACON;
+    beacon[1] = tdma_nb_slots;
+    beacon[2] = slot_ms & 0xFF;
+    beacon[3] = (slot_ms >> 8) & 0xFF;
+    beacon[4] = tdma_superframe & 0xFF;
+    beacon[5] = (tdma_superframe >> 8) & 0xFF;
+
+    radio_send_control(spi_parms, arguments, beacon, sizeof(beacon));
+    radio_get_tx_time(spi_parms, &tdma_start);
+    tdma_synced = 1;
+
+    verbprintf(2, "TDMA: beacon #%d sent\n", tdma_superframe);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Synchronize on a beacon received from the coordinator. Beacon is given without control code.
+void tdma_rx_beacon(uint8_t *beacon, uint8_t size)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t        nb_slots;
+    uint32_t       slot_us;
+    uint16_t       superframe, nb_periods;
+    struct timeval previous = tdma_start;
+    uint64_t       interval;
+
+    if (!tdma_active)
+    {
+        return;
+    }
+
+    if (tdma_coordinator)
+    {
+        verbprintf(1, "TDMA: beacon from another coordinator ignored\n");
+        return;
+    }
+
+    if (size < 5)
+    {
+        verbprintf(1, "TDMA: invalid beacon\n");
+        return;
+    }
+
+    nb_slots = beacon[0];
+    slot_us = (beacon[1] + (beacon[2] << 8)) * 1000;
+
+    if ((nb_slots == 0) || (nb_slots > TDMA_MAX_SLOTS) || (slot_us == 0))
+    {
+        verbprintf(1, "TDMA: invalid beacon\n");
+        return;
+    }
+
+    radio_get_rx_time(&tdma_start);
+    superframe = beacon[3] + (beacon[4] << 8);
+    nb_periods = superframe - tdma_superframe;
+
+    if ((!tdma_synced) || (nb_slots != tdma_nb_slots) || (slot_us != tdma_slot_us))
+    {
+        verbprintf(1, "TDMA: synchronized on %d slots of %d ms\n", nb_slots, slot_us / 1000);
+        tdma_period_us = 0;
+
+        if (tdma_node >= nb_slots)
+        {
+            verbprintf(1, "TDMA: no slot %d in superframe, receive only\n", tdma_node);
+        }
+        else if (slot_us <= TDMA_GUARD_US)
+        {
+            verbprintf(1, "TDMA: slots of %d ms too short for the guard time, receive only\n", slot_us / 1000);
+        }
+    }
+    else if ((nb_periods > 0) && (nb_periods <= TDMA_LOST_BEACONS)) // measure period on consecutive beacons
+    {
+        interval = tdma_elapsed_us(&previous) - tdma_elapsed_us(&tdma_start);
+        tdma_period_us = interval / nb_periods;
+        verbprintf(3, "TDMA: superframe period %d us\n", tdma_period_us);
+    }
+
+    tdma_superframe = superframe;
+
+    tdma_nb_slots = nb_slots;
+    tdma_slot_us = slot_us;
+    tdma_synced = 1;
+
+    verbprintf(2, "TDMA: beacon #%d received\n", tdma_superframe);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Maximum packet size in bytes that can be sent now after the given delay. Zero if this is not the
+// slot of this node or if the time left in the slot is too short. Without TDMA the radio buffer
+// size.
+uint32_t tdma_tx_budget(radio_parms_t *radio_parms, arguments_t *arguments, uint32_t delay_us)
+// ------------------------------------------------------------------------------------------------
+{
+    uint64_t elapsed, period, position;
+    uint32_t slot, remaining;
+
+    if (!tdma_active)
+    {
+        return RADIO_BUFSIZE;
+    }
+
+    if (!tdma_synced)
+    {
+        return 0;
+    }
+
+    elapsed = tdma_elapsed_us(&tdma_start);
+
+    if (tdma_coordinator)
+    {
+        if (elapsed >= (uint64_t) tdma_nb_slots * tdma_slot_us) // beacon first
+        {
+            return 0;
+        }
+    }
+    else if (elapsed >= TDMA_LOST_BEACONS * tdma_period(radio_parms, arguments)) // free running for a few superframes only
+    {
+        verbprintf(1, "TDMA: beacon lost\n");
+        tdma_synced = 0;
+        return 0;
+    }
+
+    period = tdma_period(radio_parms, arguments);
+    position = elapsed % period;
+    slot = position / tdma_slot_us; // beyond the last slot while the next beacon is on air
+
+    if (slot != tdma_node)
+    {
+        return 0;
+    }
+
+    remaining = (slot + 1) * tdma_slot_us - position;
+
+    if (remaining <= TDMA_GUARD_US + delay_us)
+    {
+        return 0;
+    }
+
+    return tdma_bytes(remaining - TDMA_GUARD_US - delay_us, radio_parms, arguments);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Microseconds until this node may try to transmit again after the given delay: the delay if it
+// ends in the slot of this node before the guard time else the start of its next slot. Without a
+// delay the current slot is taken as used up. Zero if the schedule is not known or there is no
+// slot for this node. Without TDMA the delay.
+uint32_t tdma_slot_wait_us(radio_parms_t *radio_parms, arguments_t *arguments, uint32_t delay_us)
+// ------------------------------------------------------------------------------------------------
+{
+    uint64_t period, position, slot_start;
+
+    if (!tdma_active)
+    {
+        return delay_us;
+    }
+
+    if ((!tdma_synced) || (tdma_node >= tdma_nb_slots))
+    {
+        return 0;
+    }
+
+    period = tdma_period(radio_parms, arguments);
+    position = (tdma_elapsed_us(&tdma_start) + delay_us) % period;
+    slot_start = (uint64_t) tdma_node * tdma_slot_us;
+
+    if ((delay_us) && (position >= slot_start) && (position + TDMA_GUARD_US < slot_start + tdma_slot_us))
+    {
+        return delay_us;
+    }
+
+    return delay_us + (position < slot_start ? slot_start - position : period - position + slot_start);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Maximum packet size in bytes that can be sent in a full slot. Frames larger than this can never
+// be sent. Zero if the slot is not longer than the guard time. Without TDMA the radio buffer size.
+uint32_t tdma_slot_capacity(radio_parms_t *radio_parms, arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    if (!tdma_active)
+    {
+        return RADIO_BUFSIZE;
+    }
+
+    if (tdma_slot_us <= TDMA_GUARD_US)
+    {
+        return 0;
+    }
+
+    return tdma_bytes(tdma_slot_us - TDMA_GUARD_US, radio_parms, arguments);
+}
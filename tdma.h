@@ -0,0 +1,33 @@
+/******************************************************************************/
+/* PiCC1101  - Radio serial link using CC1101 module and Raspberry-Pi         */
+/*                                                                            */
+/* Beacon synchronized TDMA                                                   */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef _TDMA_H_
+#define _TDMA_H_
+
+#include <stdint.h>
+
+#include "main.h"
+#include "pi_cc_spi.h"
+#include "radio.h"
+
+#define TDMA_MAX_SLOTS          64   // Maximum number of slots in a superframe
+#define TDMA_GUARD_US         2000   // Guard time at the end of a slot in microseconds
+#define TDMA_BLOCK_MARGIN_US  1000   // Time allowed per block for calibration and FIFO loading in microseconds
+#define TDMA_LOST_BEACONS        4   // Number of missed beacons before synchronization is lost
+
+uint8_t  tdma_init(radio_parms_t *radio_parms, arguments_t *arguments);
+uint8_t  tdma_beacon_due();
+uint32_t tdma_beacon_wait_ms();
+void     tdma_send_beacon(spi_parms_t *spi_parms, arguments_t *arguments);
+void     tdma_rx_beacon(uint8_t *beacon, uint8_t size);
+uint32_t tdma_tx_budget(radio_parms_t *radio_parms, arguments_t *arguments, uint32_t delay_us);
+uint32_t tdma_slot_wait_us(radio_parms_t *radio_parms, arguments_t *arguments, uint32_t delay_us);
+uint32_t tdma_slot_capacity(radio_parms_t *radio_parms, arguments_t *arguments);
+
+#endif
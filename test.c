@@ -12,9 +12,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/time.h>
 
 #include "test.h"
 #include "radio.h"
+#include "kiss.h"
+#include "kfq.h"
+#include "kesc.h"
 #include "util.h"
 
 // === Public functions ===========================================================================
@@ -24,14 +28,14 @@
 int radio_transmit_test_int(spi_parms_t *spi_parms, arguments_t *arguments)
 // ------------------------------------------------------------------------------------------------
 {
-    init_radio_int(spi_parms, arguments);
+    init_radio_int(arguments);
     PI_CC_SPIStrobe(spi_parms, PI_CCxxx0_SFTX); // Flush Tx FIFO
     
     verbprintf(0, "Sending %d test packets of size %d\n", arguments->repetition, arguments->packet_length);
 
     while(packets_sent < arguments->repetition)
     {
-        radio_wait_free(); // make sure no radio operation is in progress
+        radio_wait_free(spi_parms); // make sure no radio operation is in progress
         radio_send_packet(spi_parms, arguments, arguments->test_phrase, strlen(arguments->test_phrase));
         radio_wait_a_bit(arguments->packet_length / 4);
     } 
@@ -44,7 +48,7 @@ int radio_receive_test_int(spi_parms_t *spi_parms, arguments_t *arguments)
 {
     uint8_t nb_rx, rx_bytes[RADIO_BUFSIZE];
 
-    init_radio_int(spi_parms, arguments);
+    init_radio_int(arguments);
     PI_CC_SPIStrobe(spi_parms, PI_CCxxx0_SFRX); // Flush Rx FIFO
 
     verbprintf(0, "Starting...\n");
@@ -56,7 +60,7 @@ int radio_receive_test_int(spi_parms_t *spi_parms, arguments_t *arguments)
 
         do
         {
-            radio_wait_free(); // make sure no radio operation is in progress
+            radio_wait_free(spi_parms); // make sure no radio operation is in progress
             nb_rx = radio_receive_packet(spi_parms, arguments, rx_bytes);
         } while(nb_rx == 0);
 
@@ -76,7 +80,7 @@ void radio_test_echo(spi_parms_t *spi_parms, radio_parms_t *radio_parms, argumen
     uint32_t timeout_value, timeout;
     struct timeval tdelay, tstart, tstop;
 
-    init_radio_int(spi_parms, arguments);
+    init_radio_int(arguments);
     radio_flush_fifos(spi_parms);
 
     timeout_value = (uint32_t) (arguments->packet_length * 10 * radio_get_byte_time(radio_parms));
@@ -108,7 +112,7 @@ void radio_test_echo(spi_parms_t *spi_parms, radio_parms_t *radio_parms, argumen
             {
                 verbprintf(0, "Sending #%d\n", packets_sent);
 
-                radio_wait_free(); // make sure no radio operation is in progress
+                radio_wait_free(spi_parms); // make sure no radio operation is in progress
                 radio_send_packet(spi_parms, arguments, rtx_bytes, nb_bytes);
                 radio_wait_a_bit(4);
                 timeout = timeout_value; // arm Rx timeout
@@ -140,7 +144,7 @@ void radio_test_echo(spi_parms_t *spi_parms, radio_parms_t *radio_parms, argumen
 
                 do
                 {
-                    radio_wait_free(); // make sure no radio operation is in progress
+                    radio_wait_free(spi_parms); // make sure no radio operation is in progress
                     nb_bytes = radio_receive_packet(spi_parms, arguments, rtx_bytes);
                     radio_wait_a_bit(4);
 
@@ -318,3 +322,69 @@ int radio_receive_test(spi_parms_t *spi_parms, arguments_t *arguments)
 
     verbprintf(0, "Done\n");
 }
+
+// ------------------------------------------------------------------------------------------------
+// KISS escape benchmark. Escapes and parses back a binary and a text frame with the scalar and the
+// SIMD escape scanning and prints the throughput of each. No radio is used.
+void kiss_test_benchmark(arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    static kfq_t   queue;
+    static uint8_t frame[TEST_BENCH_FRAME], escaped[2*TEST_BENCH_FRAME+2];
+    static const char *kind_names[] = {"binary", "text"};
+    const char *impl_name;
+    uint32_t   iterations = TEST_BENCH_ITERATIONS * arguments->repetition, i, us_escape, us_parse, parsed_size;
+    uint8_t    kind, simd, *parsed;
+    size_t     size;
+    struct timeval tstart, tstop, tdelay;
+
+    for (kind=0; kind<2; kind++)
+    {
+        for (i=0; i<TEST_BENCH_FRAME; i++) // binary frames have about 1 byte in 128 to escape
+        {
+            frame[i] = (kind ? "the quick brown fox jumps over the lazy dog\n"[i % 44] : rand() & 0xFF);
+        }
+
+        for (simd=0; simd<2; simd++)
+        {
+            impl_name = kesc_init(simd);
+
+            gettimeofday(&tstart, NULL);
+
+            for (i=0; i<iterations; i++)
+            {
+                size = TEST_BENCH_FRAME;
+                kiss_unpack(escaped, frame, &size);
+            }
+
+            gettimeofday(&tstop, NULL);
+            timeval_subtract(&tdelay, &tstop, &tstart);
+            us_escape = ts_us(&tdelay);
+
+            gettimeofday(&tstart, NULL);
+
+            for (i=0; i<iterations; i++)
+            {
+                kfq_init(&queue);
+                kfq_parse(&queue, escaped, size, NULL);
+            }
+
+            gettimeofday(&tstop, NULL);
+            timeval_subtract(&tdelay, &tstop, &tstart);
+            us_parse = ts_us(&tdelay);
+
+            parsed = kfq_peek(&queue, &parsed_size);
+
+            if ((!parsed) || (parsed_size != TEST_BENCH_FRAME) || (memcmp(parsed, frame, TEST_BENCH_FRAME)))
+            {
+                verbprintf(0, "%s: frame not restored\n", impl_name);
+            }
+
+            verbprintf(0, "%-6s %-6s escape: %8.1f MB/s unescape: %8.1f MB/s\n", kind_names[kind], impl_name,
+                iterations * (float) TEST_BENCH_FRAME / (us_escape ? us_escape : 1),
+                iterations * (float) TEST_BENCH_FRAME / (us_parse ? us_parse : 1));
+        }
+    }
+
+    kesc_init(1);
+}
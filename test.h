@@ -14,6 +14,9 @@
 #include "pi_cc_spi.h"
 #include "radio.h"
 
+#define TEST_BENCH_FRAME      4096 // Size of the frame escaped and parsed back by the KISS benchmark
+#define TEST_BENCH_ITERATIONS 4096 // Number of times it is done for each implementation times the repetition factor
+
 int  radio_transmit_test_int(spi_parms_t *spi_parms, arguments_t *arguments);
 int  radio_receive_test_int(spi_parms_t *spi_parms, arguments_t *arguments);
 void radio_test_echo(spi_parms_t *spi_parms, radio_parms_t *radio_parms, arguments_t *arguments, uint8_t active);
@@ -21,4 +24,6 @@ void radio_test_echo(spi_parms_t *spi_parms, radio_parms_t *radio_parms, argumen
 int radio_transmit_test(spi_parms_t *spi_parms, arguments_t *arguments);
 int radio_receive_test(spi_parms_t *spi_parms, arguments_t *arguments);
 
+void kiss_test_benchmark(arguments_t *arguments);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,198 @@
+/******************************************************************************/
+/* PiCC1101  - Radio serial link using CC1101 module and Raspberry-Pi         */
+/*                                                                            */
+/* IP packets through a TUN network interface                                 */
+/*                                                                            */
+/* The program creates the network interface itself and carries IP packets   */
+/* over the radio link without AX.25. On the link a packet is a frame whose   */
+/* only header is a KISS type byte with the TUN_KISS_CMD command code. The    */
+/* AX.25 kernel modules, kissattach and the pseudo terminal are not needed.   */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <net/if.h>
+#include <linux/if_tun.h>
+
+#include "tun.h"
+#include "util.h"
+
+static int     tun_fd = -1;
+static int     tun_epoll_fd;
+static uint8_t tun_paused;                       // Interface not polled while the Tx queue is full
+static uint8_t tun_buffer[TUN_MTU_MAX + 1];      // Type byte and packet
+
+// === Static functions declarations ==============================================================
+
+static int  tun_open(char *name, uint32_t mtu);
+static void tun_poll(uint8_t paused);
+
+// === Static functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Create the interface, set its MTU and bring it up. Addresses and routes are left to the
+// system configuration. Returns the file descriptor or -1 on error.
+int tun_open(char *name, uint32_t mtu)
+// ------------------------------------------------------------------------------------------------
+{
+    struct ifreq ifr;
+    int fd, sock;
+
+    if ((fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK)) < 0)
+    {
+        fprintf(stderr, "TUN: cannot open /dev/net/tun: %s\n", strerror(errno));
+        return -1;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_flags = IFF_TUN | IFF_NO_PI; // bare IP packets
+    strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+
+    if (ioctl(fd, TUNSETIFF, &ifr) < 0)
+    {
+        fprintf(stderr, "TUN: cannot create interface %s: %s\n", name, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) >= 0)
+    {
+        ifr.ifr_mtu = mtu;
+
+        if (ioctl(sock, SIOCSIFMTU, &ifr) < 0)
+        {
+            fprintf(stderr, "TUN: cannot set MTU of %s to %d: %s\n", ifr.ifr_name, mtu, strerror(errno));
+        }
+
+        if ((ioctl(sock, SIOCGIFFLAGS, &ifr) == 0) && (!(ifr.ifr_flags & IFF_UP)))
+        {
+            ifr.ifr_flags |= IFF_UP;
+            ioctl(sock, SIOCSIFFLAGS, &ifr);
+        }
+
+        close(sock);
+    }
+
+    verbprintf(1, "TUN: interface %s up with MTU %d\n", ifr.ifr_name, mtu);
+    return fd;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Stop or resume polling the interface
+void tun_poll(uint8_t paused)
+// ------------------------------------------------------------------------------------------------
+{
+    struct epoll_event event;
+
+    if (paused == tun_paused)
+    {
+        return;
+    }
+
+    memset(&event, 0, sizeof(event));
+    event.events = (paused ? 0 : EPOLLIN);
+    event.data.fd = tun_fd;
+    epoll_ctl(tun_epoll_fd, EPOLL_CTL_MOD, tun_fd, &event);
+    tun_paused = paused;
+}
+
+// === Public functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Create the interface and add it to the event loop. Returns 0 if there is no interface or it is
+// up.
+uint8_t tun_init(arguments_t *arguments, int epoll_fd)
+// ------------------------------------------------------------------------------------------------
+{
+    struct epoll_event event;
+
+    tun_epoll_fd = epoll_fd;
+    tun_paused = 0;
+
+    if (!arguments->tun_name)
+    {
+        return 0;
+    }
+
+    if ((arguments->tun_mtu < TUN_MTU_MIN) || (arguments->tun_mtu > TUN_MTU_MAX))
+    {
+        fprintf(stderr, "TUN: MTU must be between %d and %d\n", TUN_MTU_MIN, TUN_MTU_MAX);
+        return 1;
+    }
+
+    if ((tun_fd = tun_open(arguments->tun_name, arguments->tun_mtu)) < 0)
+    {
+        return 1;
+    }
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = tun_fd;
+    epoll_ctl(tun_epoll_fd, EPOLL_CTL_ADD, tun_fd, &event);
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Returns 1 if IP packets go through the network interface
+uint8_t tun_active()
+// ------------------------------------------------------------------------------------------------
+{
+    return (tun_fd >= 0);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Queue the packets sent to the interface as frames. Packets are left in the interface queue
+// while there is no room for a packet of the largest size. Returns the number of packets queued.
+uint32_t tun_receive(kfq_t *intake)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t nb_packets = 0, room;
+    int      size;
+
+    if (tun_fd < 0)
+    {
+        return 0;
+    }
+
+    while (((room = kfq_room(intake)) > TUN_MTU_MAX) && (nb_packets < TUN_MAX_READS))
+    {
+        if ((size = read(tun_fd, &tun_buffer[1], TUN_MTU_MAX)) <= 0)
+        {
+            break;
+        }
+
+        tun_buffer[0] = TUN_KISS_CMD;
+
+        if (kfq_append(intake, tun_buffer, size + 1))
+        {
+            verbprintf(1, "TUN: no room for packet of %d bytes, dropped\n", size);
+            break;
+        }
+
+        nb_packets++;
+    }
+
+    tun_poll(kfq_room(intake) <= TUN_MTU_MAX);
+    return nb_packets;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Give a packet received on the radio link to the interface
+void tun_send(uint8_t *packet, uint32_t size)
+// ------------------------------------------------------------------------------------------------
+{
+    if (write(tun_fd, packet, size) < 0)
+    {
+        verbprintf(1, "TUN: packet of %d bytes not taken by the interface: %s\n", size, strerror(errno));
+    }
+}
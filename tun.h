@@ -0,0 +1,29 @@
+/******************************************************************************/
+/* PiCC1101  - Radio serial link using CC1101 module and Raspberry-Pi         */
+/*                                                                            */
+/* IP packets through a TUN network interface                                 */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef _TUN_H_
+#define _TUN_H_
+
+#include <stdint.h>
+
+#include "main.h"
+#include "kfq.h"
+
+#define TUN_KISS_CMD     0x0D   // KISS command code marking an IP packet on the radio link
+#define TUN_MTU_DEFAULT  8192   // Default MTU of the interface
+#define TUN_MTU_MIN        68   // Smallest MTU allowed for IPv4
+#define TUN_MTU_MAX     60000   // Largest MTU: a packet must fit in a superframe
+#define TUN_MAX_READS      64   // Packets read from the interface at each wake up at most
+
+uint8_t  tun_init(arguments_t *arguments, int epoll_fd);
+uint8_t  tun_active();
+uint32_t tun_receive(kfq_t *intake);
+void     tun_send(uint8_t *packet, uint32_t size);
+
+#endif
@@ -0,0 +1,512 @@
+/******************************************************************************/
+/* PiCC1101  - Radio serial link using CC1101 module and Raspberry-Pi         */
+/*                                                                            */
+/* Tx priority queues                                                         */
+/*                                                                            */
+/* Frames taken from the serial link are sorted in four classes: AX.25        */
+/* supervisory and unnumbered frames, TCP pure ACKs, small frames and bulk.   */
+/* The first two classes are served in strict priority. Small and bulk frames */
+/* share what is left by deficit round robin with more weight for small ones  */
+/* so that bulk is never starved. Frames of an AX.25 connection must stay in  */
+/* order since each carries the receive sequence number: while a connection   */
+/* has frames queued its next frames go to the same class.                    */
+/* TCP ACKs in UI frames can also be thinned: an ACK that acknowledges more   */
+/* data than an ACK of the same flow still queued takes its place.            */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#include <string.h>
+
+#include "txq.h"
+#include "axc.h"
+#include "tun.h"
+#include "util.h"
+
+static kfq_t       txq_queues[TXQ_NB_CLASSES];
+static txq_link_t  txq_links[TXQ_MAX_LINKS];
+static uint32_t    txq_untracked;                 // Connection frames queued while no link entry was free
+static uint32_t    txq_queued_bytes;              // Size of all frames queued
+static uint8_t     txq_enabled;                   // Frames are classified else all go to bulk in order
+static txq_ack_t   txq_acks[TXQ_MAX_ACKS];        // Queued ACKs that can be replaced
+static uint32_t    txq_ack_next;                  // Entry replaced when all are in use
+static uint8_t     txq_thinning;                  // Thin TCP ACKs
+static uint32_t    txq_nb_acks;                   // TCP ACKs in UI frames seen
+static uint32_t    txq_nb_thinned;                // TCP ACKs replaced by a later one
+static txq_class_t txq_selected;                  // Class of the frame returned by the last peek
+static txq_class_t txq_drr;                       // DRR class being served
+static int32_t     txq_deficit[TXQ_NB_CLASSES];   // DRR credit in bytes
+static const uint32_t txq_weights[TXQ_NB_CLASSES] = {0, 0, 4, 1};
+
+// === Static functions declarations ==============================================================
+
+static uint8_t     txq_tcp_ack(uint8_t *ip, uint32_t size);
+static uint32_t    txq_control_offset(uint8_t *frame, uint32_t size);
+static uint32_t    txq_ui_ack(uint8_t *frame, uint32_t size);
+static uint8_t     txq_thin(uint8_t *frame, uint32_t size);
+static void        txq_remember_ack(uint8_t *frame, uint32_t size);
+static uint8_t     txq_inspect(uint8_t *frame, uint32_t size, uint8_t *key, txq_class_t *class);
+static int         txq_find_link(uint8_t *key);
+static int         txq_free_link();
+
+// === Static functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Returns 1 if the IPv4 packet is a TCP segment without data and without SYN, FIN or RST
+uint8_t txq_tcp_ack(uint8_t *ip, uint32_t size)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t ip_header, tcp_header, total;
+
+    if ((size < 20) || ((ip[0] >> 4) != 4) || (ip[9] != 6)) // IPv4 and TCP
+    {
+        return 0;
+    }
+
+    ip_header = (ip[0] & 0x0F) * 4;
+    total = (ip[2] << 8) + ip[3];
+
+    if ((ip_header < 20) || (total > size) || (total < ip_header + 20) || ((ip[6] & 0x1F) || ip[7])) // not first fragment
+    {
+        return 0;
+    }
+
+    tcp_header = (ip[ip_header + 12] >> 4) * 4;
+
+    if (total != ip_header + tcp_header) // carries data
+    {
+        return 0;
+    }
+
+    return ((ip[ip_header + 13] & 0x10) && !(ip[ip_header + 13] & 0x07)); // ACK and no SYN, FIN, RST
+}
+
+// ------------------------------------------------------------------------------------------------
+// Offset of the AX.25 control byte in an unescaped KISS data frame or 0 if it is not AX.25. The
+// last address has the extension bit set.
+uint32_t txq_control_offset(uint8_t *frame, uint32_t size)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t nb_addr;
+
+    for (nb_addr = 1; nb_addr <= AXC_MAX_ADDR; nb_addr++)
+    {
+        if (1 + nb_addr * AXC_ADDR_LEN >= size) // no room for control byte
+        {
+            return 0;
+        }
+
+        if (frame[nb_addr * AXC_ADDR_LEN] & 0x01)
+        {
+            break;
+        }
+    }
+
+    if ((nb_addr < 2) || (nb_addr > AXC_MAX_ADDR))
+    {
+        return 0;
+    }
+
+    return 1 + nb_addr * AXC_ADDR_LEN;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Offset of the IP header if the frame is a UI frame or an IP packet of the network interface
+// carrying a TCP pure ACK else 0
+uint32_t txq_ui_ack(uint8_t *frame, uint32_t size)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t control;
+
+    if ((frame[0] & 0x0F) == TUN_KISS_CMD)
+    {
+        return (txq_tcp_ack(&frame[1], size - 1) ? 1 : 0);
+    }
+
+    control = txq_control_offset(frame, size);
+
+    if ((control == 0) || (control + 2 >= size) || ((frame[control] & 0xEF) != 0x03) || (frame[control + 1] != 0xCC))
+    {
+        return 0;
+    }
+
+    return (txq_tcp_ack(&frame[control + 2], size - control - 2) ? control + 2 : 0);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Replace a queued ACK of the same flow with this one if it acknowledges more data. Both frames
+// must be the same size with the same AX.25 header, addresses, ports and flags. Duplicate ACKs
+// are kept as they trigger fast retransmit. Returns 1 if the frame took the place of a queued one.
+uint8_t txq_thin(uint8_t *frame, uint32_t size)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t ip, tcp, ack, old_ack;
+    uint8_t  *old;
+    int      i;
+
+    if (!(ip = txq_ui_ack(frame, size)))
+    {
+        return 0;
+    }
+
+    txq_nb_acks++;
+    tcp = ip + (frame[ip] & 0x0F) * 4;
+    ack = (frame[tcp+8] << 24) + (frame[tcp+9] << 16) + (frame[tcp+10] << 8) + frame[tcp+11];
+
+    for (i=0; i<TXQ_MAX_ACKS; i++)
+    {
+        old = txq_acks[i].frame;
+
+        if ((!old) || (txq_acks[i].size != size)
+            || (memcmp(old, frame, ip + 1))                  // KISS type byte, AX.25 header and IP header length
+            || (memcmp(&old[ip+12], &frame[ip+12], 8))       // IP addresses
+            || (memcmp(&old[tcp], &frame[tcp], 4))           // TCP ports
+            || (old[tcp+13] != frame[tcp+13]))               // TCP flags
+        {
+            continue;
+        }
+
+        old_ack = (old[tcp+8] << 24) + (old[tcp+9] << 16) + (old[tcp+10] << 8) + old[tcp+11];
+
+        if ((int32_t) (ack - old_ack) <= 0) // duplicate or older
+        {
+            continue;
+        }
+
+        memcpy(old, frame, size);
+        txq_nb_thinned++;
+        verbprintf(2, "TXQ: TCP ACK replaced by a later one, %d of %d ACKs thinned\n", txq_nb_thinned, txq_nb_acks);
+        return 1;
+    }
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Keep track of a TCP ACK just queued so that a later one can replace it
+void txq_remember_ack(uint8_t *frame, uint32_t size)
+// ------------------------------------------------------------------------------------------------
+{
+    int i;
+
+    for (i=0; i<TXQ_MAX_ACKS; i++)
+    {
+        if (!txq_acks[i].frame)
+        {
+            break;
+        }
+    }
+
+    if (i == TXQ_MAX_ACKS) // forget the oldest in turn
+    {
+        i = txq_ack_next;
+        txq_ack_next = (txq_ack_next + 1) % TXQ_MAX_ACKS;
+    }
+
+    txq_acks[i].frame = frame;
+    txq_acks[i].size = size;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Classify an unescaped KISS data frame. Returns 1 if it belongs to an AX.25 connection in which
+// case the key of the connection is set.
+uint8_t txq_inspect(uint8_t *frame, uint32_t size, uint8_t *key, txq_class_t *class)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t control = txq_control_offset(frame, size), info = control + 2; // after control and PID
+    uint8_t  pid = (info <= size ? frame[info - 1] : 0);
+
+    *class = (size <= TXQ_SMALL_FRAME ? TXQ_INTERACTIVE : TXQ_BULK);
+
+    if ((frame[0] & 0x0F) == TUN_KISS_CMD) // IP packet of the network interface
+    {
+        if (txq_tcp_ack(&frame[1], size - 1))
+        {
+            *class = TXQ_ACK;
+        }
+
+        return 0;
+    }
+
+    if (control == 0) // not AX.25
+    {
+        return 0;
+    }
+
+    if (((frame[control] & 0x01) == 0) || ((frame[control] & 0xEF) == 0x03)) // I or UI frame
+    {
+        if ((pid == 0xCC) && (txq_tcp_ack(&frame[info], size - info)))
+        {
+            *class = TXQ_ACK;
+        }
+        else if (((frame[control] & 0x01) == 1) && (pid != 0xCC) && (size <= TXQ_SMALL_FRAME)) // UI not carrying IP
+        {
+            *class = TXQ_CONTROL;
+        }
+
+        if ((frame[control] & 0x01) == 1) // UI is connectionless
+        {
+            return 0;
+        }
+    }
+    else // S or U frame other than UI
+    {
+        *class = TXQ_CONTROL;
+    }
+
+    key[0] = frame[0] >> 4;
+    memcpy(&key[1], &frame[1], 2*AXC_ADDR_LEN);
+    key[AXC_ADDR_LEN] &= 0x7E;
+    key[2*AXC_ADDR_LEN] &= 0x7E;
+
+    return 1;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Look up a connection with frames queued. Returns the index or -1 if not found
+int txq_find_link(uint8_t *key)
+// ------------------------------------------------------------------------------------------------
+{
+    int i;
+
+    for (i=0; i<TXQ_MAX_LINKS; i++)
+    {
+        if ((txq_links[i].count) && (memcmp(txq_links[i].key, key, TXQ_KEY_LEN) == 0))
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Returns the index of a free connection entry or -1 if all are in use
+int txq_free_link()
+// ------------------------------------------------------------------------------------------------
+{
+    int i;
+
+    for (i=0; i<TXQ_MAX_LINKS; i++)
+    {
+        if (txq_links[i].count == 0)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// === Public functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Empty all queues
+void txq_init(arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    int i;
+
+    for (i=0; i<TXQ_NB_CLASSES; i++)
+    {
+        kfq_init(&txq_queues[i]);
+        txq_deficit[i] = 0;
+    }
+
+    memset(txq_links, 0, sizeof(txq_links));
+    memset(txq_acks, 0, sizeof(txq_acks));
+    txq_ack_next = 0;
+    txq_thinning = arguments->tcp_ack_thinning;
+    txq_nb_acks = 0;
+    txq_nb_thinned = 0;
+    txq_untracked = 0;
+    txq_queued_bytes = 0;
+    txq_enabled = arguments->tx_priority;
+    txq_selected = TXQ_BULK;
+    txq_drr = TXQ_INTERACTIVE;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Move frames from the intake queue to the class queues until one is full. Returns the number of
+// frames moved.
+uint32_t txq_classify(kfq_t *intake)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t     *frame, key[TXQ_KEY_LEN], connected;
+    uint32_t    size, nb_frames = 0;
+    txq_class_t class;
+    int         link;
+
+    while ((frame = kfq_peek(intake, &size)))
+    {
+        if ((txq_thinning) && (txq_thin(frame, size))) // a queued ACK now carries it
+        {
+            kfq_pop(intake);
+            continue;
+        }
+
+        class = TXQ_BULK;
+        connected = (txq_enabled ? txq_inspect(frame, size, key, &class) : 0);
+        link = -1;
+
+        if (connected)
+        {
+            if ((link = txq_find_link(key)) >= 0) // keep the order of the connection
+            {
+                class = txq_links[link].class;
+            }
+            else if ((txq_untracked) || ((link = txq_free_link()) < 0)) // order is kept in bulk only
+            {
+                class = TXQ_BULK;
+                link = -1;
+            }
+        }
+
+        if (kfq_append(&txq_queues[class], frame, size))
+        {
+            break;
+        }
+
+        if ((connected) && (link < 0))
+        {
+            txq_untracked++;
+        }
+        else if (connected)
+        {
+            if (txq_links[link].count == 0)
+            {
+                memcpy(txq_links[link].key, key, TXQ_KEY_LEN);
+                txq_links[link].class = class;
+            }
+
+            txq_links[link].count++;
+        }
+
+        if ((txq_thinning) && (txq_ui_ack(frame, size)))
+        {
+            txq_remember_ack(kfq_tail(&txq_queues[class], &size), size);
+        }
+
+        verbprintf(4, "TXQ: frame of %d bytes in class %d\n", size, class);
+        txq_queued_bytes += size;
+        kfq_pop(intake);
+        nb_frames++;
+    }
+
+    return nb_frames;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Number of frames queued in all classes
+uint32_t txq_count()
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t count = 0;
+    int      i;
+
+    for (i=0; i<TXQ_NB_CLASSES; i++)
+    {
+        count += kfq_count(&txq_queues[i]);
+    }
+
+    return count;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Size of all frames queued in bytes
+uint32_t txq_bytes()
+// ------------------------------------------------------------------------------------------------
+{
+    return txq_queued_bytes;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Next frame to send starting with its type byte or NULL if all queues are empty. Peeking again
+// without popping returns the same frame.
+uint8_t *txq_peek(uint32_t *size)
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t     *frame;
+    txq_class_t class;
+
+    if (!txq_enabled) // single queue in arrival order
+    {
+        txq_selected = TXQ_BULK;
+        return kfq_peek(&txq_queues[TXQ_BULK], size);
+    }
+
+    for (class = TXQ_CONTROL; class < TXQ_INTERACTIVE; class++) // strict priority
+    {
+        if ((frame = kfq_peek(&txq_queues[class], size)))
+        {
+            txq_selected = class;
+            return frame;
+        }
+    }
+
+    if (kfq_count(&txq_queues[TXQ_INTERACTIVE]) + kfq_count(&txq_queues[TXQ_BULK]) == 0)
+    {
+        return NULL;
+    }
+
+    while (1) // deficit round robin
+    {
+        if (!(frame = kfq_peek(&txq_queues[txq_drr], size))) // an empty class keeps no credit
+        {
+            txq_deficit[txq_drr] = 0;
+        }
+        else if ((int32_t) *size <= txq_deficit[txq_drr])
+        {
+            txq_selected = txq_drr;
+            return frame;
+        }
+
+        txq_drr = (txq_drr == TXQ_INTERACTIVE ? TXQ_BULK : TXQ_INTERACTIVE);
+        txq_deficit[txq_drr] += TXQ_QUANTUM * txq_weights[txq_drr];
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Remove the frame returned by the last peek
+void txq_pop()
+// ------------------------------------------------------------------------------------------------
+{
+    uint8_t     *frame, key[TXQ_KEY_LEN];
+    uint32_t    size;
+    txq_class_t class;
+    int         link, i;
+
+    if (!(frame = kfq_peek(&txq_queues[txq_selected], &size)))
+    {
+        return;
+    }
+
+    for (i=0; (i<TXQ_MAX_ACKS) && (txq_thinning); i++) // sent ACKs cannot be replaced
+    {
+        if (txq_acks[i].frame == frame)
+        {
+            txq_acks[i].frame = NULL;
+        }
+    }
+
+    if ((txq_enabled) && (txq_inspect(frame, size, key, &class))) // connection frame
+    {
+        if ((link = txq_find_link(key)) >= 0)
+        {
+            txq_links[link].count--;
+        }
+        else if (txq_untracked)
+        {
+            txq_untracked--;
+        }
+    }
+
+    if ((txq_enabled) && (txq_selected >= TXQ_INTERACTIVE))
+    {
+        txq_deficit[txq_selected] -= size;
+    }
+
+    txq_queued_bytes -= size;
+    kfq_pop(&txq_queues[txq_selected]);
+}
@@ -0,0 +1,53 @@
+/******************************************************************************/
+/* PiCC1101  - Radio serial link using CC1101 module and Raspberry-Pi         */
+/*                                                                            */
+/* Tx priority queues                                                         */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef _TXQ_H_
+#define _TXQ_H_
+
+#include <stdint.h>
+
+#include "main.h"
+#include "kfq.h"
+
+#define TXQ_SMALL_FRAME  128  // Frames up to this size including the KISS type byte are interactive
+#define TXQ_MAX_LINKS     32  // AX.25 connections whose frames are kept in order
+#define TXQ_KEY_LEN       15  // KISS port and destination and source addresses of a connection
+#define TXQ_QUANTUM      256  // Bytes credited to a DRR class at each round times its weight
+#define TXQ_MAX_ACKS      16  // Queued TCP ACKs that later ACKs of the same flow can replace
+
+typedef enum txq_class_e
+{
+    TXQ_CONTROL = 0,   // AX.25 supervisory and unnumbered frames, small UI frames not carrying IP
+    TXQ_ACK,           // TCP segments with no data (pure ACKs)
+    TXQ_INTERACTIVE,   // Small frames
+    TXQ_BULK,          // Everything else
+    TXQ_NB_CLASSES
+} txq_class_t;
+
+typedef struct txq_link_s
+{
+    uint8_t     key[TXQ_KEY_LEN];  // Port and addresses with command/response and extension bits cleared
+    uint32_t    count;             // Frames of the connection queued. Entry is free if 0.
+    txq_class_t class;             // Class all frames of the connection go to while some are queued
+} txq_link_t;
+
+typedef struct txq_ack_s
+{
+    uint8_t  *frame;               // Frame in its class queue. NULL if the entry is free.
+    uint32_t size;                 // Frame size
+} txq_ack_t;
+
+void     txq_init(arguments_t *arguments);
+uint32_t txq_classify(kfq_t *intake);
+uint32_t txq_count();
+uint32_t txq_bytes();
+uint8_t *txq_peek(uint32_t *size);
+void     txq_pop();
+
+#endif
@@ -0,0 +1,171 @@
+/******************************************************************************/
+/* PiCC1101  - Radio serial link using CC1101 module and Raspberry-Pi         */
+/*                                                                            */
+/* Adaptive serial and radio concatenation windows                            */
+/*                                                                            */
+/* The serial window holds frames from the host for a while so that more of   */
+/* them go in the same superframe. Waiting pays off only if the next frame    */
+/* comes sooner than the time it takes to send a block. The window is 1.5     */
+/* times the average time between arrivals if that is less than the airtime   */
+/* of a block and none otherwise or once enough data is queued. The radio     */
+/* window is chosen the same way from the arrivals of superframes with two    */
+/* blocks of airtime as the limit.                                            */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "win.h"
+#include "util.h"
+
+static radio_parms_t  *win_radio_parms;
+static arguments_t    *win_arguments;
+static uint8_t        win_adaptive;          // Windows are adapted else the fixed values are used
+static struct timeval win_serial_last;       // Last arrival of serial frames. Zero if none yet.
+static struct timeval win_radio_last;        // Last arrival of a superframe. Zero if none yet.
+static uint32_t       win_serial_gap;        // Average time between serial arrivals in microseconds
+static uint32_t       win_radio_gap;         // Average time between superframe arrivals in microseconds
+static uint32_t       win_serial_us;         // Serial window last chosen
+static uint32_t       win_radio_us;          // Radio window last chosen
+static uint32_t       win_nb_superframes;    // Superframes sent since last statistics
+static uint32_t       win_nb_frames;         // Frames sent since last statistics
+static uint32_t       win_nb_bytes;          // Superframe bytes sent since last statistics
+
+// === Static functions declarations ==============================================================
+
+static uint32_t win_gap(struct timeval *last, uint32_t average);
+static uint32_t win_size(uint32_t average, uint32_t limit);
+
+// === Static functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Update the average time between arrivals with the time since the last one
+uint32_t win_gap(struct timeval *last, uint32_t average)
+// ------------------------------------------------------------------------------------------------
+{
+    struct timeval now, elapsed;
+    uint32_t gap;
+
+    gettimeofday(&now, NULL);
+
+    if ((last->tv_sec == 0) && (last->tv_usec == 0)) // first arrival
+    {
+        *last = now;
+        return average;
+    }
+
+    timeval_subtract(&elapsed, &now, last);
+    *last = now;
+    gap = (elapsed.tv_sec >= WIN_MAX_GAP_US / 1000000 ? WIN_MAX_GAP_US : ts_us(&elapsed));
+
+    if (average == 0) // second arrival
+    {
+        return gap;
+    }
+
+    return average - (average >> WIN_GAP_SHIFT) + (gap >> WIN_GAP_SHIFT);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Window for an average time between arrivals. None if the next arrival is not expected within
+// the limit.
+uint32_t win_size(uint32_t average, uint32_t limit)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t window = average + average / 2;
+
+    return ((average) && (window <= limit) ? window : 0);
+}
+
+// === Public functions ===========================================================================
+
+// ------------------------------------------------------------------------------------------------
+// Start with no window until arrivals are measured
+void win_init(radio_parms_t *radio_parms, arguments_t *arguments)
+// ------------------------------------------------------------------------------------------------
+{
+    win_radio_parms = radio_parms;
+    win_arguments = arguments;
+    win_adaptive = arguments->tnc_adaptive_windows;
+    win_serial_last.tv_sec = 0;
+    win_serial_last.tv_usec = 0;
+    win_radio_last = win_serial_last;
+    win_serial_gap = 0;
+    win_radio_gap = 0;
+    win_serial_us = (win_adaptive ? 0 : arguments->tnc_serial_window);
+    win_radio_us = (win_adaptive ? 0 : arguments->tnc_radio_window);
+    win_nb_superframes = 0;
+    win_nb_frames = 0;
+    win_nb_bytes = 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Frames arrived on the serial link. Returns the serial window in microseconds.
+uint32_t win_serial(uint32_t queued_bytes)
+// ------------------------------------------------------------------------------------------------
+{
+    uint32_t block_time;
+
+    if (!win_adaptive)
+    {
+        return win_serial_us;
+    }
+
+    win_serial_gap = win_gap(&win_serial_last, win_serial_gap);
+    block_time = radio_get_block_time(win_radio_parms, win_arguments); // follows rate changes
+
+    if (queued_bytes >= WIN_DEPTH_BLOCKS * radio_get_block_payload(win_arguments)) // large enough already
+    {
+        win_serial_us = 0;
+    }
+    else
+    {
+        win_serial_us = win_size(win_serial_gap, block_time);
+    }
+
+    verbprintf(4, "WIN: serial gap %d us, %d bytes queued, window %d us\n", win_serial_gap, queued_bytes, win_serial_us);
+    return win_serial_us;
+}
+
+// ------------------------------------------------------------------------------------------------
+// A superframe arrived on the radio link. Returns the radio window in microseconds.
+uint32_t win_radio()
+// ------------------------------------------------------------------------------------------------
+{
+    if (!win_adaptive)
+    {
+        return win_radio_us;
+    }
+
+    win_radio_gap = win_gap(&win_radio_last, win_radio_gap);
+    win_radio_us = win_size(win_radio_gap, 2 * radio_get_block_time(win_radio_parms, win_arguments));
+
+    verbprintf(4, "WIN: radio gap %d us, window %d us\n", win_radio_gap, win_radio_us);
+    return win_radio_us;
+}
+
+// ------------------------------------------------------------------------------------------------
+// A superframe was assembled. Prints the windows and the superframe sizes they gave regularly.
+void win_superframe(uint32_t nb_frames, uint32_t size)
+// ------------------------------------------------------------------------------------------------
+{
+    win_nb_superframes++;
+    win_nb_frames += nb_frames;
+    win_nb_bytes += size;
+
+    if (win_nb_superframes < WIN_STATS_PERIOD)
+    {
+        return;
+    }
+
+    verbprintf((win_adaptive ? 1 : 2), "WIN: serial window %.1f ms (gap %.1f ms), radio window %.1f ms (gap %.1f ms), %.1f frames and %d bytes per superframe\n",
+        win_serial_us / 1000.0, win_serial_gap / 1000.0, win_radio_us / 1000.0, win_radio_gap / 1000.0,
+        (float) win_nb_frames / win_nb_superframes, win_nb_bytes / win_nb_superframes);
+
+    win_nb_superframes = 0;
+    win_nb_frames = 0;
+    win_nb_bytes = 0;
+}
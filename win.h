@@ -0,0 +1,28 @@
+/******************************************************************************/
+/* PiCC1101  - Radio serial link using CC1101 module and Raspberry-Pi         */
+/*                                                                            */
+/* Adaptive serial and radio concatenation windows                            */
+/*                                                                            */
+/*                      (c) Edouard Griffiths, F4EXB, 2015                    */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef _WIN_H_
+#define _WIN_H_
+
+#include <stdint.h>
+
+#include "main.h"
+#include "radio.h"
+
+#define WIN_GAP_SHIFT        3  // Inter-arrival time average weighs the last gap by 1/8
+#define WIN_MAX_GAP_US 1000000  // Longer gaps are counted as this
+#define WIN_DEPTH_BLOCKS     8  // No serial window once this many blocks of data are queued
+#define WIN_STATS_PERIOD    32  // Superframes between statistics
+
+void     win_init(radio_parms_t *radio_parms, arguments_t *arguments);
+uint32_t win_serial(uint32_t queued_bytes);
+uint32_t win_radio();
+void     win_superframe(uint32_t nb_frames, uint32_t size);
+
+#endif